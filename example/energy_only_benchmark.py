@@ -0,0 +1,50 @@
+from simtk.openmm.app import *
+from simtk.openmm import *
+from simtk.unit import *
+from sys import stdout
+import os, time, shutil
+from datetime import datetime
+
+#times energy-only evaluations of AGBNPForce, as in Monte Carlo acceptance tests and rescoring,
+#against evaluations of energy and forces for the example systems with AGBNP1 and AGBNP2
+
+systems = ['trpcage', '1li2', 'rnaseh', '1dwc', '2clr']
+nevals = 20
+
+#Choose Reference or OpenCL platform
+
+platform = Platform.getPlatformByName('Reference')
+prop = {}
+#platform = Platform.getPlatformByName('OpenCL')
+#prop = {"OpenCLPrecision" : "single"}
+
+def timeStates(context, nevals, forces):
+    #AGBNPForce alone, in force group 1
+    start=datetime.now()
+    for i in range(nevals):
+        context.getState(getEnergy = True, getForces = forces, groups = 1<<1)
+    elapsed=datetime.now() - start
+    return (elapsed.seconds+elapsed.microseconds*1e-6)/nevals
+
+for name in systems:
+    for version in [1, 2]:
+        shutil.copyfile(name + '_agbnp1.dms', name + '_agbnp1_eo.dms')
+        testDes = DesmondDMSFile(name + '_agbnp1_eo.dms')
+        system = testDes.createSystem(nonbondedMethod=CutoffNonPeriodic,nonbondedCutoff=1*nanometer, OPLS = True, implicitSolvent='AGBNP')
+        agbnp = testDes._agbnp_force
+        agbnp.setVersion(version)
+        agbnp.setForceGroup(1)
+        integrator = VerletIntegrator(0.001*picoseconds)
+        context = Context(system, integrator, platform, prop)
+        context.setPositions(testDes.positions)
+        #warm up: neighbor lists, tree sizes, kernel compilation
+        context.getState(getEnergy = True, getForces = True, groups = 1<<1)
+
+        t_forces = timeStates(context, nevals, True)
+        t_energy = timeStates(context, nevals, False)
+
+        print("%s AGBNP%d: %d atoms, energy and forces %.2f ms, energy only %.2f ms, speedup %.2f" %
+              (name, version, system.getNumParticles(), 1000*t_forces, 1000*t_energy, t_forces/t_energy))
+        del context
+        testDes.close()
+        os.remove(name + '_agbnp1_eo.dms')
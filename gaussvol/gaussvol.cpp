@@ -4,22 +4,22 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include "openmm/reference/RealVec.h"
 #include "gaussvol.h"
 
 using namespace std;
 
-//counts overlaps
-static int _nov_ = 0; 
-
 
 /* overlap volume switching function + 1st derivative */
-RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volminb, RealOpenMM &sp){
+template <class T>
+static T switchfunc(T gvol, T volmina, T volminb, T &sp){
 
-  RealOpenMM swf = 0.0f;
-  RealOpenMM swfp = 1.0f;
-  RealOpenMM swd, swu, swu2, swu3, s;
+  T swf = 0.0f;
+  T swfp = 1.0f;
+  T swd, swu, swu2, swu3, s;
   if(gvol > volminb) {
     swf = 1.0f;
     swfp = 0.0f;
@@ -40,6 +40,14 @@ RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volmin
   return s;
 }
 
+RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volminb, RealOpenMM &sp){
+  return switchfunc(gvol, volmina, volminb, sp);
+}
+
+float pol_switchfunc(float gvol, float volmina, float volminb, float &sp){
+  return switchfunc(gvol, volmina, volminb, sp);
+}
+
 /* overlap between two Gaussians represented by a (V,c,a) triplet
    V: volume of Gaussian
    c: position of Gaussian
@@ -57,13 +65,33 @@ RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volmin
    d2VdVdr is (1/r) d^2V12/dV1 dr
 
 */
-RealOpenMM ogauss_alpha(GaussianVca &g1, GaussianVca &g2, GaussianVca &g12, RealOpenMM &dVdr, RealOpenMM &dVdV, RealOpenMM &sfp){
-  RealOpenMM d2, dx, dy, dz;
-  RealVec c1 = g1.c;
-  RealVec c2 = g2.c;
-  RealVec dist;
-  RealOpenMM deltai, gvol, p12, a12;
-  RealOpenMM s, sp, df, dgvol, dgvolv, ef, dgvola2, dgvola1, dgalpha, dgalpha2, dgvolvdr;
+template <class P>
+typename P::real ogauss_d2(typename P::real v1, typename P::real a1, typename P::real v2, typename P::real a2,
+			   typename P::real d2, typename P::real &gvol, typename P::real &sfp){
+  typedef typename P::real real;
+  real deltai = 1./(a1 + a2);
+  real df = a1*a2*deltai; // 1/alpha
+  real ef = exp(-df*d2);
+  real t = df/PI;
+  gvol = ( (v1 * v2)*(t*sqrt(t)) )*ef; // (df/pi)^(3/2) w/o pow()
+
+  /* switching function */
+  real sp;
+  real s = pol_switchfunc(gvol, (real)VOLMINA, (real)VOLMINB, sp);
+  sfp = sp*gvol+s;
+  return s*gvol;
+}
+
+template <class P>
+typename P::real ogauss_alpha(GaussianVcaT<P> &g1, GaussianVcaT<P> &g2, GaussianVcaT<P> &g12,
+			      typename P::real &dVdr, typename P::real &dVdV, typename P::real &sfp){
+  typedef typename P::real real;
+  real d2;
+  typename P::vec c1 = g1.c;
+  typename P::vec c2 = g2.c;
+  typename P::vec dist;
+  real deltai, gvol, a12;
+  real df, dgvol, dgvolv;
 
   dist = c2 - c1;
   d2 = dist.dot(dist);
@@ -72,8 +100,7 @@ RealOpenMM ogauss_alpha(GaussianVca &g1, GaussianVca &g2, GaussianVca &g12, Real
   deltai = 1./a12;
   df = (g1.a)*(g2.a)*deltai; // 1/alpha
 
-  ef = exp(-df*d2);
-  gvol = ( (g1.v * g2.v)/pow(PI/df,1.5))*ef;
+  real vs = ogauss_d2<P>(g1.v, g1.a, g2.v, g2.a, d2, gvol, sfp);
   dgvol = -2.f*df*gvol; // (1/r)*(dV/dr) w/o switching function
   dgvolv = g1.v > 0 ? gvol/g1.v : 0.0;     // (dV/dV1)  w/o switching function
 
@@ -83,48 +110,393 @@ RealOpenMM ogauss_alpha(GaussianVca &g1, GaussianVca &g2, GaussianVca &g12, Real
   g12.a = a12;
   g12.v = gvol;
 
-  /* switching function */
-  s = pol_switchfunc(gvol, VOLMINA, VOLMINB, sp);
-  sfp = sp*gvol+s;
   dVdr = dgvol;
   dVdV = dgvolv;
 
-  return s*gvol;
+  return vs;
+}
+
+
+/* the kernels of ogauss_alpha_batch() are compiled for AVX-512, AVX2 and the baseline
+   instruction set, and the version for the cpu is picked at load time */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define GAUSSVOL_TARGETS __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define GAUSSVOL_TARGETS
+#endif
+#define GAUSSVOL_RESTRICT __restrict
+
+template <class P>
+void GOverlap_BatchT<P>::resize(int n){
+  this->n = n;
+  if(n <= (int)v.size()) return;
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  a.resize(n);
+  v.resize(n);
+  cx.resize(n);
+  cy.resize(n);
+  cz.resize(n);
+  a12.resize(n);
+  v12.resize(n);
+  gvol.resize(n);
+  dVdr.resize(n);
+  dVdV.resize(n);
+  sfp.resize(n);
 }
 
+/* first part of ogauss_alpha_batch(): overlap Gaussians, prefactors (in v12) and
+   exponents (in gvol) */
+template <class T>
+GAUSSVOL_TARGETS
+static void ogauss_alpha_batch_pre(int n, T x1, T y1, T z1, T a1, T v1,
+				   const T * GAUSSVOL_RESTRICT x, const T * GAUSSVOL_RESTRICT y,
+				   const T * GAUSSVOL_RESTRICT z, const T * GAUSSVOL_RESTRICT a,
+				   const T * GAUSSVOL_RESTRICT v,
+				   T * GAUSSVOL_RESTRICT cx, T * GAUSSVOL_RESTRICT cy,
+				   T * GAUSSVOL_RESTRICT cz, T * GAUSSVOL_RESTRICT a12,
+				   T * GAUSSVOL_RESTRICT v12, T * GAUSSVOL_RESTRICT ex,
+				   T * GAUSSVOL_RESTRICT df){
+  for(int i = 0; i < n; i++){
+    T dx = x[i] - x1, dy = y[i] - y1, dz = z[i] - z1;
+    T d2 = dx*dx + dy*dy + dz*dz;
+    T aa = a1 + a[i];
+    T deltai = 1/aa;
+    T f = a1*a[i]*deltai;
+    T t = f/(T)PI;
+    cx[i] = ((x1 * a1) + (x[i] * a[i])) * deltai;
+    cy[i] = ((y1 * a1) + (y[i] * a[i])) * deltai;
+    cz[i] = ((z1 * a1) + (z[i] * a[i])) * deltai;
+    a12[i] = aa;
+    v12[i] = (v1 * v[i])*(t*sqrt(t));
+    ex[i] = -f*d2;
+    df[i] = f;
+  }
+}
+
+/* last part of ogauss_alpha_batch(): volumes, switching function and derivatives.
+   On input gvol holds the exponents and dVdr the df's */
+template <class T>
+GAUSSVOL_TARGETS
+static void ogauss_alpha_batch_post(int n, T v1,
+				    T * GAUSSVOL_RESTRICT v12, T * GAUSSVOL_RESTRICT gvol,
+				    T * GAUSSVOL_RESTRICT dVdr, T * GAUSSVOL_RESTRICT dVdV,
+				    T * GAUSSVOL_RESTRICT sfp){
+  T volmina = VOLMINA, volminb = VOLMINB;
+  T swd = 1.f/(volminb - volmina);
+  for(int i = 0; i < n; i++){
+    T g = v12[i]*gaussvol_exp(gvol[i]);
+    //pol_switchfunc()
+    T swu = (g - volmina)*swd;
+    T swu2 = swu*swu;
+    T swu3 = swu*swu2;
+    T s = swu3*(10.f-15.f*swu+6.f*swu2);
+    T sp = swd*30.f*swu2*(1.f - 2.f*swu + swu2);
+    s = g > volminb ? (T)1 : (g < volmina ? (T)0 : s);
+    sp = (g > volminb || g < volmina) ? (T)0 : sp;
+    v12[i] = g;
+    gvol[i] = s*g;
+    sfp[i] = sp*g+s;
+    dVdr[i] = -2.f*dVdr[i]*g;
+    dVdV[i] = v1 > 0 ? g/v1 : (T)0;
+  }
+}
+
+template <class P>
+void ogauss_alpha_batch(GaussianVcaT<P> &g1, GOverlap_BatchT<P> &b){
+  int n = b.size();
+  if(n <= 0) return;
+  ogauss_alpha_batch_pre(n, g1.c[0], g1.c[1], g1.c[2], g1.a, g1.v,
+			 &b.x[0], &b.y[0], &b.z[0], &b.a[0], &b.v[0],
+			 &b.cx[0], &b.cy[0], &b.cz[0], &b.a12[0],
+			 &b.v12[0], &b.gvol[0], &b.dVdr[0]);
+  ogauss_alpha_batch_post(n, g1.v, &b.v12[0], &b.gvol[0],
+			  &b.dVdr[0], &b.dVdV[0], &b.sfp[0]);
+}
+
+/* distance beyond which the overlap volume between two Gaussians with volumes no larger than
+   v1 and v2 and exponents no smaller than a1 and a2 is below VOLMINA.
+   The overlap volume at distance d is V = v1 v2 (df/pi)^(3/2) exp(-df d^2) with df = a1 a2/(a1 + a2).
+   For d^2 > 3/(2 df) V decreases with df, therefore the smallest exponents give an upper bound.
+   It is evaluated for each overlap of the tree, so log(x) is replaced by the upper bound e*log(2)
+   from the binary exponent of x = m 2^e (1/2 <= m < 1), which costs much less and makes
+   the distance only slightly larger. */
+RealOpenMM ogauss_reach(RealOpenMM v1, RealOpenMM a1, RealOpenMM v2, RealOpenMM a2){
+  if(v1 <= 0 || v2 <= 0) return 0;
+  RealOpenMM df = a1*a2/(a1 + a2);
+  RealOpenMM t = df/PI;
+  RealOpenMM d2 = 1.5/df;
+  int e;
+  frexp( (v1*v2)*(t*sqrt(t))/VOLMINA, &e );
+  RealOpenMM lv = e*M_LN2;
+  if(lv/df > d2) d2 = lv/df;
+  //small safety margin against roundoff
+  return 1.001*sqrt(d2);
+}
+
+void GCellGrid::build(vector<RealVec> &pos, vector<int> &active, RealOpenMM size){
+  int npoints = pos.size();
+  int nactive = 0;
+  RealVec cmin, cmax;
+  for(int i = 0; i < npoints; i++){
+    if(active[i] <= 0) continue;
+    if(nactive == 0){
+      cmin = cmax = pos[i];
+    }else{
+      for(int k = 0; k < 3; k++){
+	if(pos[i][k] < cmin[k]) cmin[k] = pos[i][k];
+	if(pos[i][k] > cmax[k]) cmax[k] = pos[i][k];
+      }
+    }
+    nactive += 1;
+  }
+  origin = cmin;
+  cell_size = size > 0 ? size : 1.0;
+
+  //limits the number of cells for very sparse sets of points
+  long maxcells = 8*(long)nactive + 64;
+  long nc;
+  do {
+    nc = 1;
+    for(int k = 0; k < 3; k++){
+      n[k] = nactive > 0 ? (int)((cmax[k] - cmin[k])/cell_size) + 1 : 1;
+      nc *= n[k];
+    }
+    if(nc > maxcells) cell_size *= 1.26;
+  } while(nc > maxcells);
+  ncells = nc;
+
+  //counting sort of the points by cell, in increasing point order within each cell
+  cell_of.resize(npoints);
+  cell_start.assign(ncells+1, 0);
+  for(int i = 0; i < npoints; i++){
+    cell_of[i] = -1;
+    if(active[i] <= 0) continue;
+    int ic[3];
+    for(int k = 0; k < 3; k++){
+      ic[k] = (int)((pos[i][k] - origin[k])/cell_size);
+      if(ic[k] >= n[k]) ic[k] = n[k] - 1;
+    }
+    cell_of[i] = (ic[2]*n[1] + ic[1])*n[0] + ic[0];
+    cell_start[cell_of[i]+1] += 1;
+  }
+  for(int c = 0; c < ncells; c++) cell_start[c+1] += cell_start[c];
+  cell_points.resize(nactive);
+  for(int i = 0; i < npoints; i++){
+    if(cell_of[i] < 0) continue;
+    int c = cell_of[i];
+    cell_points[cell_start[c]] = i;
+    cell_start[c] += 1;
+  }
+  //the fill above has shifted the start indexes by one cell, restore them
+  for(int c = ncells; c > 0; c--) cell_start[c] = cell_start[c-1];
+  cell_start[0] = 0;
+}
+
+void GCellGrid::neighbors(const RealVec &c, int imin, vector<int> &list){
+  list.clear();
+  if(ncells <= 0) return;
+  int ic[3], lo[3], hi[3];
+  for(int k = 0; k < 3; k++){
+    RealOpenMM x = (c[k] - origin[k])/cell_size;
+    if(x < -1 || x >= n[k] + 1) return;
+    ic[k] = x < 0 ? -1 : (int)x;
+    lo[k] = ic[k] - 1 < 0 ? 0 : ic[k] - 1;
+    hi[k] = ic[k] + 1 > n[k] - 1 ? n[k] - 1 : ic[k] + 1;
+  }
+  for(int iz = lo[2]; iz <= hi[2]; iz++){
+    for(int iy = lo[1]; iy <= hi[1]; iy++){
+      for(int ix = lo[0]; ix <= hi[0]; ix++){
+	int cell = (iz*n[1] + iy)*n[0] + ix;
+	for(int p = cell_start[cell]; p < cell_start[cell+1]; p++){
+	  if(cell_points[p] > imin) list.push_back(cell_points[p]);
+	}
+      }
+    }
+  }
+  sort(list.begin(), list.end());
+}
+
+GThreadPool::~GThreadPool(void){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  start_cv.notify_all();
+  for(int i = 0; i < (int)workers.size(); i++) workers[i].join();
+}
+
+void GThreadPool::dispatch(int nt, void (*fn)(const void *, int), const void *arg){
+  std::unique_lock<std::mutex> lock(mutex);
+  //new workers skip the calls made before they were started
+  while((int)workers.size() < nt - 1){
+    workers.push_back(std::thread(&GThreadPool::worker, this, (int)workers.size() + 1, generation));
+  }
+  this->fn = fn;
+  this->arg = arg;
+  ntasks = nt;
+  pending = nt - 1;
+  generation += 1;
+  lock.unlock();
+  start_cv.notify_all();
+  fn(arg, 0);
+  lock.lock();
+  while(pending > 0) done_cv.wait(lock);
+}
+
+void GThreadPool::worker(int t, long seen){
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true){
+    while(!quit && generation == seen) start_cv.wait(lock);
+    if(quit) return;
+    seen = generation;
+    if(t >= ntasks) continue;
+    void (*task_fn)(const void *, int) = fn;
+    const void *task_arg = arg;
+    lock.unlock();
+    task_fn(task_arg, t);
+    lock.lock();
+    pending -= 1;
+    if(pending == 0) done_cv.notify_one();
+  }
+}
 
 /* overlap comparison function */
-bool goverlap_compare( const GOverlap &overlap1, const GOverlap &overlap2) {
+template <class P>
+bool goverlap_compare( const GOverlapT<P> &overlap1, const GOverlapT<P> &overlap2) {
   /* order by volume, larger first */
   return overlap1.volume > overlap2.volume;
 }
 
+template <class P>
+void GOverlap_ArrayT<P>::resize(int n){
+  g.resize(n);
+  gamma1i.resize(n);
+  vmax.resize(n);
+  reach.resize(n);
+  level.resize(n);
+  atom.resize(n);
+  parent_index.resize(n);
+  sibling_index.resize(n);
+  children_startindex.resize(n);
+  children_count.resize(n);
+  volume.resize(n);
+  dvv1.resize(n);
+  dv1.resize(n);
+  sfp.resize(n);
+  self_volume.resize(n);
+}
+
+template <class P>
+void GOverlap_ArrayT<P>::reserve(int n){
+  g.reserve(n);
+  gamma1i.reserve(n);
+  vmax.reserve(n);
+  reach.reserve(n);
+  level.reserve(n);
+  atom.reserve(n);
+  parent_index.reserve(n);
+  sibling_index.reserve(n);
+  children_startindex.reserve(n);
+  children_count.reserve(n);
+  volume.reserve(n);
+  dvv1.reserve(n);
+  dv1.reserve(n);
+  sfp.reserve(n);
+  self_volume.reserve(n);
+}
+
+template <class P>
+void GOverlap_ArrayT<P>::set(int i, const GOverlapT<P> &ov){
+  g[i] = ov.g;
+  gamma1i[i] = ov.gamma1i;
+  vmax[i] = ov.vmax;
+  reach[i] = ov.reach;
+  level[i] = ov.level;
+  atom[i] = ov.atom;
+  parent_index[i] = ov.parent_index;
+  sibling_index[i] = ov.sibling_index;
+  children_startindex[i] = ov.children_startindex;
+  children_count[i] = ov.children_count;
+  volume[i] = ov.volume;
+  dvv1[i] = ov.dvv1;
+  dv1[i] = ov.dv1;
+  sfp[i] = ov.sfp;
+  self_volume[i] = ov.self_volume;
+}
+
+template <class P>
+void GOverlap_ArrayT<P>::get(int i, GOverlapT<P> &ov){
+  ov.g = g[i];
+  ov.gamma1i = gamma1i[i];
+  ov.vmax = vmax[i];
+  ov.reach = reach[i];
+  ov.level = level[i];
+  ov.atom = atom[i];
+  ov.parent_index = parent_index[i];
+  ov.sibling_index = sibling_index[i];
+  ov.children_startindex = children_startindex[i];
+  ov.children_count = children_count[i];
+  ov.volume = volume[i];
+  ov.dvv1 = dvv1[i];
+  ov.dv1 = dv1[i];
+  ov.sfp = sfp[i];
+  ov.self_volume = self_volume[i];
+}
+
+template <class P>
+void GOverlap_ArrayT<P>::copy(int i, GOverlap_ArrayT<P> &src, int j){
+  g[i] = src.g[j];
+  gamma1i[i] = src.gamma1i[j];
+  vmax[i] = src.vmax[j];
+  reach[i] = src.reach[j];
+  level[i] = src.level[j];
+  atom[i] = src.atom[j];
+  parent_index[i] = src.parent_index[j];
+  sibling_index[i] = src.sibling_index[j];
+  children_startindex[i] = src.children_startindex[j];
+  children_count[i] = src.children_count[j];
+  volume[i] = src.volume[j];
+  dvv1[i] = src.dvv1[j];
+  dv1[i] = src.dv1[j];
+  sfp[i] = src.sfp[j];
+  self_volume[i] = src.self_volume[j];
+}
 
-int GOverlap_Tree::init_overlap_tree(vector<RealVec> &pos,
+
+template <class P>
+int GOverlap_TreeT<P>::init_overlap_tree(vector<RealVec> &pos,
 				 vector<RealOpenMM> &radius, //atomic radii
 				 vector<RealOpenMM> &volume, //atomic volumes
 				 vector<RealOpenMM> &gamma,
 				 vector<int> &ishydrogen){
 
-  GOverlap overlap;
+  GOverlapT<P> overlap;
   
-  // reset tree
-  overlaps.clear();
+  // reset tree, the storage is kept and is grown ahead of time
+  // with some margin over the size of the last tree
+  int last_size = overlaps.size();
+  overlaps.reserve(last_size + last_size/8 + natoms + 1);
+  overlaps.resize(natoms+1);
 
   /* slot 0 contains the master tree information, children = all of the atoms */
   overlap.level = 0;
   overlap.volume = 0;
-  overlap.dv1 = RealVec(0,0,0);
+  overlap.dv1 = vec(0,0,0);
   overlap.dvv1 = 0.;
   overlap.self_volume = 0;
   overlap.sfp = 1.;
   overlap.gamma1i = 0.;
+  overlap.vmax = 0.;
+  overlap.reach = 0.;
   overlap.parent_index = -1;
+  overlap.sibling_index = -1;
   overlap.atom = -1;
   overlap.children_startindex = 1;
   overlap.children_count = natoms;
 
-  overlaps.push_back(overlap);
+  overlaps.set(0, overlap);
 
   /* list of atoms start at slot #1 */
   for(int iat=0; iat<natoms; iat++){
@@ -135,45 +507,68 @@ int GOverlap_Tree::init_overlap_tree(vector<RealVec> &pos,
     overlap.g.a = a;
     overlap.g.c = pos[iat];
     overlap.volume = vol;
-    overlap.dv1 = RealVec(0,0,0);
+    overlap.dv1 = vec(0,0,0);
     overlap.dvv1 = 1.; //dVi/dVi
     overlap.self_volume = 0.;
     overlap.sfp = 1.;
     overlap.gamma1i = gamma[iat];// gamma[iat]/SA_DR;
+    overlap.vmax = vol;
+    overlap.reach = 0.;
     overlap.parent_index = 0;
+    overlap.sibling_index = -1;
     overlap.atom = iat; 
     overlap.children_startindex = -1;
     overlap.children_count = -1;
-    overlaps.push_back(overlap);
+    overlaps.set(iat+1, overlap);
+  }
+
+  /* reach of the atoms, from the largest volume and the smallest exponent of the atoms
+     they can overlap with */
+  atom_vmax = atom_amin = 0;
+  for(int iat = 0; iat < natoms; iat++){
+    GaussianVcaT<P> &g = overlaps.g[iat+1];
+    if(g.v > 0){
+      if(g.v > atom_vmax) atom_vmax = g.v;
+      if(atom_amin <= 0 || g.a < atom_amin) atom_amin = g.a;
+    }
+  }
+  for(int iat = 0; iat < natoms; iat++){
+    GaussianVcaT<P> &g = overlaps.g[iat+1];
+    overlaps.reach[iat+1] = overlap_reach(g.v, g.a);
   }
 
   return 1;
 }
 
 /* adds to the tree the children of overlap identified by "parent_index" in the tree */
-int GOverlap_Tree::add_children(int parent_index, vector<GOverlap> &children_overlaps){
+template <class P>
+int GOverlap_TreeT<P>::add_children(int parent_index, vector< GOverlapT<P> > &children_overlaps, GOverlap_SubtreesT<P> *st){
   int i, ip, slot;
 
   /* adds children starting at the last slot */
-  int start_index = overlaps.size();
+  GOverlap_ArrayT<P> &tree_overlaps = st ? st->overlaps : overlaps;
+  int end = tree_overlaps.size();
+  int start_index = st ? st->base + end : end;
   
   int noverlaps = children_overlaps.size();
 
-  /* retrieves address of root overlap */
-  GOverlap *root = &(overlaps[parent_index]);
+  /* retrieves root overlap */
+  int iroot;
+  GOverlap_ArrayT<P> &root = overlap_at(parent_index, st, iroot);
 
   /* registers list of children */
-  root->children_startindex = start_index;
-  root->children_count = noverlaps;
+  root.children_startindex[iroot] = start_index;
+  root.children_count[iroot] = noverlaps;
 
   /* sort neighbors by overlap volume */
   //if(root->level == 1){
-  sort(children_overlaps.begin(), children_overlaps.end(), goverlap_compare);
+  sort(children_overlaps.begin(), children_overlaps.end(), goverlap_compare<P>);
     //}
 
-  int root_level = root->level;
+  int root_level = root.level[iroot];
 
   /* now copies the children overlaps from temp buffer */
+  tree_overlaps.resize(end + noverlaps);
   for(int ip=0;ip<noverlaps;ip++){
     children_overlaps[ip].level = root_level + 1;
     // connect overlap to parent
@@ -182,19 +577,17 @@ int GOverlap_Tree::add_children(int parent_index, vector<GOverlap> &children_ove
     children_overlaps[ip].children_startindex = -1;
     children_overlaps[ip].children_count = -1;
     // add to tree
-    // note that the 'root' pointer may be invalidated by the push back below
-    overlaps.push_back(children_overlaps[ip]);
+    tree_overlaps.set(end + ip, children_overlaps[ip]);
   }
 
-  _nov_ += noverlaps;
-
   return start_index;
 }
 
 
 /* scans the siblings of overlap identified by "root_index" to create children overlaps,
    returns them into the "children_overlaps" buffer: (root) + (atom) -> (root, atom) */
-int GOverlap_Tree::compute_children(int root_index, vector<GOverlap> &children_overlaps){
+template <class P>
+int GOverlap_TreeT<P>::compute_children(int root_index, vector< GOverlapT<P> > &children_overlaps, GOverlap_SubtreesT<P> *st){
   int parent_index;
   int sibling_start, sibling_count;
   int j;
@@ -203,45 +596,104 @@ int GOverlap_Tree::compute_children(int root_index, vector<GOverlap> &children_o
   children_overlaps.clear();
 
   /* retrieves overlap */
-  GOverlap &root = overlaps[root_index];
+  int iroot;
+  GOverlap_ArrayT<P> &root = overlap_at(root_index, st, iroot);
   
   /* retrieves parent overlap */
-  parent_index = root.parent_index;
+  parent_index = root.parent_index[iroot];
   if(parent_index < 0) return 1;//master root? can't do compute_children() on master root
-  if(root.level >= MAX_ORDER) return 1;
-  GOverlap &parent = overlaps[parent_index];
+  int root_level = root.level[iroot];
+  if(root_level >= MAX_ORDER) return 1;
+  int iparent;
+  GOverlap_ArrayT<P> &parent = overlap_at(parent_index, st, iparent);
 
   /* retrieves start index and count of siblings */
-  sibling_start = parent.children_startindex;
-  sibling_count = parent.children_count;
+  sibling_start = parent.children_startindex[iparent];
+  sibling_count = parent.children_count[iparent];
   if(sibling_start < 0 || sibling_count < 0) return -1; //parent is not initialized?
   if(root_index < sibling_start && root_index > sibling_start + sibling_count -1 ) return -1; //this overlap somehow is not the child of registered parent
 
-  /* now loops over "younger" siblings (i<j loop) to compute new overlaps */
-  for(int slotj=root_index+1; slotj<sibling_start + sibling_count; slotj++){
-    GaussianVca g12;
-    GOverlap &sibling = overlaps[slotj];
-    RealOpenMM gvol, dVdr,dVdV, sfp;
-
-    /* atomic gaussian of last atom of sibling */
-    int atom2 = sibling.atom;
-    GaussianVca &g1 = root.g;
-    GaussianVca &g2 = overlaps[atom2+1].g; //atoms are stored in the tree at indexes 1...N
-    gvol = ogauss_alpha(g1, g2, g12, dVdr, dVdV, sfp);
+  /* the candidate siblings of 2-body overlaps are the atoms in the neighboring cells of
+     the atom grid (in increasing order as in the full scan below) */
+  bool use_grid = (root_level == 1 && atom_grid.ncells > 0);
+  int ncandidates = sibling_start + sibling_count - (root_index+1);
+  vector<int> &candidates = st ? st->candidates : grid_candidates;
+  if(use_grid){
+    atom_grid.neighbors(root.g[iroot].c, root.atom[iroot], candidates);
+    ncandidates = candidates.size();
+  }
 
-    /* create child if overlap volume is not zero */
-    if(gvol > MIN_GVOL){
-      GOverlap ov;
-      ov.g = g12;
-      ov.volume = gvol;
+  /* gathers the atomic gaussians of the last atoms of the "younger" siblings (i<j loop).
+     Those farther than the reach of this overlap can not form an overlap and are skipped
+     without evaluating it */
+  GaussianVcaT<P> &g1 = root.g[iroot];
+  real reach = root.reach[iroot];
+  real reach2 = reach*reach;
+  GOverlap_BatchT<P> &batch = st ? st->batch : this->batch;
+  vector<int> &batch_atoms = st ? st->batch_atoms : this->batch_atoms;
+  vector<int> &batch_siblings = st ? st->batch_siblings : this->batch_siblings;
+  batch.resize(ncandidates);
+  batch_atoms.resize(ncandidates);
+  batch_siblings.resize(ncandidates);
+  int nb = 0;
+  for(int k = 0; k < ncandidates; k++){
+    int slotj = use_grid ? candidates[k] + 1 : root_index + 1 + k;
+    int isibling;
+    GOverlap_ArrayT<P> &sibling = overlap_at(slotj, st, isibling);
+    int atom2 = sibling.atom[isibling];
+    GaussianVcaT<P> &g2 = overlaps.g[atom2+1]; //atoms are stored in the tree at indexes 1...N
+    vec dist = g2.c - g1.c;
+    if(dist.dot(dist) > reach2) continue;
+    batch_atoms[nb] = atom2;
+    batch_siblings[nb] = slotj;
+    batch.x[nb] = g2.c[0];
+    batch.y[nb] = g2.c[1];
+    batch.z[nb] = g2.c[2];
+    batch.a[nb] = g2.a;
+    batch.v[nb] = g2.v;
+    nb += 1;
+  }
+  batch.resize(nb);
+
+  /* now computes the overlaps with all of them at once */
+  real gamma1 = root.gamma1i[iroot];
+  real vmax1 = root.vmax[iroot];
+  ogauss_alpha_batch(g1, batch);
+
+  for(int k = 0; k < nb; k++){
+    int atom2 = batch_atoms[k];
+    GaussianVcaT<P> &g2 = overlaps.g[atom2+1];
+    /* create child if overlap volume is not zero. In incremental mode the overlap is kept
+       if it can be above threshold once the distance has shrunk by the skin, using
+       the same bound for the parent volume */
+    real vmax = batch.v12[k];
+    bool keep = batch.gvol[k] > MIN_GVOL;
+    if(skin > 0){
+      vec dist = g2.c - g1.c;
+      real d = sqrt(dist.dot(dist)) - skin;
+      if(d < 0) d = 0;
+      real df = g1.a*g2.a/(g1.a + g2.a);
+      real t = df/PI;
+      vmax = (vmax1*g2.v)*(t*sqrt(t))*exp(-df*d*d);
+      keep = vmax > VOLMINA;
+    }
+    if(keep){
+      GOverlapT<P> ov;
+      ov.g.c = vec(batch.cx[k], batch.cy[k], batch.cz[k]);
+      ov.g.a = batch.a12[k];
+      ov.g.v = batch.v12[k];
+      ov.volume = batch.gvol[k];
       ov.self_volume = 0;
       ov.atom = atom2;
+      ov.sibling_index = batch_siblings[k];
       // dv1 is the gradient of V(123..)n with respect to the position of 1
-      ov.dv1 = ( g2.c - g1.c ) * (-dVdr);
+      ov.dv1 = ( g2.c - g1.c ) * (-batch.dVdr[k]);
       //dvv1 is the derivative of V(123...)n with respect to V(123...)
-      ov.dvv1 = dVdV;
-      ov.sfp = sfp;
-      ov.gamma1i = root.gamma1i + overlaps[atom2+1].gamma1i;
+      ov.dvv1 = batch.dVdV[k];
+      ov.sfp = batch.sfp[k];
+      ov.gamma1i = gamma1 + overlaps.gamma1i[atom2+1];
+      ov.vmax = vmax;
+      ov.reach = root_level + 1 < MAX_ORDER ? overlap_reach(vmax, ov.g.a) : 0;
       children_overlaps.push_back(ov);
     }
   }
@@ -250,36 +702,68 @@ int GOverlap_Tree::compute_children(int root_index, vector<GOverlap> &children_o
 }
 
 
-/*rescan the sub-tree to recompute the volumes, does not modify the tree */
-int GOverlap_Tree::rescan_r(int slot){
-  int parent_index;
-  int sibling_start, sibling_count;
+/* bins the atoms of the 1-body level into cells as large as the largest possible reach
+   of a 2-body overlap. Atoms with zero volume (hydrogens) never overlap and are left out. */
+template <class P>
+int GOverlap_TreeT<P>::init_atom_grid(void){
+  grid_pos.resize(natoms);
+  grid_active.resize(natoms);
+  for(int iat = 0; iat < natoms; iat++){
+    GaussianVcaT<P> &g = overlaps.g[iat+1];
+    grid_pos[iat] = g.c;
+    grid_active[iat] = g.v > 0 ? 1 : 0;
+  }
+  atom_grid.build(grid_pos, grid_active, overlap_reach(atom_vmax, atom_amin));
+  return 1;
+}
 
+/*rescan the sub-tree to recompute the volumes, does not modify the tree */
+template <class P>
+int GOverlap_TreeT<P>::rescan_r(int slot){
   /* this overlap  */
-  GOverlap &ov = overlaps[slot];
-
-  /* recompute its own overlap by merging parent and last atom */
-  parent_index = ov.parent_index;
-  if(parent_index > 0){
-    GaussianVca g12;
-    RealOpenMM dVdr,dVdV, dVdalpha, d2Vdalphadr, d2VdVdr, sfp;
-    int atom = ov.atom;
-    GOverlap &parent  = overlaps[parent_index];
-    GaussianVca &g1 = parent.g;
-    GaussianVca &g2 = overlaps[atom+1].g; //atoms are stored in the tree at indexes 1...N
-    RealOpenMM gvol = ogauss_alpha(g1,g2, g12,dVdr,dVdV,sfp);
-    ov.g = g12;
-    ov.volume = gvol;
-    // dv1 is the gradient of V(123..)n with respect to the position of 1
-    ov.dv1 = ( g2.c - g1.c ) * (-dVdr);
-    //dvv1 is the derivative of V(123...)n with respect to V(123...)
-    ov.dvv1 = dVdV;
-    ov.sfp = sfp;
-    ov.gamma1i = parent.gamma1i + overlaps[atom+1].gamma1i;
+  GOverlap_ArrayT<P> &ov = overlaps;
+  int start = ov.children_startindex[slot], count = ov.children_count[slot];
+  if(start < 0 || count <= 0) return 1;
+
+  /* recompute the overlaps of the children by merging this overlap and their last atoms
+     (the atoms, children of the master root, are not recomputed) */
+  if(slot > 0){
+    GaussianVcaT<P> g1 = ov.g[slot];
+    /* in incremental mode the tree includes overlaps below threshold; their volume is
+       zeroed for their children so that the whole subtree contributes nothing, as if it
+       was not in the tree. The siblings of this overlap are already updated. */
+    if(skin > 0 && ov.volume[slot] <= 0) g1.v = 0;
+    batch.resize(count);
+    for(int k = 0; k < count; k++){
+      GaussianVcaT<P> &g2 = ov.g[ov.atom[start+k]+1]; //atoms are stored in the tree at indexes 1...N
+      batch.x[k] = g2.c[0];
+      batch.y[k] = g2.c[1];
+      batch.z[k] = g2.c[2];
+      batch.a[k] = g2.a;
+      batch.v[k] = g2.v;
+      //same for the overlaps formed with a sibling below threshold
+      if(skin > 0 && ov.volume[ov.sibling_index[start+k]] <= 0) batch.v[k] = 0;
+    }
+    ogauss_alpha_batch(g1, batch);
+    for(int k = 0; k < count; k++){
+      int slot_child = start + k;
+      int atom = ov.atom[slot_child];
+      GaussianVcaT<P> &g2 = ov.g[atom+1];
+      ov.g[slot_child].c = vec(batch.cx[k], batch.cy[k], batch.cz[k]);
+      ov.g[slot_child].a = batch.a12[k];
+      ov.g[slot_child].v = batch.v12[k];
+      ov.volume[slot_child] = batch.gvol[k];
+      // dv1 is the gradient of V(123..)n with respect to the position of 1
+      ov.dv1[slot_child] = ( g2.c - g1.c ) * (-batch.dVdr[k]);
+      //dvv1 is the derivative of V(123...)n with respect to V(123...)
+      ov.dvv1[slot_child] = batch.dVdV[k];
+      ov.sfp[slot_child] = batch.sfp[k];
+      ov.gamma1i[slot_child] = ov.gamma1i[slot] + ov.gamma1i[atom+1];
+    }
   }
   
   /* calls itself recursively on the children */
-  for(int slot_child=ov.children_startindex ; slot_child < ov.children_startindex+ov.children_count ; slot_child++){
+  for(int slot_child=start ; slot_child < start+count ; slot_child++){
     rescan_r(slot_child);
   }
 
@@ -287,7 +771,8 @@ int GOverlap_Tree::rescan_r(int slot){
 }
 
 /*rescan the tree to recompute the volumes, does not modify the tree */
-int GOverlap_Tree::rescan_tree_v(vector<RealVec> &pos,
+template <class P>
+int GOverlap_TreeT<P>::rescan_tree_v(vector<RealVec> &pos,
 				 vector<RealOpenMM> &radius,
 				 vector<RealOpenMM> &volume,
 				 vector<RealOpenMM> &gamma,
@@ -295,31 +780,30 @@ int GOverlap_Tree::rescan_tree_v(vector<RealVec> &pos,
 
   int slot;
   
+  GOverlap_ArrayT<P> &ov = overlaps;
   slot = 0;
-  GOverlap *ov = &(overlaps[slot]);
-  ov->level = 0;
-  ov->volume = 0;
-  ov->dv1 = RealVec(0,0,0);
-  ov->dvv1 = 0.;
-  ov->self_volume = 0;
-  ov->sfp = 1.;
-  ov->gamma1i = 0.;
+  ov.level[slot] = 0;
+  ov.volume[slot] = 0;
+  ov.dv1[slot] = vec(0,0,0);
+  ov.dvv1[slot] = 0.;
+  ov.self_volume[slot] = 0;
+  ov.sfp[slot] = 1.;
+  ov.gamma1i[slot] = 0.;
 
   slot = 1;
   for(int iat=0;iat<natoms;iat++, slot++){
     RealOpenMM a = KFC/(radius[iat]*radius[iat]);
     RealOpenMM vol = ishydrogen[iat] > 0 ? 0. : volume[iat];
-    ov = &(overlaps[slot]);
-    ov->level = 1;
-    ov->g.v = vol;
-    ov->g.a = a;
-    ov->g.c = pos[iat];
-    ov->volume = vol;
-    ov->dv1 = RealVec(0,0,0);
-    ov->dvv1 = 1.; //dVi/dVi
-    ov->self_volume = 0.;
-    ov->sfp = 1.;
-    ov->gamma1i = gamma[iat]; // gamma[iat]/SA_DR;
+    ov.level[slot] = 1;
+    ov.g[slot].v = vol;
+    ov.g[slot].a = a;
+    ov.g[slot].c = pos[iat];
+    ov.volume[slot] = vol;
+    ov.dv1[slot] = vec(0,0,0);
+    ov.dvv1[slot] = 1.; //dVi/dVi
+    ov.self_volume[slot] = 0.;
+    ov.sfp[slot] = 1.;
+    ov.gamma1i[slot] = gamma[iat]; // gamma[iat]/SA_DR;
    }
 
   rescan_r(0);
@@ -327,23 +811,23 @@ int GOverlap_Tree::rescan_tree_v(vector<RealVec> &pos,
 }
 
 /*rescan the sub-tree to recompute the gammas, does not modify the volumes nor the tree */
-int GOverlap_Tree::rescan_gamma_r(int slot){
+template <class P>
+int GOverlap_TreeT<P>::rescan_gamma_r(int slot){
   int parent_index;
-  int sibling_start, sibling_count;
 
   /* this overlap  */
-  GOverlap &ov = overlaps[slot];
+  GOverlap_ArrayT<P> &ov = overlaps;
 
   /* recompute its own overlap by merging parent and last atom */
-  parent_index = ov.parent_index;
+  parent_index = ov.parent_index[slot];
   if(parent_index > 0){
-    int atom = ov.atom;
-    GOverlap &parent  = overlaps[parent_index];
-    ov.gamma1i = parent.gamma1i + overlaps[atom+1].gamma1i;
+    int atom = ov.atom[slot];
+    ov.gamma1i[slot] = ov.gamma1i[parent_index] + ov.gamma1i[atom+1];
   }
   
   /* calls itself recursively on the children */
-  for(int slot_child=ov.children_startindex ; slot_child < ov.children_startindex+ov.children_count ; slot_child++){
+  int start = ov.children_startindex[slot], count = ov.children_count[slot];
+  for(int slot_child=start ; slot_child < start+count ; slot_child++){
     rescan_gamma_r(slot_child);
   }
 
@@ -353,18 +837,17 @@ int GOverlap_Tree::rescan_gamma_r(int slot){
 
 
 /*rescan the tree to recompute the gammas only, does not modify volumes and the tree */
-int GOverlap_Tree::rescan_tree_g(vector<RealOpenMM> &gamma){
+template <class P>
+int GOverlap_TreeT<P>::rescan_tree_g(vector<RealOpenMM> &gamma){
 
   int slot;
   
   slot = 0;
-  GOverlap *ov = &(overlaps[slot]);
-  ov->gamma1i = 0.;
+  overlaps.gamma1i[slot] = 0.;
 
   slot = 1;
   for(int iat=0;iat<natoms;iat++, slot++){
-    ov = &(overlaps[slot]);
-    ov->gamma1i = gamma[iat];
+    overlaps.gamma1i[slot] = gamma[iat];
    }
 
   rescan_gamma_r(0);
@@ -373,74 +856,185 @@ int GOverlap_Tree::rescan_tree_g(vector<RealOpenMM> &gamma){
 
 
 
-int GOverlap_Tree::compute_andadd_children_r(int root){
-  vector<GOverlap> children_overlaps;
-  compute_children(root, children_overlaps);
+/* the children are copied into the tree by add_children() before descending into them,
+   so a single scratch buffer for the tree (or for each thread subtree storage) is reused
+   at all levels of the recursion and does not allocate once it has grown */
+template <class P>
+int GOverlap_TreeT<P>::compute_andadd_children_r(int root, GOverlap_SubtreesT<P> *st){
+  vector< GOverlapT<P> > &children_overlaps = st ? st->children : children;
+  compute_children(root, children_overlaps, st);
   int noverlaps = children_overlaps.size();
   if(noverlaps>0){
-    int start_slot = add_children(root, children_overlaps);
+    int start_slot = add_children(root, children_overlaps, st);
     for (int ichild=start_slot; ichild < start_slot + noverlaps ; ichild++){
-      compute_andadd_children_r(ichild);
+      compute_andadd_children_r(ichild, st);
     }
   }
   return 1;
 }
 
-int GOverlap_Tree::compute_overlap_tree_r(vector<RealVec> &pos, vector<RealOpenMM> &radius,
+template <class P>
+int GOverlap_TreeT<P>::compute_overlap_tree_r(vector<RealVec> &pos, vector<RealOpenMM> &radius,
 					  vector<RealOpenMM> &volume,
 					  vector<RealOpenMM> &gamma, vector<int> &ishydrogen){
   init_overlap_tree(pos, radius, volume, gamma, ishydrogen);
+  init_atom_grid();
+  if(nthreads > 1 && natoms > 1){
+    return compute_subtrees_threads();
+  }
   for(int slot = 1; slot <= natoms ; slot++){
     compute_andadd_children_r(slot);
   }
   return 1;
 }
 
+/* the range of atoms [lo,hi) of a thread is packed in a single atomic word as lo<<32|hi
+   so that the owner and thieves can update it with a compare-and-swap */
+static inline unsigned long long pack_range(unsigned int lo, unsigned int hi){
+  return ((unsigned long long)lo << 32) | hi;
+}
+
+/* grows the subtrees of the atoms in parallel. The subtree of an atom only depends
+   on the 1-body level and on its own overlaps, so each thread grows the subtrees of its atoms
+   independently into its own storage. Each thread starts with a contiguous range of atoms and,
+   when done, steals the upper half of the remaining range of another thread. This balances
+   buried atoms with large subtrees against surface atoms with small ones.
+   Finally the subtrees are copied in atom order into the tree, which is then the same as
+   the one grown serially by compute_overlap_tree_r(). */
+template <class P>
+int GOverlap_TreeT<P>::compute_subtrees_threads(void){
+  int nt = nthreads < natoms ? nthreads : natoms;
+  int base = natoms + 1; //all thread subtrees start past the 1-body level
+  subtrees.resize(nt);
+  subtree_thread.resize(natoms);
+  subtree_start.resize(natoms);
+  subtree_size.resize(natoms);
+  if((int)subtree_ranges.size() < nt) subtree_ranges = vector< std::atomic<unsigned long long> >(nt);
+  vector< std::atomic<unsigned long long> > &ranges = subtree_ranges;
+  for(int t = 0; t < nt; t++){
+    subtrees[t].base = base;
+    subtrees[t].overlaps.clear();
+    ranges[t].store(pack_range((long)natoms*t/nt, (long)natoms*(t+1)/nt));
+  }
+
+  pool.run(nt, [this, nt, &ranges](int t){
+      GOverlap_SubtreesT<P> &st = subtrees[t];
+      int victim = t;
+      while(true){
+	//takes the next atom from the front of the own range
+	unsigned long long r = ranges[t].load();
+	unsigned int lo = r >> 32, hi = r & 0xffffffff;
+	if(lo < hi){
+	  if(!ranges[t].compare_exchange_weak(r, pack_range(lo+1, hi))) continue;
+	  int atom = lo;
+	  int start = st.overlaps.size();
+	  compute_andadd_children_r(atom+1, &st);
+	  subtree_thread[atom] = t;
+	  subtree_start[atom] = start;
+	  subtree_size[atom] = st.overlaps.size() - start;
+	  continue;
+	}
+	//own range is empty, steals the upper half of the range of another thread
+	bool stolen = false;
+	for(int k = 1; k < nt && !stolen; k++){
+	  victim = (victim + 1) % nt;
+	  if(victim == t) victim = (victim + 1) % nt;
+	  unsigned long long rv = ranges[victim].load();
+	  unsigned int vlo = rv >> 32, vhi = rv & 0xffffffff;
+	  while(vlo < vhi){
+	    unsigned int mid = vlo + (vhi - vlo)/2;
+	    if(ranges[victim].compare_exchange_weak(rv, pack_range(vlo, mid))){
+	      ranges[t].store(pack_range(mid, vhi));
+	      stolen = true;
+	      break;
+	    }
+	    vlo = rv >> 32; vhi = rv & 0xffffffff;
+	  }
+	}
+	if(!stolen) break;
+      }
+    });
+
+  //places the subtrees in atom order after the 1-body level
+  vector<int> &shift = subtree_shift;
+  shift.resize(natoms);
+  int size = base;
+  for(int atom = 0; atom < natoms; atom++){
+    shift[atom] = size - (base + subtree_start[atom]);
+    size += subtree_size[atom];
+  }
+  overlaps.resize(size);
+
+  //copies the subtrees into the tree relocating the indexes past the 1-body level
+  pool.run(nt, [this, nt, base, &shift](int t){
+      for(int atom = (long)natoms*t/nt; atom < (long)natoms*(t+1)/nt; atom++){
+	GOverlap_SubtreesT<P> &st = subtrees[subtree_thread[atom]];
+	int sh = shift[atom];
+	if(overlaps.children_startindex[atom+1] >= base) overlaps.children_startindex[atom+1] += sh;
+	for(int i = subtree_start[atom]; i < subtree_start[atom] + subtree_size[atom]; i++){
+	  int slot = base + i + sh;
+	  overlaps.copy(slot, st.overlaps, i);
+	  if(overlaps.parent_index[slot] >= base) overlaps.parent_index[slot] += sh;
+	  if(overlaps.sibling_index[slot] >= base) overlaps.sibling_index[slot] += sh;
+	  if(overlaps.children_startindex[slot] >= base) overlaps.children_startindex[slot] += sh;
+	}
+      }
+    });
+
+  return 1;
+}
+
 /* compute volumes, energy of this volume and calls itself to get the volumes of the children */
-int GOverlap_Tree::compute_volume_underslot2_r
+template <class P>
+int GOverlap_TreeT<P>::compute_volume_underslot2_r
 (
  int slot,
- RealOpenMM &psi1i, RealOpenMM &f1i, RealVec &p1i, //subtree accumulators for free volume
- RealOpenMM &psip1i, RealOpenMM &fp1i, RealVec &pp1i, //subtree accumulators for self volume
- RealOpenMM &energy1i, RealOpenMM &fenergy1i, RealVec &penergy1i, //subtree accumulators for volume-based energy
- vector<RealVec> &dr,          //gradients of volume-based energy wrt to atom positions
- vector<RealOpenMM> &dv,          //gradients of volume-based energy wrt to atomic volumes
- vector<RealOpenMM> &free_volume, //atomic free volumes
- vector<RealOpenMM> &self_volume  //atomic self volumes
+ accum &psi1i, accum &f1i, accum_vec &p1i, //subtree accumulators for free volume
+ accum &psip1i, accum &fp1i, accum_vec &pp1i, //subtree accumulators for self volume
+ accum &energy1i, accum &fenergy1i, accum_vec &penergy1i, //subtree accumulators for volume-based energy
+ vector<accum_vec> &dr,          //gradients of volume-based energy wrt to atom positions
+ vector<accum> &dv,          //gradients of volume-based energy wrt to atomic volumes
+ vector<accum> &free_volume, //atomic free volumes
+ vector<accum> &self_volume  //atomic self volumes
 ){
 
-  GOverlap &ov = overlaps[slot];
-  RealOpenMM cf = ov.level % 2 == 0 ? -1.0 : 1.0;
-  RealOpenMM volcoeff  = ov.level > 0 ? cf : 0;
-  RealOpenMM volcoeffp = ov.level > 0 ? volcoeff/(RealOpenMM)ov.level : 0;
+  GOverlap_ArrayT<P> &ov = overlaps;
+  int level = ov.level[slot];
+  accum cf = level % 2 == 0 ? -1.0 : 1.0;
+  accum volcoeff  = level > 0 ? cf : 0;
+  accum volcoeffp = level > 0 ? volcoeff/(accum)level : 0;
 
-  int atom = ov.atom;
-  RealOpenMM ai = overlaps[atom+1].g.a;
-  RealOpenMM a1i = ov.g.a;
-  RealOpenMM a1 = a1i - ai;
+  int atom = ov.atom[slot];
+  accum ai = ov.g[atom+1].a;
+  accum a1i = ov.g[slot].a;
+  accum a1 = a1i - ai;
  
   int i,j;
-  RealOpenMM c1, c1p, c2;
+  accum c1, c1p, c2;
 
-  psi1i = volcoeff*ov.volume; //for free volumes
-  f1i = volcoeff*ov.sfp ;
-  p1i = RealVec(0,0,0);
+  accum volume = ov.volume[slot];
+  accum sfp = ov.sfp[slot];
+  accum gamma1i = ov.gamma1i[slot];
 
-  psip1i = volcoeffp*ov.volume; //for self volumes
-  fp1i = volcoeffp*ov.sfp;
-  pp1i = RealVec(0,0,0);
+  psi1i = volcoeff*volume; //for free volumes
+  f1i = volcoeff*sfp ;
+  p1i = accum_vec(0,0,0);
 
-  energy1i = volcoeffp*ov.gamma1i*ov.volume; //EV energy
-  fenergy1i = volcoeffp*ov.sfp*ov.gamma1i;
-  penergy1i = RealVec(0,0,0);
+  psip1i = volcoeffp*volume; //for self volumes
+  fp1i = volcoeffp*sfp;
+  pp1i = accum_vec(0,0,0);
 
+  energy1i = volcoeffp*gamma1i*volume; //EV energy
+  fenergy1i = volcoeffp*sfp*gamma1i;
+  penergy1i = accum_vec(0,0,0);
 
-  if(ov.children_startindex >= 0){
+  int start = ov.children_startindex[slot], count = ov.children_count[slot];
+  if(start >= 0){
     int sloti;
-    for(int sloti=ov.children_startindex ; sloti < ov.children_startindex+ov.children_count ; sloti++){
-      RealOpenMM psi1it, f1it; RealVec p1it;
-      RealOpenMM psip1it, fp1it; RealVec pp1it;
-      RealOpenMM energy1it, fenergy1it; RealVec penergy1it;
+    for(int sloti=start ; sloti < start+count ; sloti++){
+      accum psi1it, f1it; accum_vec p1it;
+      accum psip1it, fp1it; accum_vec pp1it;
+      accum energy1it, fenergy1it; accum_vec penergy1it;
       compute_volume_underslot2_r(sloti,
 				  psi1it, f1it, p1it, 
 				  psip1it, fp1it, pp1it,
@@ -462,51 +1056,59 @@ int GOverlap_Tree::compute_volume_underslot2_r
     }
   }
 
-  if(ov.level > 0){
+  if(level > 0){
     //contributions to free and self volume of last atom
     free_volume[atom] += psi1i;
     self_volume[atom] += psip1i;
 
+    accum_vec dv1 = ov.dv1[slot];
+    accum dvv1 = ov.dvv1[slot];
+
     //contributions to energy gradients
     c2 = ai/a1i;
-    dr[atom] += (-ov.dv1) * fenergy1i + penergy1i * c2;
+    dr[atom] += (-dv1) * fenergy1i + penergy1i * c2;
     //ov.g.v is the unswitched volume
-    dv[atom] += ov.g.v * fenergy1i; //will be divided by Vatom later 
+    dv[atom] += ov.g[slot].v * fenergy1i; //will be divided by Vatom later 
     
     //update subtree P1..i's for parent
     c2 = a1/a1i;
-    p1i = (ov.dv1) * f1i + p1i * c2;
-    pp1i = (ov.dv1) * fp1i + pp1i * c2;
-    penergy1i = (ov.dv1) * fenergy1i + penergy1i * c2;
+    p1i = (dv1) * f1i + p1i * c2;
+    pp1i = (dv1) * fp1i + pp1i * c2;
+    penergy1i = (dv1) * fenergy1i + penergy1i * c2;
     //update subtree F1..i's for parent
-    f1i = ov.dvv1 * f1i;
-    fp1i = ov.dvv1 * fp1i;
-    fenergy1i = ov.dvv1 * fenergy1i;
+    f1i = dvv1 * f1i;
+    fp1i = dvv1 * fp1i;
+    fenergy1i = dvv1 * fenergy1i;
   }
   return 1;
 }
 
 /* traverses tree and computes volumes, etc. */
-int GOverlap_Tree::compute_volume2_r(vector<RealVec> &pos,
-				     RealOpenMM &volume, RealOpenMM &energy, 
-				     vector<RealVec> &dr,
-				     vector<RealOpenMM> &dv,
-				     vector<RealOpenMM> &free_volume,
-				     vector<RealOpenMM> &self_volume){ 
+template <class P>
+int GOverlap_TreeT<P>::compute_volume2_r(vector<RealVec> &pos,
+				     accum &volume, accum &energy, 
+				     vector<accum_vec> &dr,
+				     vector<accum> &dv,
+				     vector<accum> &free_volume,
+				     vector<accum> &self_volume){ 
   
   int slot = 0;
   int i,j;
-  RealOpenMM psi1i, f1i; RealVec p1i; //subtree accumulators for (free) volume
-  RealOpenMM psip1i, fp1i; RealVec pp1i; //subtree accumulators for self volume
-  RealOpenMM energy1i, fenergy1i; RealVec penergy1i; //subtree accumulators for volume-based energy
+  accum psi1i, f1i; accum_vec p1i; //subtree accumulators for (free) volume
+  accum psip1i, fp1i; accum_vec pp1i; //subtree accumulators for self volume
+  accum energy1i, fenergy1i; accum_vec penergy1i; //subtree accumulators for volume-based energy
 
   // reset volumes, gradients
-  RealVec zero3 = RealVec(0,0,0);
+  accum_vec zero3 = accum_vec(0,0,0);
   for(int i = 0 ; i < dr.size(); ++i) dr[i] = zero3;
   for(int i = 0 ; i < dv.size(); ++i) dv[i] = 0.;
   for(int i = 0 ; i < free_volume.size(); ++i) free_volume[i] = 0;
   for(int i = 0 ; i < self_volume.size(); ++i) self_volume[i] = 0;
 
+  if(nthreads > 1 && natoms > 1){
+    return compute_volume_threads(volume, energy, dr, dv, free_volume, self_volume);
+  }
+
   compute_volume_underslot2_r(0,
 			      psi1i, f1i, p1i, 
 			      psip1i, fp1i, pp1i,
@@ -518,18 +1120,355 @@ int GOverlap_Tree::compute_volume2_r(vector<RealVec> &pos,
   return 1;
 }
 
+/* the subtree of an atom occupies a contiguous section of the tree starting at its first child,
+   the atoms are split into contiguous blocks with about the same number of overlaps */
+template <class P>
+void GOverlap_TreeT<P>::split_atom_blocks(int nt){
+  //subtree sizes from the start of the subtree of the next atom with children
+  vector<long> &work = atom_work;
+  work.resize(natoms+1);
+  int next_start = overlaps.size();
+  for(int atom = natoms-1; atom >= 0; atom--){
+    int start = overlaps.children_startindex[atom+1];
+    int size = 0;
+    if(start > natoms && overlaps.children_count[atom+1] > 0){
+      size = next_start - start;
+      next_start = start;
+    }
+    work[atom] = 1 + size;
+  }
+  //blocks with about the same amount of work
+  long total = 0;
+  for(int atom = 0; atom < natoms; atom++) total += work[atom];
+  vector<int> &block = atom_block;
+  block.resize(nt+1);
+  block[0] = 0;
+  long sum = 0;
+  int t = 1;
+  for(int atom = 0; atom < natoms && t < nt; atom++){
+    sum += work[atom];
+    if(sum*nt >= total*t) block[t++] = atom+1;
+  }
+  while(t <= nt) block[t++] = natoms;
+}
+
+/* threaded traversal of the tree. The atoms are split into blocks by split_atom_blocks(). Each
+   thread traverses the subtrees of its block in order accumulating atomic quantities into its own
+   buffers, which are then summed in thread order. The volume and energy are summed in atom order
+   as in the serial traversal. */
+template <class P>
+int GOverlap_TreeT<P>::compute_volume_threads(accum &volume, accum &energy, 
+					  vector<accum_vec> &dr,
+					  vector<accum> &dv,
+					  vector<accum> &free_volume,
+					  vector<accum> &self_volume){
+  int nt = nthreads < natoms ? nthreads : natoms;
+  accumulators.resize(nt);
+  atom_volume.resize(natoms);
+  atom_energy.resize(natoms);
+  split_atom_blocks(nt);
+  vector<int> &block = atom_block;
+
+  accum_vec zero3 = accum_vec(0,0,0);
+  pool.run(nt, [this, &block, zero3](int t){
+      GOverlap_AccumulatorsT<P> &acc = accumulators[t];
+      acc.dr.assign(natoms, zero3);
+      acc.dv.assign(natoms, 0.);
+      acc.free_volume.assign(natoms, 0.);
+      acc.self_volume.assign(natoms, 0.);
+      for(int atom = block[t]; atom < block[t+1]; atom++){
+	accum psi1i, f1i; accum_vec p1i;
+	accum psip1i, fp1i; accum_vec pp1i;
+	accum energy1i, fenergy1i; accum_vec penergy1i;
+	compute_volume_underslot2_r(atom+1,
+				    psi1i, f1i, p1i, 
+				    psip1i, fp1i, pp1i,
+				    energy1i, fenergy1i, penergy1i,
+				    acc.dr, acc.dv, acc.free_volume, acc.self_volume);
+	atom_volume[atom] = psi1i;
+	atom_energy[atom] = energy1i;
+      }
+    });
+
+  //reduction over threads, in thread order for each atom
+  pool.run(nt, [this, nt, &dr, &dv, &free_volume, &self_volume](int t){
+      for(int i = (long)natoms*t/nt; i < (long)natoms*(t+1)/nt; i++){
+	for(int k = 0; k < nt; k++){
+	  GOverlap_AccumulatorsT<P> &acc = accumulators[k];
+	  dr[i] += acc.dr[i];
+	  dv[i] += acc.dv[i];
+	  free_volume[i] += acc.free_volume[i];
+	  self_volume[i] += acc.self_volume[i];
+	}
+      }
+    });
+
+  volume = 0;
+  energy = 0;
+  for(int atom = 0; atom < natoms; atom++){
+    volume += atom_volume[atom];
+    energy += atom_energy[atom];
+  }
+  return 1;
+}
+
+/* visits the node at slot for all of the channels: the overlaps of its children are computed
+   with ogauss_alpha_batch() from those of the node, as in rescan_r(), and the subtree
+   accumulators are then summed on the way back up as in compute_volume_underslot2_r() */
+template <class P>
+int GOverlap_TreeT<P>::compute_volume_channels_r(int slot, int k, GOverlap_ChannelsT<P> &ch, GOverlap_ChannelThreadT<P> &th,
+						 GOverlap_ChannelSumsT<P> &sums){
+  GOverlap_ArrayT<P> &ov = overlaps;
+  int nc = ch.nchannels;
+  int level = ov.level[slot];
+  int atom = ov.atom[slot];
+  accum cf = level % 2 == 0 ? -1.0 : 1.0;
+  accum volcoeff  = level > 0 ? cf : 0;
+  accum volcoeffp = level > 0 ? volcoeff/(accum)level : 0;
+
+  /* overlaps of this node, computed by the parent (atoms are set from the channel parameters) */
+  GaussianVcaT<P> g[MAX_CHANNELS];
+  real volume[MAX_CHANNELS], sfp[MAX_CHANNELS], dvv1[MAX_CHANNELS], gamma1i[MAX_CHANNELS];
+  vec dv1[MAX_CHANNELS];
+  for(int c = 0; c < nc; c++){
+    if(level == 1){
+      g[c] = ch.atoms[c*natoms + atom];
+      volume[c] = g[c].v;
+      dv1[c] = vec(0,0,0);
+      dvv1[c] = 1.;
+      sfp[c] = 1.;
+      gamma1i[c] = ch.atom_gamma[c*natoms + atom];
+    }else if(level > 1){
+      GOverlap_ChannelLevelT<P> &lv = th.levels[(level-2)*nc + c];
+      GOverlap_BatchT<P> &b = lv.batch;
+      g[c].c = vec(b.cx[k], b.cy[k], b.cz[k]);
+      g[c].a = b.a12[k];
+      g[c].v = b.v12[k];
+      volume[c] = b.gvol[k];
+      dv1[c] = lv.dv1[k];
+      dvv1[c] = b.dVdV[k];
+      sfp[c] = b.sfp[k];
+      gamma1i[c] = lv.gamma1i[k];
+    }else{
+      g[c] = ov.g[slot];
+      volume[c] = 0;
+      dv1[c] = vec(0,0,0);
+      dvv1[c] = 0.;
+      sfp[c] = 1.;
+      gamma1i[c] = 0.;
+    }
+  }
+
+  /* the tree is left with the overlaps of the last channel */
+  if(level > 0){
+    int c = nc - 1;
+    ov.g[slot] = g[c];
+    ov.volume[slot] = volume[c];
+    ov.dv1[slot] = dv1[c];
+    ov.dvv1[slot] = dvv1[c];
+    ov.self_volume[slot] = 0;
+    ov.sfp[slot] = sfp[c];
+    ov.gamma1i[slot] = gamma1i[c];
+  }
+
+  for(int c = 0; c < nc; c++){
+    sums.psi1i[c] = volcoeff*volume[c]; //for free volumes
+    sums.f1i[c] = volcoeff*sfp[c];
+    sums.p1i[c] = accum_vec(0,0,0);
+
+    sums.psip1i[c] = volcoeffp*volume[c]; //for self volumes
+    sums.fp1i[c] = volcoeffp*sfp[c];
+    sums.pp1i[c] = accum_vec(0,0,0);
+
+    sums.energy1i[c] = volcoeffp*gamma1i[c]*volume[c]; //EV energy
+    sums.fenergy1i[c] = volcoeffp*sfp[c]*gamma1i[c];
+    sums.penergy1i[c] = accum_vec(0,0,0);
+  }
+
+  int start = ov.children_startindex[slot], count = ov.children_count[slot];
+  if(start >= 0 && count > 0){
+    /* overlaps of the children (the atoms, children of the master root, are set above) */
+    if(level > 0){
+      int sibling_start = level > 1 ? ov.children_startindex[ov.parent_index[slot]] : 0;
+      for(int c = 0; c < nc; c++){
+	GOverlap_ChannelLevelT<P> &lv = th.levels[(level-1)*nc + c];
+	GOverlap_BatchT<P> &b = lv.batch;
+	GaussianVcaT<P> g1 = g[c];
+	//see rescan_r()
+	if(skin > 0 && volume[c] <= 0) g1.v = 0;
+	b.resize(count);
+	lv.dv1.resize(count);
+	lv.gamma1i.resize(count);
+	for(int j = 0; j < count; j++){
+	  GaussianVcaT<P> &g2 = ch.atoms[c*natoms + ov.atom[start+j]];
+	  b.x[j] = g2.c[0];
+	  b.y[j] = g2.c[1];
+	  b.z[j] = g2.c[2];
+	  b.a[j] = g2.a;
+	  b.v[j] = g2.v;
+	  if(skin > 0 && level > 1 &&
+	     th.levels[(level-2)*nc + c].batch.gvol[ov.sibling_index[start+j] - sibling_start] <= 0) b.v[j] = 0;
+	}
+	ogauss_alpha_batch(g1, b);
+	for(int j = 0; j < count; j++){
+	  int atom2 = ov.atom[start+j];
+	  GaussianVcaT<P> &g2 = ch.atoms[c*natoms + atom2];
+	  lv.dv1[j] = ( g2.c - g1.c ) * (-b.dVdr[j]);
+	  lv.gamma1i[j] = gamma1i[c] + ch.atom_gamma[c*natoms + atom2];
+	}
+      }
+    }
+
+    for(int j = 0; j < count; j++){
+      GOverlap_ChannelSumsT<P> t;
+      compute_volume_channels_r(start + j, j, ch, th, t);
+      for(int c = 0; c < nc; c++){
+	sums.psi1i[c] += t.psi1i[c];
+	sums.f1i[c] += t.f1i[c];
+	sums.p1i[c] += t.p1i[c];
+
+	sums.psip1i[c] += t.psip1i[c];
+	sums.fp1i[c] += t.fp1i[c];
+	sums.pp1i[c] += t.pp1i[c];
+
+	sums.energy1i[c] += t.energy1i[c];
+	sums.fenergy1i[c] += t.fenergy1i[c];
+	sums.penergy1i[c] += t.penergy1i[c];
+      }
+    }
+  }
+
+  if(level > 0){
+    for(int c = 0; c < nc; c++){
+      int i = c*natoms + atom;
+      accum ai = ch.atoms[i].a;
+      accum a1i = g[c].a;
+      accum a1 = a1i - ai;
+      accum c2;
+      accum_vec dv1c = dv1[c];
+      accum dvv1c = dvv1[c];
+
+      //contributions to free and self volume of last atom
+      th.free_volume[i] += sums.psi1i[c];
+      th.self_volume[i] += sums.psip1i[c];
+
+      //contributions to energy gradients
+      c2 = ai/a1i;
+      th.dr[i] += (-dv1c) * sums.fenergy1i[c] + sums.penergy1i[c] * c2;
+      //g.v is the unswitched volume
+      th.dv[i] += g[c].v * sums.fenergy1i[c]; //will be divided by Vatom later
+
+      //update subtree P1..i's for parent
+      c2 = a1/a1i;
+      sums.p1i[c] = (dv1c) * sums.f1i[c] + sums.p1i[c] * c2;
+      sums.pp1i[c] = (dv1c) * sums.fp1i[c] + sums.pp1i[c] * c2;
+      sums.penergy1i[c] = (dv1c) * sums.fenergy1i[c] + sums.penergy1i[c] * c2;
+      //update subtree F1..i's for parent
+      sums.f1i[c] = dvv1c * sums.f1i[c];
+      sums.fp1i[c] = dvv1c * sums.fp1i[c];
+      sums.fenergy1i[c] = dvv1c * sums.fenergy1i[c];
+    }
+  }
+  return 1;
+}
+
+template <class P>
+int GOverlap_TreeT<P>::compute_volume_channels(vector<RealVec> &pos, GOverlap_ChannelsT<P> &ch){
+  int nc = ch.nchannels;
+  int n = nc*natoms;
+  int nt = nthreads < natoms ? nthreads : natoms;
+  if(nt < 1) nt = 1;
+  accum_vec zero3 = accum_vec(0,0,0);
+  channel_threads.resize(nt);
+  for(int t = 0; t < nt; t++){
+    GOverlap_ChannelThreadT<P> &th = channel_threads[t];
+    th.levels.resize(MAX_ORDER*nc);
+    th.dr.assign(n, zero3);
+    th.dv.assign(n, 0.);
+    th.free_volume.assign(n, 0.);
+    th.self_volume.assign(n, 0.);
+  }
+
+  //master root as in rescan_tree_v()
+  overlaps.level[0] = 0;
+  overlaps.volume[0] = 0;
+  overlaps.dv1[0] = vec(0,0,0);
+  overlaps.dvv1[0] = 0.;
+  overlaps.self_volume[0] = 0;
+  overlaps.sfp[0] = 1.;
+  overlaps.gamma1i[0] = 0.;
+
+  if(nt == 1){
+    GOverlap_ChannelThreadT<P> &th = channel_threads[0];
+    GOverlap_ChannelSumsT<P> sums;
+    compute_volume_channels_r(0, 0, ch, th, sums);
+    for(int c = 0; c < nc; c++){
+      ch.volume[c] = sums.psi1i[c];
+      ch.energy[c] = sums.energy1i[c];
+    }
+    ch.dr.swap(th.dr);
+    ch.dv.swap(th.dv);
+    ch.free_volume.swap(th.free_volume);
+    ch.self_volume.swap(th.self_volume);
+    return 1;
+  }
+
+  //subtrees of the atoms by blocks as in compute_volume_threads()
+  split_atom_blocks(nt);
+  vector<int> &block = atom_block;
+  atom_volume.resize(n);
+  atom_energy.resize(n);
+  pool.run(nt, [this, &ch, &block, nc](int t){
+      GOverlap_ChannelThreadT<P> &th = channel_threads[t];
+      for(int atom = block[t]; atom < block[t+1]; atom++){
+	GOverlap_ChannelSumsT<P> sums;
+	compute_volume_channels_r(atom+1, atom, ch, th, sums);
+	for(int c = 0; c < nc; c++){
+	  atom_volume[atom*nc + c] = sums.psi1i[c];
+	  atom_energy[atom*nc + c] = sums.energy1i[c];
+	}
+      }
+    });
+
+  //reduction over threads, in thread order for each atom
+  ch.dr.assign(n, zero3);
+  ch.dv.assign(n, 0.);
+  ch.free_volume.assign(n, 0.);
+  ch.self_volume.assign(n, 0.);
+  pool.run(nt, [this, &ch, nt, n](int t){
+      for(int i = (long)n*t/nt; i < (long)n*(t+1)/nt; i++){
+	for(int k = 0; k < nt; k++){
+	  GOverlap_ChannelThreadT<P> &th = channel_threads[k];
+	  ch.dr[i] += th.dr[i];
+	  ch.dv[i] += th.dv[i];
+	  ch.free_volume[i] += th.free_volume[i];
+	  ch.self_volume[i] += th.self_volume[i];
+	}
+      }
+    });
+
+  for(int c = 0; c < nc; c++){
+    ch.volume[c] = 0;
+    ch.energy[c] = 0;
+    for(int atom = 0; atom < natoms; atom++){
+      ch.volume[c] += atom_volume[atom*nc + c];
+      ch.energy[c] += atom_energy[atom*nc + c];
+    }
+  }
+  return 1;
+}
+
 #ifdef NOTNOW
 /* print overlaps up to 2-body */
 static void print_flat_tree_2body(GOverlap_Tree &tree){
   int end = 0;
   // the end of the 2-body must be given by the last child of the last atom with children
   for(int slot = 1; slot <= tree.natoms; slot++){
-    if(tree.overlaps[slot].children_startindex > 0) end = tree.overlaps[slot].children_startindex;
+    if(tree.overlaps.children_startindex[slot] > 0) end = tree.overlaps.children_startindex[slot];
   }
   //now print
   for(int slot = 0; slot <= end ; slot++){
-    GOverlap *ov = &(tree.overlaps[slot]);
-    cout << slot << " " << ov->volume << " " << ov->children_startindex << " " << ov->children_count << endl;
+    cout << slot << " " << tree.overlaps.volume[slot] << " " << tree.overlaps.children_startindex[slot] << " " << tree.overlaps.children_count[slot] << endl;
   }
 }
 #endif
@@ -542,8 +1481,8 @@ static void test_gaussian(GOverlap_Tree &tree){
   RealOpenMM d, dx, gvol, dVdr, dVdV, gvol_old, sfp;
   RealVec grad, dist;
 
-  g1 = tree.overlaps[1].g;
-  g2 = tree.overlaps[2].g;
+  g1 = tree.overlaps.g[1];
+  g2 = tree.overlaps.g[2];
   gvol = gvol_old = ogauss_alpha(g1, g2, g12, dVdr, dVdV, sfp);
   dist = g2.c - g1.c;
   grad = dist * (-dVdr) * sfp; //gradient with respect to position of g2
@@ -561,12 +1500,15 @@ static void test_gaussian(GOverlap_Tree &tree){
 }
 #endif
 
-void GOverlap::print_overlap(void){
+template <class P>
+void GOverlapT<P>::print_overlap(void){
   cout << std::setprecision(4) << std::setw(7) << level << " " << std::setw(7)  << atom << " " << std::setw(7)  << parent_index << " " <<  std::setw(7) << children_startindex << " " << std::setw(7) << children_count << " " << std::setw(10) << self_volume << " " << std::setw(10) << volume << " " << std::setw(10) << gamma1i << " " << std::setw(10) << g.a << " " << std::setw(10) << g.c[0] << " " <<  std::setw(10) << g.c[1] << " " <<  std::setw(10) << g.c[2] << " " <<  std::setw(10) << dv1[0] << " " << std::setw(10) << dv1[1] << " " << std::setw(10) << dv1[2] << " " << std::setw(10) << sfp << endl;
 }
 
-void GOverlap_Tree::print_tree_r(int slot){
-  GOverlap &ov = overlaps[slot];
+template <class P>
+void GOverlap_TreeT<P>::print_tree_r(int slot){
+  GOverlapT<P> ov;
+  overlaps.get(slot, ov);
   std::cout << "tg: " << std::setw(6) << slot << " ";
   ov.print_overlap();
   for(int i=ov.children_startindex ; i < ov.children_startindex+ ov.children_count; i++){
@@ -574,56 +1516,173 @@ void GOverlap_Tree::print_tree_r(int slot){
   }
 }
 
-void GOverlap_Tree::print_tree(void){
+// exports the tree to a list of overlap records
+template <class P>
+void GOverlap_TreeT<P>::get_overlaps(vector< GOverlapT<P> > &ovs){
+  int n = overlaps.size();
+  ovs.resize(n);
+  for(int i = 0; i < n; i++) overlaps.get(i, ovs[i]);
+}
+
+template <class P>
+void GOverlap_TreeT<P>::print_tree(void){
   std::cout << "slot level LastAtom parent ChStart ChCount SelfV V gamma a x y z dedx dedy dedz sfp" << std::endl;
   for(int i=1;i<= natoms ; i++){
     print_tree_r(i);
   }
 }
 
-void GaussVol::compute_tree(vector<RealVec> &positions){
+template <class P>
+void GaussVolT<P>::compute_tree(vector<RealVec> &positions){
+  if(skin > 0 && tree_is_current(positions)){
+    tree->rescan_tree_v(positions, radii, volumes, gammas, ishydrogen);
+    return;
+  }
   tree->compute_overlap_tree_r(positions, radii, volumes, gammas, ishydrogen);
+  nbuilds += 1;
+  if(skin > 0){
+    //resets the volumes of the overlaps below threshold and of their subtrees
+    tree->rescan_tree_v(positions, radii, volumes, gammas, ishydrogen);
+    build_positions = positions;
+    build_radii = radii;
+    build_volumes = volumes;
+    tree_built = true;
+  }
+}
+
+//whether the tree built last can be reused at the given positions
+template <class P>
+bool GaussVolT<P>::tree_is_current(vector<RealVec> &positions){
+  if(!tree_built) return false;
+  for(int i = 0; i < natoms; i++){
+    if(radii[i] != build_radii[i] || volumes[i] != build_volumes[i]) return false;
+  }
+  RealOpenMM maxd2 = 0.25*skin*skin;
+  for(int i = 0; i < natoms; i++){
+    RealVec dist = positions[i] - build_positions[i];
+    if(dist.dot(dist) > maxd2) return false;
+  }
+  return true;
 }
 
 
-void GaussVol::compute_volume(vector<RealVec> &positions,
+template <class P>
+void GaussVolT<P>::compute_volume(vector<RealVec> &positions,
 			      RealOpenMM &volume,
 			      RealOpenMM &energy,
 			      vector<RealVec> &force,
 			      vector<RealOpenMM> &gradV,
 			      vector<RealOpenMM> &free_volume,  vector<RealOpenMM> &self_volume){
+  typename P::accum tvolume, tenergy;
+  results.dr.resize(natoms);
+  results.dv.resize(natoms);
+  results.free_volume.resize(natoms);
+  results.self_volume.resize(natoms);
   tree->compute_volume2_r(positions,
-			  volume, energy, 
-			  force,
-			  gradV,
-			  free_volume, self_volume); 
-  for(int i = 0; i < natoms; ++i) force[i] = -force[i];//transform gradient to force
+			  tvolume, tenergy, 
+			  results.dr,
+			  results.dv,
+			  results.free_volume, results.self_volume); 
+  volume = tvolume;
+  energy = tenergy;
+  for(int i = 0; i < natoms; ++i) force[i] = -results.dr[i];//transform gradient to force
   for(int i = 0; i < natoms; ++i) {
+    gradV[i] = results.dv[i];
     if(volumes[i] > 0) {
       gradV[i] = gradV[i]/volumes[i];
     }
+    free_volume[i] = results.free_volume[i];
+    self_volume[i] = results.self_volume[i];
   }
 }
 
+template <class P>
+void GaussVolT<P>::compute_volume_channels(vector<RealVec> &positions,
+				       vector< vector<RealOpenMM> > &radii,
+				       vector< vector<RealOpenMM> > &volumes,
+				       vector< vector<RealOpenMM> > &gammas,
+				       vector<RealOpenMM> &volume,
+				       vector<RealOpenMM> &energy,
+				       vector< vector<RealVec> > &force,
+				       vector< vector<RealOpenMM> > &gradV,
+				       vector< vector<RealOpenMM> > &free_volume,
+				       vector< vector<RealOpenMM> > &self_volume){
+  int nc = radii.size();
+  if(nc < 1 || nc > MAX_CHANNELS){
+    throw OpenMMException("compute_volume_channels: invalid number of channels");
+  }
+  if(volumes.size() != nc || gammas.size() != nc){
+    throw OpenMMException("compute_volume_channels: number of channels does not match");
+  }
+  GOverlap_ChannelsT<P> &ch = tree->channels;
+  ch.nchannels = nc;
+  ch.atoms.resize(nc*natoms);
+  ch.atom_gamma.resize(nc*natoms);
+  for(int c = 0; c < nc; c++){
+    if(radii[c].size() != natoms || volumes[c].size() != natoms || gammas[c].size() != natoms){
+      throw OpenMMException("compute_volume_channels: number of atoms does not match");
+    }
+    for(int iat = 0; iat < natoms; iat++){
+      GaussianVcaT<P> &g = ch.atoms[c*natoms + iat];
+      g.a = KFC/(radii[c][iat]*radii[c][iat]);
+      g.v = ishydrogen[iat] > 0 ? 0. : volumes[c][iat];
+      g.c = positions[iat];
+      ch.atom_gamma[c*natoms + iat] = gammas[c][iat];
+    }
+  }
+
+  tree->compute_volume_channels(positions, ch);
+
+  volume.resize(nc);
+  energy.resize(nc);
+  force.resize(nc);
+  gradV.resize(nc);
+  free_volume.resize(nc);
+  self_volume.resize(nc);
+  for(int c = 0; c < nc; c++){
+    volume[c] = ch.volume[c];
+    energy[c] = ch.energy[c];
+    force[c].resize(natoms);
+    gradV[c].resize(natoms);
+    free_volume[c].resize(natoms);
+    self_volume[c].resize(natoms);
+    for(int i = 0; i < natoms; i++){
+      force[c][i] = -ch.dr[c*natoms + i];//transform gradient to force
+      gradV[c][i] = ch.dv[c*natoms + i];
+      if(volumes[c][i] > 0) gradV[c][i] = gradV[c][i]/volumes[c][i];
+      free_volume[c][i] = ch.free_volume[c*natoms + i];
+      self_volume[c][i] = ch.self_volume[c*natoms + i];
+    }
+  }
+
+  //the tree is now set with the last channel
+  this->radii = radii[nc-1];
+  this->volumes = volumes[nc-1];
+  this->gammas = gammas[nc-1];
+}
+
 //rescan to compute a subset of overlap volumes with radii smaller than ones used to
 //set up the tree with compute_tree()
-void GaussVol::rescan_tree_volumes(vector<RealVec> &positions){
+template <class P>
+void GaussVolT<P>::rescan_tree_volumes(vector<RealVec> &positions){
   tree->rescan_tree_v(positions, radii, volumes, gammas, ishydrogen);
 }
 
 //deposit current gammas on the overlap tree
-void GaussVol::rescan_tree_gammas(void){
+template <class P>
+void GaussVolT<P>::rescan_tree_gammas(void){
   tree->rescan_tree_g(gammas);
 }
 
 
-int GOverlap_Tree::nchildren_under_slot_r(int slot){
+template <class P>
+int GOverlap_TreeT<P>::nchildren_under_slot_r(int slot){
   int n = 0;
-  if(overlaps[slot].children_count > 0){
-    n += overlaps[slot].children_count;
+  if(overlaps.children_count[slot] > 0){
+    n += overlaps.children_count[slot];
     //now calls itself on the children
-    for(int i = 0; i < overlaps[slot].children_count; i++){
-      n += nchildren_under_slot_r(overlaps[slot].children_startindex + i);
+    for(int i = 0; i < overlaps.children_count[slot]; i++){
+      n += nchildren_under_slot_r(overlaps.children_startindex[slot] + i);
     }
   }
   return n;
@@ -631,7 +1690,8 @@ int GOverlap_Tree::nchildren_under_slot_r(int slot){
 
 
 // returns number of overlaps for each atom 
-void GaussVol::getstat(vector<int>& nov){
+template <class P>
+void GaussVolT<P>::getstat(vector<int>& nov){
    nov.resize(natoms);
    for(int i=0; i<natoms; i++) nov[i] = 0;
    for(int atom = 0; atom < natoms; atom++){
@@ -639,3 +1699,21 @@ void GaussVol::getstat(vector<int>& nov){
      nov[atom] = tree->nchildren_under_slot_r(slot);
    }
 }
+
+//explicit instantiations for the precision policies in gaussvol.h
+#define GAUSSVOL_INSTANTIATE(P) \
+  template P::real ogauss_alpha<P>(GaussianVcaT<P> &g1, GaussianVcaT<P> &g2, GaussianVcaT<P> &g12, \
+				   P::real &dVdr, P::real &dVdV, P::real &sfp); \
+  template P::real ogauss_d2<P>(P::real v1, P::real a1, P::real v2, P::real a2, \
+				P::real d2, P::real &gvol, P::real &sfp); \
+  template void ogauss_alpha_batch<P>(GaussianVcaT<P> &g1, GOverlap_BatchT<P> &b); \
+  template bool goverlap_compare<P>(const GOverlapT<P> &overlap1, const GOverlapT<P> &overlap2); \
+  template class GOverlap_BatchT<P>; \
+  template class GOverlapT<P>; \
+  template class GOverlap_ArrayT<P>; \
+  template class GOverlap_TreeT<P>; \
+  template class GaussVolT<P>;
+
+GAUSSVOL_INSTANTIATE(GaussVolDoublePrecision)
+GAUSSVOL_INSTANTIATE(GaussVolFloatPrecision)
+GAUSSVOL_INSTANTIATE(GaussVolMixedPrecision)
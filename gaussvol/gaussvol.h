@@ -29,7 +29,13 @@
 
 #include <cmath>
 #include <cfloat>
+#include <cstring>
+#include <stdint.h>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 using std::vector;
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/ContextImpl.h"
@@ -54,6 +60,9 @@ using namespace OpenMM;
 // maximum overlap level
 #define MAX_ORDER (8)
 
+// maximum number of parameter channels of GaussVol::compute_volume_channels()
+#define MAX_CHANNELS (4)
+
 //use nm and kj
 #define ANG (0.1f)
 #define ANG3 (0.001f)
@@ -62,16 +71,101 @@ using namespace OpenMM;
 #define VOLMINA (0.01f*ANG3)
 #define VOLMINB (0.1f*ANG3)
 
+/* 3-vector of floats with the operations of RealVec used by GaussVol */
+class GFloatVec {
+ public:
+  GFloatVec(void){
+    d[0] = d[1] = d[2] = 0.f;
+  }
+  GFloatVec(float x, float y, float z){
+    d[0] = x; d[1] = y; d[2] = z;
+  }
+  GFloatVec(const RealVec &v){
+    d[0] = v[0]; d[1] = v[1]; d[2] = v[2];
+  }
+  operator RealVec() const {
+    return RealVec(d[0], d[1], d[2]);
+  }
+  float operator[](int i) const {
+    return d[i];
+  }
+  float &operator[](int i){
+    return d[i];
+  }
+  GFloatVec operator+(const GFloatVec &r) const {
+    return GFloatVec(d[0]+r.d[0], d[1]+r.d[1], d[2]+r.d[2]);
+  }
+  GFloatVec operator-(const GFloatVec &r) const {
+    return GFloatVec(d[0]-r.d[0], d[1]-r.d[1], d[2]-r.d[2]);
+  }
+  GFloatVec operator-() const {
+    return GFloatVec(-d[0], -d[1], -d[2]);
+  }
+  GFloatVec operator*(float s) const {
+    return GFloatVec(d[0]*s, d[1]*s, d[2]*s);
+  }
+  GFloatVec operator/(float s) const {
+    return GFloatVec(d[0]/s, d[1]/s, d[2]/s);
+  }
+  GFloatVec &operator+=(const GFloatVec &r){
+    d[0] += r.d[0]; d[1] += r.d[1]; d[2] += r.d[2];
+    return *this;
+  }
+  GFloatVec &operator-=(const GFloatVec &r){
+    d[0] -= r.d[0]; d[1] -= r.d[1]; d[2] -= r.d[2];
+    return *this;
+  }
+  float dot(const GFloatVec &r) const {
+    return d[0]*r.d[0] + d[1]*r.d[1] + d[2]*r.d[2];
+  }
+ private:
+  float d[3];
+};
+
+/*
+  Precision policies of the GaussVol classes. "real" is the precision of the Gaussians and of
+  the quantities stored in the overlap tree, "accum" that of the sums of volumes, energies
+  and gradients over the tree. Inputs and outputs of GaussVol are RealOpenMM/RealVec
+  with any policy.
+ */
+class GaussVolDoublePrecision {
+ public:
+  typedef RealOpenMM real;
+  typedef RealVec vec;
+  typedef RealOpenMM accum;
+  typedef RealVec accum_vec;
+};
+
+class GaussVolFloatPrecision {
+ public:
+  typedef float real;
+  typedef GFloatVec vec;
+  typedef float accum;
+  typedef GFloatVec accum_vec;
+};
+
+//float storage, double accumulation
+class GaussVolMixedPrecision {
+ public:
+  typedef float real;
+  typedef GFloatVec vec;
+  typedef RealOpenMM accum;
+  typedef RealVec accum_vec;
+};
+
 /* 3D Gaussian, V,c,a representation */
-class GaussianVca {
+template <class P>
+class GaussianVcaT {
  public:
-  RealOpenMM v; /* Gaussian volume */
-  RealOpenMM a; /* Gaussian exponent */
-  RealVec  c; /* center */
+  typename P::real v; /* Gaussian volume */
+  typename P::real a; /* Gaussian exponent */
+  typename P::vec  c; /* center */
 };
+typedef GaussianVcaT<GaussVolDoublePrecision> GaussianVca;
 
 // switching function used in Gaussian overlap function
 RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volminb, RealOpenMM &sp);
+float pol_switchfunc(float gvol, float volmina, float volminb, float &sp);
 
 /* overlap between two Gaussians represented by a (V,c,a) triplet
    V: volume of Gaussian
@@ -90,43 +184,377 @@ RealOpenMM pol_switchfunc(RealOpenMM gvol, RealOpenMM volmina, RealOpenMM volmin
    d2VdVdr is (1/r) d^2V12/dV1 dr
 
 */
-RealOpenMM ogauss_alpha(GaussianVca &g1, GaussianVca &g2, GaussianVca &g12, RealOpenMM &dVdr, RealOpenMM &dVdV, RealOpenMM &sfp);
+template <class P>
+typename P::real ogauss_alpha(GaussianVcaT<P> &g1, GaussianVcaT<P> &g2, GaussianVcaT<P> &g12,
+			      typename P::real &dVdr, typename P::real &dVdV, typename P::real &sfp);
+
+/* overlap volume of two Gaussians with volumes v1, v2 and exponents a1, a2 at squared distance d2,
+   the volume part of ogauss_alpha(). Returns the volume with the switching function applied, the
+   volume without it in gvol and the derivative factor of the switching function in sfp. */
+template <class P>
+typename P::real ogauss_d2(typename P::real v1, typename P::real a1, typename P::real v2, typename P::real a2,
+			   typename P::real d2, typename P::real &gvol, typename P::real &sfp);
+
+/* distance beyond which the overlap volume between two Gaussians with volumes no larger than
+   v1 and v2 and exponents no smaller than a1 and a2 is below VOLMINA, that is ogauss_alpha()
+   returns zero */
+RealOpenMM ogauss_reach(RealOpenMM v1, RealOpenMM a1, RealOpenMM v2, RealOpenMM a2);
+
+/*
+  Packed input and output of ogauss_alpha_batch(): the Gaussians overlapped with a common
+  Gaussian and, for each overlap, the quantities returned by ogauss_alpha().
+ */
+template <class P>
+class GOverlap_BatchT {
+ public:
+  typedef typename P::real real;
+  GOverlap_BatchT(void){
+    n = 0;
+  }
+  int size(void) const {
+    return n;
+  }
+  //sets the number of Gaussians in the batch, the arrays are only grown
+  void resize(int n);
+
+  int n;
+
+  //input Gaussians (g2)
+  vector<real> x, y, z, a, v;
+  //overlap Gaussians (g12)
+  vector<real> cx, cy, cz, a12, v12;
+  //switched overlap volume and derivatives
+  vector<real> gvol, dVdr, dVdV, sfp;
+};
+
+/* ogauss_alpha() for the overlaps of g1 with each of the Gaussians in the batch. The work
+   is done in branch-free loops over the packed arrays, which are compiled for the available
+   vector instruction sets (selected at runtime, where supported) */
+template <class P>
+void ogauss_alpha_batch(GaussianVcaT<P> &g1, GOverlap_BatchT<P> &b);
+
+/* exp(x) for the vectorized batch kernels of GaussVol and of the platforms, for x up to about
+   700 (80 in single precision). With x = n ln2 + r, |r| <= ln2/2, exp(r) is evaluated from its
+   Taylor polynomial and 2^n is set in the exponent bits. The result is within a few ulps of the
+   math library exp(), it is 0 for x < -708 (-87). Being inline and branch-free it is vectorized
+   along with the loops that call it, unlike the library function. */
+template <class T> inline T gaussvol_exp(T x);
+
+template <> inline double gaussvol_exp<double>(double x){
+  const double shifter = 6755399441055744.0; //1.5*2^52, t - shifter is rounded to an integer
+  const double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+  double xc = x < -708.0 ? -708.0 : (x > 709.0 ? 709.0 : x);
+  double t = xc*1.4426950408889634 + shifter;
+  double n = t - shifter;
+  double r = (xc - n*ln2_hi) - n*ln2_lo;
+  double p = 1.0/6227020800.0;
+  p = p*r + 1.0/479001600.0;
+  p = p*r + 1.0/39916800.0;
+  p = p*r + 1.0/3628800.0;
+  p = p*r + 1.0/362880.0;
+  p = p*r + 1.0/40320.0;
+  p = p*r + 1.0/5040.0;
+  p = p*r + 1.0/720.0;
+  p = p*r + 1.0/120.0;
+  p = p*r + 1.0/24.0;
+  p = p*r + 1.0/6.0;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+  uint64_t u;
+  memcpy(&u, &t, sizeof(u));
+  u = (u + 1023) << 52;
+  double s;
+  memcpy(&s, &u, sizeof(s));
+  return x < -708.0 ? 0.0 : p*s;
+}
+
+template <> inline float gaussvol_exp<float>(float x){
+  const float shifter = 12582912.0f; //1.5*2^23
+  const float ln2_hi = 0.693359375f, ln2_lo = -2.12194440e-4f;
+  float xc = x < -87.0f ? -87.0f : (x > 88.0f ? 88.0f : x);
+  float t = xc*1.44269504f + shifter;
+  float n = t - shifter;
+  float r = (xc - n*ln2_hi) - n*ln2_lo;
+  float p = 1.0f/5040.0f;
+  p = p*r + 1.0f/720.0f;
+  p = p*r + 1.0f/120.0f;
+  p = p*r + 1.0f/24.0f;
+  p = p*r + 1.0f/6.0f;
+  p = p*r + 0.5f;
+  p = p*r + 1.0f;
+  p = p*r + 1.0f;
+  uint32_t u;
+  memcpy(&u, &t, sizeof(u));
+  u = (u + 127) << 23;
+  float s;
+  memcpy(&s, &u, sizeof(s));
+  return x < -87.0f ? 0.0f : p*s;
+}
+
+/*
+  A uniform grid of cubic cells used to locate the Gaussians near a point in space.
+  With cells not smaller than the reach of the overlaps, all of the Gaussians that can overlap
+  with a Gaussian are found in the 27 cells around it.
+ */
+class GCellGrid {
+ public:
+  GCellGrid(void){
+    ncells = 0;
+    n[0] = n[1] = n[2] = 0;
+    cell_size = 0;
+  }
+
+  /* bins the points with active[i] > 0 into cells of the given size */
+  void build(vector<RealVec> &pos, vector<int> &active, RealOpenMM cell_size);
+
+  /* returns in "list", in increasing order, the indexes larger than imin of the points
+     in the 27 cells around position c */
+  void neighbors(const RealVec &c, int imin, vector<int> &list);
+
+  int ncells;
+  int n[3];                 //number of cells along each direction
+  RealOpenMM cell_size;
+  RealVec origin;           //lower corner of the grid
+  vector<int> cell_start;   //start of the points of each cell in cell_points, size ncells+1
+  vector<int> cell_points;  //point indexes sorted by cell, increasing within each cell
+  vector<int> cell_of;      //scratch: cell index of each point (-1 if not active)
+};
+
+/*
+  A pool of persistent worker threads. run(nt, task) calls task(t) for t = 0..nt-1, t = 0 on
+  the calling thread and the others on the workers, and returns when all of them are done.
+  The workers are started by the first call that needs them and then wait for the next one,
+  so that calls in the steady state neither create threads nor allocate.
+ */
+class GThreadPool {
+ public:
+  GThreadPool(void){
+    fn = 0;
+    arg = 0;
+    ntasks = 0;
+    pending = 0;
+    generation = 0;
+    quit = false;
+  }
+  ~GThreadPool(void);
+
+  template <class F>
+  void run(int nt, const F &task){
+    if(nt <= 1){
+      task(0);
+      return;
+    }
+    dispatch(nt, &GThreadPool::call<F>, &task);
+  }
+
+ private:
+  GThreadPool(const GThreadPool &);
+  GThreadPool &operator=(const GThreadPool &);
+  template <class F>
+  static void call(const void *task, int t){
+    (*(const F *)task)(t);
+  }
+  void dispatch(int nt, void (*fn)(const void *, int), const void *arg);
+  void worker(int t, long seen);
+
+  vector<std::thread> workers;   //worker t+1 runs task(t+1)
+  std::mutex mutex;
+  std::condition_variable start_cv, done_cv;
+  void (*fn)(const void *, int);  //task of the current call
+  const void *arg;
+  int ntasks;                    //number of tasks of the current call
+  int pending;                   //workers still running the current call
+  long generation;               //number of calls so far
+  bool quit;
+};
 
 /* an overlap */
-class GOverlap {
+template <class P>
+class GOverlapT {
   public:
+    typedef typename P::real real;
     int level;                      //level (0=root, 1=atoms, 2=2-body, 3=3-body, etc.)
-    GaussianVca g;                  // Gaussian representing overlap
-    RealOpenMM volume;                   //volume of overlap (also stores Psi1..i in GPU version)
-    RealOpenMM dvv1;                     // derivative wrt volume of first atom (also stores F1..i in GPU version)
-    RealVec  dv1;                   // derivative wrt position of first atom (also stores P1..i in GPU version) 
-    RealOpenMM gamma1i;                  // sum gammai for this overlap
-    RealOpenMM self_volume;              //self volume accumulator (also stores Psi'1..i in GPU version)
-    RealOpenMM sfp;                     //switching function derivatives    
+    GaussianVcaT<P> g;              // Gaussian representing overlap
+    real volume;                   //volume of overlap (also stores Psi1..i in GPU version)
+    real dvv1;                     // derivative wrt volume of first atom (also stores F1..i in GPU version)
+    typename P::vec dv1;            // derivative wrt position of first atom (also stores P1..i in GPU version) 
+    real gamma1i;                  // sum gammai for this overlap
+    real self_volume;              //self volume accumulator (also stores Psi'1..i in GPU version)
+    real sfp;                     //switching function derivatives    
+    real vmax;                    //upper bound of the volume within the skin (incremental mode)
+    real reach;                   //distance from the center beyond which its overlaps with atoms are
+                                   //below VOLMINA (in incremental mode, at any position within the skin)
     int atom;                      // the atomic index of the last atom of the overlap list (i, j, k, ..., atom) 
                                    //    = (Parent, atom)
     int parent_index;              // index in tree list of parent overlap
+    int sibling_index;             // index in tree list of the sibling overlap this overlap was formed with
     int children_startindex;       // start index in tree array of children
     int children_count;            // number of children
     void print_overlap(void);
 };
+typedef GOverlapT<GaussVolDoublePrecision> GOverlap;
 
 
 /* overlap comparison function */
-bool goverlap_compare( const GOverlap &overlap1, const GOverlap &overlap2);
+template <class P>
+bool goverlap_compare( const GOverlapT<P> &overlap1, const GOverlapT<P> &overlap2);
+
+/*
+  Storage of the overlaps of the tree in structure-of-arrays layout. The fields
+  used to construct the tree, those used to traverse it and those only used for
+  printing are in separate arrays so that each pass only streams the data it needs.
+  GOverlap is the equivalent (array-of-structures) record used to exchange overlaps
+  with the arrays.
+ */
+template <class P>
+class GOverlap_ArrayT {
+ public:
+  typedef typename P::real real;
+  int size(void) const {
+    return atom.size();
+  }
+  void clear(void){
+    resize(0);
+  }
+  void resize(int n);
+  void reserve(int n);
+  //stores overlap record ov in slot i
+  void set(int i, const GOverlapT<P> &ov);
+  //retrieves the overlap record of slot i
+  void get(int i, GOverlapT<P> &ov);
+  //copies slot j of src into slot i
+  void copy(int i, GOverlap_ArrayT<P> &src, int j);
+
+  //construction fields
+  vector< GaussianVcaT<P> > g;
+  vector<real> gamma1i;
+  vector<real> vmax;
+  vector<real> reach;
+  vector<int> level;
+  vector<int> atom;
+  vector<int> parent_index;
+  vector<int> sibling_index;
+  vector<int> children_startindex;
+  vector<int> children_count;
+  //traversal fields
+  vector<real> volume;
+  vector<real> dvv1;
+  vector<typename P::vec> dv1;
+  vector<real> sfp;
+  //debug fields
+  vector<real> self_volume;
+};
+
+
+/*
+  Storage for the subtrees of the atoms processed by one thread during a threaded
+  construction of the overlap tree. Overlaps in the subtrees are addressed with tree
+  indexes starting at "base", that is overlaps[i] holds tree slot base+i.
+  Indexes below base refer to the shared root and 1-body slots of the tree.
+ */
+template <class P>
+class GOverlap_SubtreesT {
+ public:
+  int base;
+  GOverlap_ArrayT<P> overlaps;
+  vector<int> candidates;             //scratch for compute_children()
+  vector< GOverlapT<P> > children;    //scratch for compute_andadd_children_r()
+  GOverlap_BatchT<P> batch;           //scratch for compute_children()
+  vector<int> batch_atoms;
+  vector<int> batch_siblings;
+};
 
+/*
+  Accumulators of atomic quantities of a traversal of the tree.
+ */
+template <class P>
+class GOverlap_AccumulatorsT {
+ public:
+  vector<typename P::accum_vec> dr;
+  vector<typename P::accum> dv;
+  vector<typename P::accum> free_volume;
+  vector<typename P::accum> self_volume;
+};
+
+/*
+  Overlaps of one parameter channel for the children of an overlap along the path
+  followed by compute_volume_channels_r().
+ */
+template <class P>
+class GOverlap_ChannelLevelT {
+ public:
+  GOverlap_BatchT<P> batch;
+  vector<typename P::vec> dv1;
+  vector<typename P::real> gamma1i;
+};
+
+/*
+  Parameters, scratch and results of compute_volume_channels(). Per-atom arrays
+  are indexed by channel*natoms + atom.
+ */
+template <class P>
+class GOverlap_ChannelsT {
+ public:
+  typedef typename P::accum accum;
+  int nchannels;
+  vector< GaussianVcaT<P> > atoms;    //atomic Gaussians
+  vector<typename P::real> atom_gamma;
+  accum volume[MAX_CHANNELS];
+  accum energy[MAX_CHANNELS];
+  vector<typename P::accum_vec> dr;
+  vector<accum> dv;
+  vector<accum> free_volume;
+  vector<accum> self_volume;
+};
+
+/* scratch and atomic accumulators of a thread of compute_volume_channels(), indexed as in
+   GOverlap_ChannelsT */
+template <class P>
+class GOverlap_ChannelThreadT {
+ public:
+  vector< GOverlap_ChannelLevelT<P> > levels; //children of the overlaps along the path, [level*nchannels + channel]
+  vector<typename P::accum_vec> dr;
+  vector<typename P::accum> dv;
+  vector<typename P::accum> free_volume;
+  vector<typename P::accum> self_volume;
+};
+
+/* subtree accumulators of compute_volume_channels_r(), one per channel */
+template <class P>
+class GOverlap_ChannelSumsT {
+ public:
+  typedef typename P::accum accum;
+  typedef typename P::accum_vec accum_vec;
+  accum psi1i[MAX_CHANNELS], f1i[MAX_CHANNELS];           //free volume
+  accum_vec p1i[MAX_CHANNELS];
+  accum psip1i[MAX_CHANNELS], fp1i[MAX_CHANNELS];         //self volume
+  accum_vec pp1i[MAX_CHANNELS];
+  accum energy1i[MAX_CHANNELS], fenergy1i[MAX_CHANNELS];  //volume-based energy
+  accum_vec penergy1i[MAX_CHANNELS];
+};
 
 /*
   A collection of, mainly, recursive routines to constructs and analyze the overlap tree.
   Not meant to be called directly. It is used by GaussVol.
  */
-class GOverlap_Tree {
+template <class P>
+class GOverlap_TreeT {
  public:
-  GOverlap_Tree(int natoms){
+  typedef typename P::real real;
+  typedef typename P::vec vec;
+  typedef typename P::accum accum;
+  typedef typename P::accum_vec accum_vec;
+
+  GOverlap_TreeT(int natoms){
     this->natoms = natoms;
+    this->nthreads = 1;
+    this->skin = 0;
+    this->atom_vmax = 0;
+    this->atom_amin = 0;
   }
 
-  ~GOverlap_Tree(void){
+  ~GOverlap_TreeT(void){
     overlaps.clear();
   }
 
@@ -137,41 +565,89 @@ class GOverlap_Tree {
 			vector<RealOpenMM> &gammas,
 			vector<int> &ishydrogen);
   
+  /* returns the storage and the index "i" in it of the overlap at the given tree slot,
+     looking into the thread subtrees "st" for slots past the 1-body level if given */
+  GOverlap_ArrayT<P> &overlap_at(int slot, GOverlap_SubtreesT<P> *st, int &i){
+    if(st && slot >= st->base){
+      i = slot - st->base;
+      return st->overlaps;
+    }
+    i = slot;
+    return overlaps;
+  }
+
   // adds to the tree the children of overlap identified by "parent_index" in the tree
-  int add_children(int parent_index, vector<GOverlap> &children_overlaps);
+  int add_children(int parent_index, vector< GOverlapT<P> > &children_overlaps, GOverlap_SubtreesT<P> *st = 0);
 
   /* scans the siblings of overlap identified by "root_index" to create children overlaps,
    returns them into the "children_overlaps" buffer: (root) + (atom) -> (root, atom) */
-  int compute_children(int root_index, vector<GOverlap> &children_overlaps);
+  int compute_children(int root_index, vector< GOverlapT<P> > &children_overlaps, GOverlap_SubtreesT<P> *st = 0);
+
+  //bins the atoms of the 1-body level into the cell grid used to find 2-body overlaps
+  int init_atom_grid(void);
+
+  //reach radius of an overlap with volume (or upper bound to the volume) v and exponent a
+  RealOpenMM overlap_reach(RealOpenMM v, RealOpenMM a){
+    return ogauss_reach(v, a, atom_vmax, atom_amin) + skin;
+  }
 
   //grow the tree with more children starting at the given root slot (recursive)
-  int compute_andadd_children_r(int root);
+  int compute_andadd_children_r(int root, GOverlap_SubtreesT<P> *st = 0);
   
   //compute the tree starting from the 1-body level
   int compute_overlap_tree_r(vector<RealVec> &pos, vector<RealOpenMM> &radius,
 			     vector<RealOpenMM> &volume,
 			     vector<RealOpenMM> &gamma, vector<int> &ishydrogen);
 
+  /* grows the subtrees of the atoms with "nthreads" threads and stitches them into
+     the tree in atom order. The resulting tree is the same as with one thread. */
+  int compute_subtrees_threads(void);
+
   /* compute volumes, energy of the overlap at slot and calls itself recursively to get 
      the volumes of the children */
   int compute_volume_underslot2_r(
      int slot,
-     RealOpenMM &psi1i, RealOpenMM &f1i, RealVec &p1i, //subtree accumulators for free volume
-     RealOpenMM &psip1i, RealOpenMM &fp1i, RealVec &pp1i, //subtree accumulators for self volume
-     RealOpenMM &energy1i, RealOpenMM &fenergy1i, RealVec &penergy1i, //subtree accumulators for volume-based energy
-     vector<RealVec>  &dr,          //gradients of volume-based energy wrt to atomic positions
-     vector<RealOpenMM>  &dv,          //gradients of volume-based energy wrt to atomic volumes				
-     vector<RealOpenMM> &free_volume, //atomic free volumes
-     vector<RealOpenMM> &self_volume  //atomic self volumes
+     accum &psi1i, accum &f1i, accum_vec &p1i, //subtree accumulators for free volume
+     accum &psip1i, accum &fp1i, accum_vec &pp1i, //subtree accumulators for self volume
+     accum &energy1i, accum &fenergy1i, accum_vec &penergy1i, //subtree accumulators for volume-based energy
+     vector<accum_vec>  &dr,          //gradients of volume-based energy wrt to atomic positions
+     vector<accum>  &dv,          //gradients of volume-based energy wrt to atomic volumes				
+     vector<accum> &free_volume, //atomic free volumes
+     vector<accum> &self_volume  //atomic self volumes
 				  );
   
   /* recursively traverses tree and computes volumes, etc. */
   int compute_volume2_r(vector<RealVec> &pos,
-			RealOpenMM &volume, RealOpenMM &energy, 
-			vector<RealVec> &dr,
-			vector<RealOpenMM> &dv,
-			vector<RealOpenMM> &free_volume,
-			vector<RealOpenMM> &self_volume);
+			accum &volume, accum &energy, 
+			vector<accum_vec> &dr,
+			vector<accum> &dv,
+			vector<accum> &free_volume,
+			vector<accum> &self_volume);
+
+  /* splits the atoms into "nt" contiguous blocks (atom_block) with about the same number of
+     overlaps in their subtrees */
+  void split_atom_blocks(int nt);
+
+  /* traverses the subtrees of the atoms with "nthreads" threads, each accumulating into its own
+     buffers, followed by a reduction in a fixed order. Results are reproducible for a given number
+     of threads. */
+  int compute_volume_threads(accum &volume, accum &energy, 
+			     vector<accum_vec> &dr,
+			     vector<accum> &dv,
+			     vector<accum> &free_volume,
+			     vector<accum> &self_volume);
+
+  /* computes the overlaps of the node at slot, the "k"-th child of its parent, for all of
+     the channels and calls itself recursively on the children. The overlaps of the last channel
+     are stored in the tree. */
+  int compute_volume_channels_r(int slot, int k, GOverlap_ChannelsT<P> &ch, GOverlap_ChannelThreadT<P> &th,
+				GOverlap_ChannelSumsT<P> &sums);
+
+  /* computes volumes, energies and gradients over the tree topology for each of the channels
+     of atomic parameters set in "ch" in a single traversal. The tree is left with the overlaps
+     of the last channel as after rescan_tree_v(). With more than one thread the subtrees of the
+     atoms are split among the threads as in compute_volume_threads(). */
+  int compute_volume_channels(vector<RealVec> &pos, GOverlap_ChannelsT<P> &ch);
 
   /*rescan the sub-tree to recompute the volumes, does not modify the tree */
   int rescan_r(int slot);
@@ -198,19 +674,55 @@ class GOverlap_Tree {
   //counts number of overlaps under the one given
   int nchildren_under_slot_r(int slot);
 
+  //returns the tree as a list of overlap records (for validation)
+  void get_overlaps(vector< GOverlapT<P> > &ovs);
+
   int natoms;
-  vector<GOverlap> overlaps; //the root is at index 0, atoms are at 1..natoms+1
+  GOverlap_ArrayT<P> overlaps; //the root is at index 0, atoms are at 1..natoms+1
+  vector< GOverlapT<P> > children; //scratch for compute_andadd_children_r()
+  GOverlap_BatchT<P> batch;      //scratch for compute_children() and rescan_r()
+  vector<int> batch_atoms;
+  vector<int> batch_siblings;
+
+  RealOpenMM skin;         //if > 0 the tree includes the overlaps that can appear when atoms
+                           //move by up to skin/2 (incremental mode)
+
+  int nthreads;                          //number of threads used to construct the tree
+  GThreadPool pool;                      //workers of the threaded construction and traversal
+  vector< GOverlap_SubtreesT<P> > subtrees;    //per-thread subtrees
+  vector<int> subtree_thread;            //thread, start and size in the thread subtrees
+  vector<int> subtree_start;             //of the subtree of each atom
+  vector<int> subtree_size;
+  vector< std::atomic<unsigned long long> > subtree_ranges; //ranges of atoms of the threads
+  vector<int> subtree_shift;             //relocation of the subtree of each atom
+  vector<long> atom_work;                //size of the subtree of each atom
+  vector<int> atom_block;                //blocks of atoms of the threads of the traversal
+  vector< GOverlap_AccumulatorsT<P> > accumulators; //per-thread accumulators for compute_volume_threads()
+  vector<accum> atom_volume;                  //volume and energy of the subtree of each atom (and channel)
+  vector<accum> atom_energy;
+  GOverlap_ChannelsT<P> channels;             //for GaussVol::compute_volume_channels()
+  vector< GOverlap_ChannelThreadT<P> > channel_threads; //per-thread scratch of compute_volume_channels()
+
+  RealOpenMM atom_vmax;         //largest volume and smallest exponent of the atoms with volume
+  RealOpenMM atom_amin;
+  GCellGrid atom_grid;          //cell list of the atomic Gaussians
+  vector<RealVec> grid_pos;     //scratch for init_atom_grid()
+  vector<int> grid_active;
+  vector<int> grid_candidates;  //scratch for compute_children()
 };
+typedef GOverlap_TreeT<GaussVolDoublePrecision> GOverlap_Tree;
 
 /*
-A class that implements the Gaussian description of an object (molecule) made of a overlapping spheres
+A class that implements the Gaussian description of an object (molecule) made of a overlapping spheres.
+The precision of the overlap tree and of the sums over it is set by the policy P (see above).
  */
-class GaussVol {
+template <class P>
+class GaussVolT {
  public: 
   /* Creates/Initializes a GaussVol instance*/
-  GaussVol(const int natoms,
+  GaussVolT(const int natoms,
 	   vector<int> &ishydrogen){
-    tree = new GOverlap_Tree(natoms);
+    tree = new GOverlap_TreeT<P>(natoms);
     this->natoms = natoms;
     this->radii.resize(natoms);
     for(int i=0;i<natoms;i++) radii[i] = 1.;
@@ -219,20 +731,26 @@ class GaussVol {
     this->gammas.resize(natoms);
     for(int i=0;i<natoms;i++) gammas[i] = 0.;
     this->ishydrogen = ishydrogen;
+    this->skin = 0;
+    this->tree_built = false;
+    this->nbuilds = 0;
   }
-  GaussVol(const int natoms,
+  GaussVolT(const int natoms,
 	   vector<RealOpenMM> &radii,
 	   vector<RealOpenMM> &volumes,
 	   vector<RealOpenMM> &gammas,
 	   vector<int> &ishydrogen){
-    tree = new GOverlap_Tree(natoms);
+    tree = new GOverlap_TreeT<P>(natoms);
     this->natoms = natoms;
     this->radii = radii;
     this->volumes = volumes;
     this->gammas = gammas;
     this->ishydrogen = ishydrogen;
+    this->skin = 0;
+    this->tree_built = false;
+    this->nbuilds = 0;
   }
-  ~GaussVol(void){
+  ~GaussVolT(void){
     delete tree;
     radii.clear();
     volumes.clear();
@@ -271,7 +789,21 @@ class GaussVol {
     }
   }
   
-  //constructs the tree
+  /* changes the number of atoms, for instance to reuse the instance for a set of particles
+     that changes from one call to the next. Storage is kept and grown as needed.
+     Radii, volumes and gammas must be set again afterwards. */
+  void setNumAtoms(const int natoms, vector<int> &ishydrogen){
+    this->natoms = natoms;
+    tree->natoms = natoms;
+    radii.resize(natoms, 1.);
+    volumes.resize(natoms, 0.);
+    gammas.resize(natoms, 0.);
+    this->ishydrogen.resize(natoms);
+    for(int i=0;i<natoms;i++) this->ishydrogen[i] = ishydrogen[i];
+    tree_built = false;
+  }
+
+  //constructs the tree, in incremental mode only rescans it if the atoms are still within the skin
   void compute_tree(vector<RealVec> &positions);
 
   /* returns GaussVol volume energy function and forces */
@@ -287,26 +819,96 @@ class GaussVol {
   //rescan the tree after resetting gammas, radii and volumes
   void rescan_tree_volumes(vector<RealVec> &positions);
 
+  /* same as compute_volume() for several sets ("channels") of radii, volumes and gammas
+     with one traversal of the tree built by compute_tree(). Results are returned per channel.
+     Afterwards the radii, volumes and gammas of the GaussVol instance and the tree are those of the
+     last channel, as if set and followed by rescan_tree_volumes(). */
+  void compute_volume_channels(vector<RealVec> &positions,
+			       vector< vector<RealOpenMM> > &radii,
+			       vector< vector<RealOpenMM> > &volumes,
+			       vector< vector<RealOpenMM> > &gammas,
+			       vector<RealOpenMM> &volume,
+			       vector<RealOpenMM> &energy,
+			       vector< vector<RealVec> > &force,
+			       vector< vector<RealOpenMM> > &gradV,
+			       vector< vector<RealOpenMM> > &free_volume,
+			       vector< vector<RealOpenMM> > &self_volume);
+
   //rescan the tree resetting gammas only with current values
   void rescan_tree_gammas(void);
 
   // returns number of overlaps for each atom 
   void getstat(vector<int>& nov);
 
+  //sets the number of threads used to construct the tree
+  void setNumThreads(int nthreads){
+    tree->nthreads = nthreads > 0 ? nthreads : 1;
+  }
+
+  /* sets incremental mode: the tree is built once with a margin of overlaps
+     that can appear when the atoms move by up to skin/2 and it is then only rescanned
+     at the new positions until an atom moves farther than that or the radii or volumes
+     used to build it change. skin = 0 (default) rebuilds the tree at each call to compute_tree(). */
+  void setSkin(RealOpenMM skin){
+    this->skin = skin > 0 ? skin : 0;
+    tree->skin = this->skin;
+    tree_built = false;
+  }
+
+  /* returns the cell grid of the atoms with volume of the last tree build if all of the atoms
+     within "range" of an atom are found in the 27 cells around it, 0 otherwise. In incremental
+     mode the binned positions are those of the last build. */
+  GCellGrid *getAtomGrid(RealOpenMM range){
+    GCellGrid &grid = tree->atom_grid;
+    if(grid.ncells > 0 && grid.cell_size >= range + 0.5*skin) return &grid;
+    return 0;
+  }
+
+  //number of times the tree has been built from scratch
+  int getNumTreeBuilds(void){
+    return nbuilds;
+  }
+
   void print_tree(void){
     tree->print_tree();
   }
 
+  //returns the overlap tree as a list of overlap records (for validation)
+  void get_overlaps(vector< GOverlapT<P> > &ovs){
+    tree->get_overlaps(ovs);
+  }
+
 
   
  private:
-  GOverlap_Tree *tree;
+  GOverlap_TreeT<P> *tree;
+  GOverlap_AccumulatorsT<P> results; //outputs of the tree traversal in accumulation precision
 
   int natoms;
   vector<RealOpenMM> radii;
   vector<RealOpenMM> volumes;
   vector<RealOpenMM> gammas;
   vector<int> ishydrogen;
+
+  //incremental mode
+  RealOpenMM skin;
+  bool tree_built;                  //whether the tree below has been built with the skin
+  vector<RealVec> build_positions;  //positions, radii and volumes of the last build
+  vector<RealOpenMM> build_radii;
+  vector<RealOpenMM> build_volumes;
+  int nbuilds;
+  bool tree_is_current(vector<RealVec> &positions);
 };
+typedef GaussVolT<GaussVolDoublePrecision> GaussVol;
+typedef GaussVolT<GaussVolFloatPrecision> GaussVolFloat;
+typedef GaussVolT<GaussVolMixedPrecision> GaussVolMixed;
+
+//instantiated in the gaussvol library for the three precision policies
+extern template class GOverlap_TreeT<GaussVolDoublePrecision>;
+extern template class GOverlap_TreeT<GaussVolFloatPrecision>;
+extern template class GOverlap_TreeT<GaussVolMixedPrecision>;
+extern template class GaussVolT<GaussVolDoublePrecision>;
+extern template class GaussVolT<GaussVolFloatPrecision>;
+extern template class GaussVolT<GaussVolMixedPrecision>;
 
 #endif //GAUSSVOL_H
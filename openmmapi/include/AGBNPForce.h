@@ -7,6 +7,7 @@
 
 #include "openmm/Context.h"
 #include "openmm/Force.h"
+#include <string>
 #include <vector>
 #include "internal/windowsExportAGBNP.h"
 
@@ -136,6 +137,23 @@ public:
     
     void updateParametersInContext(OpenMM::Context& context);
 
+    /**
+     * Get the number of times the overlap tree of this force in a Context ran out of space and
+     * was grown during the force evaluations (the steps are replayed, the results are not
+     * affected). It is 0 on platforms that do not preallocate the tree.
+     *
+     * @param context    the Context in which to query the counter
+     */
+    int getNumTreeOverflows(OpenMM::Context& context);
+
+    /**
+     * Get a report of the numbers of launches of each device kernel of this force in a Context,
+     * in total and per evaluation. It is empty on platforms that do not launch device kernels.
+     *
+     * @param context    the Context in which to query the counters
+     */
+    std::string getKernelLaunchReport(OpenMM::Context& context);
+
     // version number: AGBNP version 1 or 2, version 0 is GVolSA
     void setVersion(int agbnp_version);
 
@@ -143,6 +161,79 @@ public:
       return version;
     }
 
+    /**
+     * Set the accuracy parameter of the treecode evaluation of the GB pair energy with NoCutoff.
+     * Pairs of atoms close enough that their GB pair term differs from the Coulomb term 1/d are
+     * evaluated exactly; clusters of charged atoms further away, whose size is less than this
+     * fraction of their distance, are evaluated from their Cartesian multipole expansion up to the
+     * order set by setGBPairTreecodeOrder(). The errors decrease as theta^(order+1). Forces are
+     * the gradients of the expansions. 0 (the default) evaluates all the pairs. Supported by the
+     * Reference and CPU platforms with NoCutoff, ignored otherwise.
+     *
+     * @param theta    the accuracy parameter, 0 <= theta < 1
+     */
+    void setGBPairTreecodeAccuracy(double theta);
+
+    double getGBPairTreecodeAccuracy() const {
+      return gb_treecode_theta;
+    }
+
+    /**
+     * Set the order of the multipole expansions of the GB pair treecode, from 0 (charges) to 10.
+     * The default is 6.
+     */
+    void setGBPairTreecodeOrder(int order);
+
+    int getGBPairTreecodeOrder() const {
+      return gb_treecode_order;
+    }
+
+    /**
+     * Set the skin of the overlap tree of the volume calculation, in nm. With a skin > 0 the tree
+     * also holds the overlaps that can appear when the atoms move by up to half the skin, and it is
+     * only rescanned, not rebuilt, until an atom moves further than that from where the tree was
+     * built or the radii change. 0 (the default) rebuilds the tree at each evaluation. Supported by
+     * the Reference and CPU platforms, ignored by the OpenCL platform.
+     *
+     * @param skin    the skin distance, >= 0
+     */
+    void setTreeSkin(double skin);
+
+    double getTreeSkin() const {
+      return tree_skin;
+    }
+
+    /**
+     * Set whether the OpenCL platform uses the fused kernel pipeline, in which the reset, init and
+     * reduction kernels of the AGBNP1 evaluation are merged into the kernels around them. It
+     * launches about 26 kernels per evaluation with forces rather than 40, which matters for small
+     * systems where the launch overhead dominates. It must be set before the Context is created.
+     * Ignored by the other platforms and by GVolSA and AGBNP2.
+     */
+    void setUseFusedKernels(bool fused) {
+      use_fused_kernels = fused;
+    }
+
+    bool getUseFusedKernels() const {
+      return use_fused_kernels;
+    }
+
+    /**
+     * Set the directory in which the OpenCL platform caches the binaries of the programs it
+     * compiles. The binaries are keyed by device, driver version, OpenMM version, precision,
+     * source text and compilation defines, so Contexts created later for the same system and
+     * device load them instead of compiling. The directory must exist. An empty string, the
+     * default, disables the cache. It must be set before the Context is created and it is
+     * ignored by the other platforms.
+     */
+    void setProgramCacheDirectory(const std::string& directory) {
+      program_cache_directory = directory;
+    }
+
+    const std::string& getProgramCacheDirectory() const {
+      return program_cache_directory;
+    }
+
 protected:
     OpenMM::ForceImpl* createImpl() const;
 private:
@@ -152,6 +243,11 @@ private:
     double cutoffDistance;
     unsigned int version; //1 or 2
     double solvent_radius;
+    double gb_treecode_theta;
+    int gb_treecode_order;
+    double tree_skin;
+    bool use_fused_kernels;
+    std::string program_cache_directory;
 };
 
 /**
@@ -44,6 +44,20 @@ public:
      * @param force      the AGBNPForce to copy the parameters from
      */
     virtual void copyParametersToContext(OpenMM::ContextImpl& context, const AGBNPForce& force) = 0;
+    /**
+     * Get the number of times the overlap tree overflowed and was grown. Platforms that
+     * do not preallocate the tree return 0.
+     */
+    virtual int getNumTreeOverflows(void) {
+        return 0;
+    }
+    /**
+     * Get a report of the numbers of launches of each device kernel. Platforms that do not
+     * launch device kernels return an empty string.
+     */
+    virtual std::string getKernelLaunchReport(void) {
+        return "";
+    }
 };
 
 } // namespace AGBNPPlugin
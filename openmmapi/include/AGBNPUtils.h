@@ -180,4 +180,42 @@ class AGBNPI42DLookupTable {
 
 };
 
+/* Q4ij lookup tables of all of the (screened, screener) radius type pairs with uniformly spaced
+   knots. The cubic splines of an AGBNPI42DLookupTable are stored as polynomial coefficients
+   in the local coordinate t of each interval, in one contiguous array, so that evaluation
+   is a direct index into the table instead of a search over the knots. */
+class AGBNPI4UniformTable {
+ public:
+  AGBNPI4UniformTable(const AGBNPI42DLookupTable& lut);
+  //value of Q4ij at distance x
+  double eval(const double x, const int rad_typei, const int rad_typej) const {
+    double t;
+    const double *c = interval(x, rad_typei, rad_typej, t);
+    return c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+  }
+  //value and derivative of Q4ij at distance x
+  void evalboth(const double x, const int rad_typei, const int rad_typej, double& f, double& fp) const {
+    double t;
+    const double *c = interval(x, rad_typei, rad_typej, t);
+    f = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    fp = (c[1] + t*(2.*c[2] + t*3.*c[3]))*inv_dx;
+  }
+  int ntypes_screened;
+  int ntypes_screener;
+  int nintervals;      //number of intervals of each table
+  double rmin, inv_dx; //first knot and inverse spacing
+  vector<double> coeff; //4 coefficients per interval, tables indexed by typei * ntypes_screener + typej
+
+ private:
+  //coefficients of the interval containing x and local coordinate t in [0,1]
+  const double *interval(const double x, const int rad_typei, const int rad_typej, double& t) const {
+    double u = (x - rmin)*inv_dx;
+    int k = (int)u;
+    if(k < 0) k = 0;
+    if(k >= nintervals) k = nintervals - 1;
+    t = u - k;
+    return &coeff[4*((rad_typei*ntypes_screener + rad_typej)*nintervals + k)];
+  }
+};
+
 #endif /* AGBNP_UTILS_H_ */
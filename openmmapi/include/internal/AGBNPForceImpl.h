@@ -37,6 +37,8 @@ public:
     }
     std::vector<std::string> getKernelNames();
     void updateParametersInContext(OpenMM::ContextImpl& context);
+    int getNumTreeOverflows(void);
+    std::string getKernelLaunchReport(void);
 private:
     const AGBNPForce& owner;
     OpenMM::Kernel kernel;
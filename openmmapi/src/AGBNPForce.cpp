@@ -12,7 +12,8 @@ using namespace AGBNPPlugin;
 using namespace OpenMM;
 using namespace std;
 
-AGBNPForce::AGBNPForce() : nonbondedMethod(NoCutoff), cutoffDistance(1.0), version(1), solvent_radius(SOLVENT_RADIUS) {
+AGBNPForce::AGBNPForce() : nonbondedMethod(NoCutoff), cutoffDistance(1.0), version(1), solvent_radius(SOLVENT_RADIUS),
+			   gb_treecode_theta(0.0), gb_treecode_order(6), tree_skin(0.0), use_fused_kernels(false) {
 }
 
 int AGBNPForce::addParticle(double radius, double gamma, double vdw_alpha, double charge, bool ishydrogen){
@@ -58,6 +59,30 @@ void AGBNPForce::setVersion(int agbnp_version){
   }
 }
 
+void AGBNPForce::setGBPairTreecodeAccuracy(double theta){
+  if(theta >= 0.0 && theta < 1.0) {
+    gb_treecode_theta = theta;
+  }else{
+    throw OpenMMException("AGBNPForce::setGBPairTreecodeAccuracy(): the accuracy parameter must be in [0,1)");
+  }
+}
+
+void AGBNPForce::setGBPairTreecodeOrder(int order){
+  if(order >= 0 && order <= 10) {
+    gb_treecode_order = order;
+  }else{
+    throw OpenMMException("AGBNPForce::setGBPairTreecodeOrder(): the order must be between 0 and 10");
+  }
+}
+
+void AGBNPForce::setTreeSkin(double skin){
+  if(skin >= 0.0) {
+    tree_skin = skin;
+  }else{
+    throw OpenMMException("AGBNPForce::setTreeSkin(): the skin must be non-negative");
+  }
+}
+
 void AGBNPForce::getParticleParameters(int index,  double& radius, double& gamma, double &vdw_alpha, double &charge,
 				      bool& ishydrogen) const { 
 
@@ -76,3 +101,11 @@ ForceImpl* AGBNPForce::createImpl() const {
 void AGBNPForce::updateParametersInContext(Context& context) {
     dynamic_cast<AGBNPForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+int AGBNPForce::getNumTreeOverflows(Context& context) {
+    return dynamic_cast<AGBNPForceImpl&>(getImplInContext(context)).getNumTreeOverflows();
+}
+
+std::string AGBNPForce::getKernelLaunchReport(Context& context) {
+    return dynamic_cast<AGBNPForceImpl&>(getImplInContext(context)).getKernelLaunchReport();
+}
@@ -44,3 +44,11 @@ std::vector<std::string> AGBNPForceImpl::getKernelNames() {
 void AGBNPForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcAGBNPForceKernel>().copyParametersToContext(context, owner);
 }
+
+int AGBNPForceImpl::getNumTreeOverflows(void) {
+    return kernel.getAs<CalcAGBNPForceKernel>().getNumTreeOverflows();
+}
+
+std::string AGBNPForceImpl::getKernelLaunchReport(void) {
+    return kernel.getAs<CalcAGBNPForceKernel>().getKernelLaunchReport();
+}
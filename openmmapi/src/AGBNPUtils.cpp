@@ -213,3 +213,32 @@ double AGBNPI42DLookupTable::evalderiv(const double x, const int rad_typei, cons
   return tables[index]->evalderiv(x);
 }
 
+
+/* converts the natural cubic splines of the 2D lookup table, which have uniformly spaced knots,
+   to the coefficients of y(t) = c0 + c1 t + c2 t^2 + c3 t^3 over each interval with t = (x - x_k)/h */
+AGBNPI4UniformTable::AGBNPI4UniformTable(const AGBNPI42DLookupTable& lut){
+  ntypes_screened = lut.ntypes_screened;
+  ntypes_screener = lut.ntypes_screener;
+  int ntables = ntypes_screened*ntypes_screener;
+  if(ntables <= 0 || !lut.tables[0]){
+    throw OpenMMException("AGBNPI4UniformTable(): empty lookup table");
+  }
+  const vector<double>& x0 = lut.tables[0]->table->xt;
+  nintervals = x0.size() - 1;
+  rmin = x0[0];
+  double h = (x0[nintervals] - x0[0])/nintervals;
+  inv_dx = 1./h;
+  coeff.resize(4*ntables*nintervals);
+  for(int index = 0; index < ntables; index++){
+    AGBNPLookupTable *table = lut.tables[index]->table;
+    for(int k = 0; k < nintervals; k++){
+      double y0 = table->yt[k], y1 = table->yt[k+1];
+      double s0 = table->y2t[k]*h*h/6., s1 = table->y2t[k+1]*h*h/6.;
+      double *c = &coeff[4*(index*nintervals + k)];
+      c[0] = y0;
+      c[1] = y1 - y0 - 2.*s0 - s1;
+      c[2] = 3.*s0;
+      c[3] = s1 - s0;
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef OPENMM_CPUAGBNPKERNELFACTORY_H_
+#define OPENMM_CPUAGBNPKERNELFACTORY_H_
+
+/* -------------------------------------------------------------------------- *
+ *                              OpenMM-AGBNP                                 *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/KernelFactory.h"
+
+namespace OpenMM {
+
+/**
+ * This KernelFactory creates kernels for the CPU implementation of the
+ * AGBNP plugin.
+ */
+
+class CpuAGBNPKernelFactory : public KernelFactory {
+public:
+    KernelImpl* createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_CPUAGBNPKERNELFACTORY_H_*/
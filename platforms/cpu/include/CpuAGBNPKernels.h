@@ -0,0 +1,73 @@
+#ifndef CPU_AGBNP_KERNELS_H_
+#define CPU_AGBNP_KERNELS_H_
+
+/* -------------------------------------------------------------------------- *
+ *                           OpenMM-AGBNP                                    *
+ * -------------------------------------------------------------------------- */
+#include "ReferenceAGBNPKernels.h"
+#include <vector>
+
+namespace AGBNPPlugin {
+
+/* per-thread workspace of the CPU kernel: the pairs of the row being processed packed
+   in contiguous arrays and the thread's own accumulators */
+class CpuAGBNPThreadData {
+ public:
+  //neighbor list rows built by this thread
+  std::vector<int> row_count, list, candidates;
+  //packed pairs of a row
+  std::vector<int> pj, tij, tji;
+  std::vector<RealOpenMM> dx, dy, dz, d2;
+  std::vector<RealOpenMM> p1, p2, p3;     //per-pair inputs of the batch kernels
+  std::vector<RealOpenMM> r1, r2, r3, r4, r5; //per-pair results of the batch kernels
+  //accumulators
+  std::vector<RealVec> force;
+  std::vector<RealOpenMM> acc1, acc2;
+  RealOpenMM energy;
+  //makes room for rows of n pairs
+  void grow(int n);
+};
+
+/**
+ * This kernel is invoked by AGBNPForce on the CPU platform. The volume and MS stages are
+ * those of the Reference kernel; the neighbor list and the Born radii, GB pair and
+ * Born radii derivative stages run on multiple threads over packed pair arrays.
+ */
+class CpuCalcAGBNPForceKernel : public ReferenceCalcAGBNPForceKernel {
+public:
+    CpuCalcAGBNPForceKernel(std::string name, const OpenMM::Platform& platform, int numThreads) :
+      ReferenceCalcAGBNPForceKernel(name, platform, numThreads) {
+    }
+
+protected:
+    std::vector<CpuAGBNPThreadData> thread_data;
+    std::vector<int> row_block;
+    //I4 table offsets and weights of the atoms in the descreening pairs
+    std::vector<int> type_screened, type_screener;
+    std::vector<RealOpenMM> screener_weight, der_weight;
+
+    //runs task(t) for t = 0..nt-1 on nt threads of the kernel's pool
+    template <class F>
+    void runThreads(int nt, const F& task){
+      if((int)thread_data.size() < nt) thread_data.resize(nt);
+      pool.run(nt, task);
+    }
+    //splits the rows in nt blocks with about the same number of neighbor list pairs (all pairs if allPairs)
+    void rowBlocks(int nt, bool allPairs, std::vector<int>& block);
+    //gathers the neighbor list pairs of row i (all j > i if allPairs) in the packed arrays of td
+    int gatherRow(int i, bool allPairs, std::vector<RealVec>& pos, CpuAGBNPThreadData& td);
+
+    void buildNeighborList(std::vector<RealVec>& pos);
+    void computeBornRadii(std::vector<RealVec>& pos);
+    RealOpenMM computeGBPairEnergy(std::vector<RealVec>& pos, std::vector<RealVec>& force,
+				   RealOpenMM dielectric_factor, RealOpenMM w_egb,
+				   std::vector<RealOpenMM>& egb_der_Y, bool includeForces = true);
+    void computeBornRadiiDerivatives(std::vector<RealVec>& pos, std::vector<RealVec>& force,
+				     std::vector<RealOpenMM>& evdw_der_brw, std::vector<RealOpenMM>& egb_der_bru,
+				     RealOpenMM w_vdw, RealOpenMM w_egb,
+				     std::vector<RealOpenMM>& evdw_der_W, std::vector<RealOpenMM>& egb_der_U);
+};
+
+} // namespace AGBNPPlugin
+
+#endif /*CPU_AGBNP_KERNELS_H_*/
@@ -0,0 +1,39 @@
+/* -------------------------------------------------------------------------- *
+ *                              OpenMM-AGBNP                                 *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuAGBNPKernelFactory.h"
+#include "ReferenceAGBNPKernelFactory.h"
+#include "CpuAGBNPKernels.h"
+#include "openmm/reference/ReferencePlatform.h"
+#include "openmm/internal/ContextImpl.h"
+#include "openmm/OpenMMException.h"
+
+using namespace AGBNPPlugin;
+using namespace OpenMM;
+
+extern "C" OPENMM_EXPORT void registerPlatforms() {
+}
+
+/* the kernel uses the positions and forces of the Reference platform data, which
+   the CPU platform shares. The registration is in a function with a name of its own so
+   that it can be called from programs that also link the Reference plugin. */
+extern "C" OPENMM_EXPORT void registerAGBNPCpuKernelFactories() {
+    for (int i = 0; i < Platform::getNumPlatforms(); i++) {
+        Platform& platform = Platform::getPlatform(i);
+        if (platform.getName() == "CPU" && dynamic_cast<ReferencePlatform*>(&platform) != NULL) {
+            CpuAGBNPKernelFactory* factory = new CpuAGBNPKernelFactory();
+            platform.registerKernelFactory(CalcAGBNPForceKernel::Name(), factory);
+        }
+    }
+}
+
+extern "C" OPENMM_EXPORT void registerKernelFactories() {
+    registerAGBNPCpuKernelFactories();
+}
+
+KernelImpl* CpuAGBNPKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
+    if (name == CalcAGBNPForceKernel::Name())
+        return new CpuCalcAGBNPForceKernel(name, platform, ReferenceAGBNPKernelFactory::getNumThreads(platform, context));
+    throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
+}
@@ -0,0 +1,374 @@
+/* -------------------------------------------------------------------------- *
+ *                               OpenMM-AGBNP                                *
+ * -------------------------------------------------------------------------- */
+
+#include <cmath>
+#include <cfloat>
+#include "AGBNPUtils.h"
+#include "CpuAGBNPKernels.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/ContextImpl.h"
+#include "gaussvol.h"
+
+using namespace AGBNPPlugin;
+using namespace OpenMM;
+using namespace std;
+
+/* the batch kernels are compiled for AVX-512, AVX2 and the baseline instruction set,
+   and the version for the cpu is picked at load time */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define CPUAGBNP_TARGETS __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define CPUAGBNP_TARGETS
+#endif
+#define CPUAGBNP_RESTRICT __restrict
+
+/* I4 descreening terms of the n packed pairs of a row, zero at distances beyond dmax:
+   qij = wj*Q4ij (j descreens i) and qji = wi*Q4ji (i descreens j). tij and tji are the
+   offsets of the tables of the pairs in the coefficients of the uniform I4 table. */
+CPUAGBNP_TARGETS
+static void descreen_batch(int n, double dmax2, double wi,
+			   const double * CPUAGBNP_RESTRICT d2, const double * CPUAGBNP_RESTRICT wj,
+			   const int * CPUAGBNP_RESTRICT tij, const int * CPUAGBNP_RESTRICT tji,
+			   const double * CPUAGBNP_RESTRICT coeff, int nintervals, double rmin, double inv_dx,
+			   double * CPUAGBNP_RESTRICT qij, double * CPUAGBNP_RESTRICT qji){
+  for(int m = 0; m < n; m++){
+    double d = sqrt(d2[m]);
+    double u = (d - rmin)*inv_dx;
+    int k = (int)u;
+    k = k < 0 ? 0 : (k >= nintervals ? nintervals - 1 : k);
+    double t = u - k;
+    const double *c = coeff + 4*(tij[m]*nintervals + k);
+    double f = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    c = coeff + 4*(tji[m]*nintervals + k);
+    double g = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    double mask = d2[m] < dmax2 ? 1.0 : 0.0;
+    qij[m] = mask*wj[m]*f;
+    qji[m] = mask*wi*g;
+  }
+}
+
+/* as descreen_batch() for the Born radii derivatives. hj is 1 if j is a heavy atom and 0 otherwise,
+   swj is hj times the volume scaling factor of j and fj the weight of the Born radius derivative
+   of j (and similarly hi, swi and fi for i). Returns qa = hj*Q4ij, qb = hi*Q4ji and the factor
+   of the gradient along the pair displacement */
+CPUAGBNP_TARGETS
+static void descreen_der_batch(int n, double dmax2, double hi, double swi, double fi,
+			       const double * CPUAGBNP_RESTRICT d2, const double * CPUAGBNP_RESTRICT hj,
+			       const double * CPUAGBNP_RESTRICT swj, const double * CPUAGBNP_RESTRICT fj,
+			       const int * CPUAGBNP_RESTRICT tij, const int * CPUAGBNP_RESTRICT tji,
+			       const double * CPUAGBNP_RESTRICT coeff, int nintervals, double rmin, double inv_dx,
+			       double * CPUAGBNP_RESTRICT qa, double * CPUAGBNP_RESTRICT qb,
+			       double * CPUAGBNP_RESTRICT fac){
+  for(int m = 0; m < n; m++){
+    double d = sqrt(d2[m]);
+    double u = (d - rmin)*inv_dx;
+    int k = (int)u;
+    k = k < 0 ? 0 : (k >= nintervals ? nintervals - 1 : k);
+    double t = u - k;
+    const double *c = coeff + 4*(tij[m]*nintervals + k);
+    double f = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    double fp = (c[1] + t*(2.*c[2] + t*3.*c[3]))*inv_dx;
+    c = coeff + 4*(tji[m]*nintervals + k);
+    double g = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    double gp = (c[1] + t*(2.*c[2] + t*3.*c[3]))*inv_dx;
+    double mask = d2[m] < dmax2 ? 1.0 : 0.0;
+    qa[m] = mask*hj[m]*f;
+    qb[m] = mask*hi*g;
+    fac[m] = mask*(fi*swj[m]*fp + fj[m]*swi*gp)/d;
+  }
+}
+
+/* GB pair terms of a row, zero beyond the cutoff: the pair energies, the gradient factors and the
+   contributions to the Y's */
+CPUAGBNP_TARGETS
+static void gb_pair_batch(int n, double qi, double bi, double dielectric_factor, double cutoff2,
+			  const double * CPUAGBNP_RESTRICT d2, const double * CPUAGBNP_RESTRICT qj,
+			  const double * CPUAGBNP_RESTRICT bj,
+			  double * CPUAGBNP_RESTRICT egb, double * CPUAGBNP_RESTRICT mw,
+			  double * CPUAGBNP_RESTRICT yt){
+  double pt25 = 0.25;
+  for(int m = 0; m < n; m++){
+    double bb = bi*bj[m];
+    double et = gaussvol_exp(-pt25*d2[m]/bb);
+    double mask = d2[m] < cutoff2 ? 1.0 : 0.0;
+    double qqf = mask*qi*qj[m];
+    double qq = dielectric_factor*qqf;
+    double fgb = 1./sqrt(d2[m] + bb*et);
+    double fgb3 = fgb*fgb*fgb;
+    egb[m] = 2.*qq*fgb;
+    mw[m] = -2.0*qq*(1.0-pt25*et)*fgb3;
+    yt[m] = qqf*(bb+pt25*d2[m])*et*fgb3;
+  }
+}
+
+void CpuAGBNPThreadData::grow(int n){
+  if(n <= (int)pj.size()) return;
+  pj.resize(n);
+  tij.resize(n);
+  tji.resize(n);
+  dx.resize(n);
+  dy.resize(n);
+  dz.resize(n);
+  d2.resize(n);
+  p1.resize(n);
+  p2.resize(n);
+  p3.resize(n);
+  r1.resize(n);
+  r2.resize(n);
+  r3.resize(n);
+  r4.resize(n);
+  r5.resize(n);
+}
+
+void CpuCalcAGBNPForceKernel::rowBlocks(int nt, bool allPairs, vector<int>& block){
+  long total = allPairs ? (long)numParticles*(numParticles-1)/2 : neighbor_start[numParticles];
+  block.resize(nt+1);
+  block[0] = 0;
+  long sum = 0;
+  int t = 1;
+  for(int i = 0; i < numParticles && t < nt; i++){
+    sum += allPairs ? numParticles - i - 1 : neighbor_start[i+1] - neighbor_start[i];
+    if(sum*nt >= total*t) block[t++] = i+1;
+  }
+  while(t <= nt) block[t++] = numParticles;
+}
+
+int CpuCalcAGBNPForceKernel::gatherRow(int i, bool allPairs, vector<RealVec>& pos, CpuAGBNPThreadData& td){
+  int n = allPairs ? numParticles - i - 1 : neighbor_start[i+1] - neighbor_start[i];
+  td.grow(n);
+  if(n <= 0) return 0;
+  const int *list = allPairs ? 0 : &neighbor_list[neighbor_start[i]];
+  for(int m = 0; m < n; m++){
+    int j = allPairs ? i + 1 + m : list[m];
+    RealVec dist = usePeriodic ? pairDelta(pos[i], pos[j]) : pos[j] - pos[i];
+    td.pj[m] = j;
+    td.dx[m] = dist[0];
+    td.dy[m] = dist[1];
+    td.dz[m] = dist[2];
+    td.d2[m] = dist.dot(dist);
+  }
+  return n;
+}
+
+/* same list as the Reference kernel, from its cell grid of the atoms with the rows split
+   among the threads */
+void CpuCalcAGBNPForceKernel::buildNeighborList(vector<RealVec>& pos){
+  RealOpenMM rlist = (useCutoff ? cutoffDistance : AGBNP_I4LOOKUP_MAXA) + neighborSkin;
+  RealOpenMM rlist2 = rlist*rlist;
+  initNeighborGrid(pos, rlist);
+
+  int nt = numThreads < numParticles ? numThreads : 1;
+  runThreads(nt, [&](int t){
+      CpuAGBNPThreadData& td = thread_data[t];
+      int first = (long)t*numParticles/nt;
+      int last = (long)(t+1)*numParticles/nt;
+      td.row_count.resize(last - first);
+      td.list.clear();
+      for(int i = first; i < last; i++){
+	td.row_count[i - first] = neighborRow(i, pos, rlist2, td.candidates, td.list);
+      }
+    });
+
+  //rows in order
+  neighbor_start.resize(numParticles+1);
+  int total = 0;
+  for(int t = 0; t < nt; t++) total += thread_data[t].list.size();
+  neighbor_list.resize(total);
+  int k = 0, i = 0;
+  for(int t = 0; t < nt; t++){
+    CpuAGBNPThreadData& td = thread_data[t];
+    copy(td.list.begin(), td.list.end(), neighbor_list.begin() + k);
+    for(int r = 0; r < (int)td.row_count.size(); r++){
+      neighbor_start[i++] = k;
+      k += td.row_count[r];
+    }
+  }
+  neighbor_start[numParticles] = k;
+}
+
+/* inverse Born radii and Born radii. Each thread descreens the atoms of a block of rows
+   into its own buffer and the buffers are reduced in thread order. */
+void CpuCalcAGBNPForceKernel::computeBornRadii(vector<RealVec>& pos){
+  RealOpenMM pifac = 1./(4.*M_PI);
+  RealOpenMM dmax = AGBNP_I4LOOKUP_MAXA;
+  if(useCutoff && cutoffDistance < dmax) dmax = cutoffDistance;
+  RealOpenMM dmax2 = dmax*dmax;
+  type_screened.resize(numParticles);
+  type_screener.resize(numParticles);
+  screener_weight.resize(numParticles);
+  for(int i = 0; i < numParticles; i++){
+    type_screened[i] = i4_lut->radius_type_screened[i]*i4_table->ntypes_screener;
+    //hydrogens do not descreen, their table (type -1) is replaced by a valid one with zero weight
+    type_screener[i] = ishydrogen[i] == 0 ? i4_lut->radius_type_screener[i] : 0;
+    screener_weight[i] = ishydrogen[i] == 0 ? pifac*volume_scaling_factor[i] : 0.0;
+  }
+
+  int nt = numThreads < numParticles ? numThreads : 1;
+  rowBlocks(nt, false, row_block);
+  runThreads(nt, [&](int t){
+      CpuAGBNPThreadData& td = thread_data[t];
+      td.acc1.assign(numParticles, 0.0);
+      for(int i = row_block[t]; i < row_block[t+1]; i++){
+	int n = gatherRow(i, false, pos, td);
+	if(n == 0) continue;
+	for(int m = 0; m < n; m++){
+	  int j = td.pj[m];
+	  td.tij[m] = type_screened[i] + type_screener[j];
+	  td.tji[m] = type_screened[j] + type_screener[i];
+	  td.p1[m] = screener_weight[j];
+	}
+	descreen_batch(n, dmax2, screener_weight[i], &td.d2[0], &td.p1[0], &td.tij[0], &td.tji[0],
+		       &i4_table->coeff[0], i4_table->nintervals, i4_table->rmin, i4_table->inv_dx,
+		       &td.r1[0], &td.r2[0]);
+	RealOpenMM sum = 0.0;
+	for(int m = 0; m < n; m++){
+	  sum += td.r1[m];
+	  td.acc1[td.pj[m]] += td.r2[m];
+	}
+	td.acc1[i] += sum;
+      }
+    });
+
+  for(int i = 0; i < numParticles; i++){
+    inverse_born_radius[i] = 1./radii_vdw[i];
+  }
+  for(int t = 0; t < nt; t++){
+    for(int i = 0; i < numParticles; i++){
+      inverse_born_radius[i] -= thread_data[t].acc1[i];
+    }
+  }
+  setBornRadii();
+}
+
+/* GB pair energy with the rows split among the threads in blocks with about the same number
+   of pairs, over the neighbor list with a cutoff and over all pairs otherwise. Each thread
+   accumulates into its own force and Y buffers, which are then reduced in thread order. */
+RealOpenMM CpuCalcAGBNPForceKernel::computeGBPairEnergy(vector<RealVec>& pos, vector<RealVec>& force,
+							RealOpenMM dielectric_factor, RealOpenMM w_egb,
+							vector<RealOpenMM>& egb_der_Y, bool includeForces){
+  if(useGBPairTreecode()){
+    return computeGBPairEnergyTreecode(pos, force, dielectric_factor, w_egb, egb_der_Y, includeForces);
+  }
+  bool allPairs = !useCutoff;
+  RealOpenMM cutoff2 = useCutoff ? cutoffDistance*cutoffDistance : DBL_MAX;
+  int nt = numThreads < numParticles ? numThreads : 1;
+  rowBlocks(nt, allPairs, row_block);
+  RealVec zero3 = RealVec(0,0,0);
+  runThreads(nt, [&](int t){
+      CpuAGBNPThreadData& td = thread_data[t];
+      td.energy = 0.0;
+      if(includeForces){
+	td.force.assign(numParticles, zero3);
+	td.acc1.assign(numParticles, 0.0);
+      }
+      for(int i = row_block[t]; i < row_block[t+1]; i++){
+	int n = gatherRow(i, allPairs, pos, td);
+	if(n == 0) continue;
+	for(int m = 0; m < n; m++){
+	  int j = td.pj[m];
+	  td.p1[m] = charge[j];
+	  td.p2[m] = born_radius[j];
+	}
+	gb_pair_batch(n, charge[i], born_radius[i], dielectric_factor, cutoff2, &td.d2[0], &td.p1[0],
+		      &td.p2[0], &td.r3[0], &td.r4[0], &td.r5[0]);
+	RealOpenMM egb = 0.0;
+	for(int m = 0; m < n; m++) egb += td.r3[m];
+	td.energy += egb;
+	if(!includeForces) continue;
+	RealVec fi = zero3;
+	RealOpenMM yi = 0.0;
+	for(int m = 0; m < n; m++){
+	  int j = td.pj[m];
+	  RealVec g = RealVec(td.dx[m], td.dy[m], td.dz[m]) * (td.r4[m]*w_egb);
+	  fi += g;
+	  td.force[j] -= g;
+	  yi += td.r5[m];
+	  td.acc1[j] += td.r5[m];
+	}
+	td.force[i] += fi;
+	td.acc1[i] += yi;
+      }
+    });
+
+  RealOpenMM gb_pair_energy = 0.0;
+  for(int t = 0; t < nt; t++){
+    gb_pair_energy += thread_data[t].energy;
+    if(!includeForces) continue;
+    for(int i = 0; i < numParticles; i++){
+      force[i] += thread_data[t].force[i];
+      egb_der_Y[i] += thread_data[t].acc1[i];
+    }
+  }
+  return gb_pair_energy;
+}
+
+/* Born radii components of the gradients and W's and U's, as in the Reference kernel,
+   with the rows split among the threads and per-thread force, W and U buffers */
+void CpuCalcAGBNPForceKernel::computeBornRadiiDerivatives(vector<RealVec>& pos, vector<RealVec>& force,
+							  vector<RealOpenMM>& evdw_der_brw, vector<RealOpenMM>& egb_der_bru,
+							  RealOpenMM w_vdw, RealOpenMM w_egb,
+							  vector<RealOpenMM>& evdw_der_W, vector<RealOpenMM>& egb_der_U){
+  RealOpenMM dmax = AGBNP_I4LOOKUP_MAXA;
+  if(useCutoff && cutoffDistance < dmax) dmax = cutoffDistance;
+  RealOpenMM dmax2 = dmax*dmax;
+  //type_screened and type_screener are set by computeBornRadii()
+  der_weight.resize(numParticles);
+  for(int i = 0; i < numParticles; i++){
+    der_weight[i] = w_vdw*evdw_der_brw[i] + w_egb*egb_der_bru[i];
+  }
+
+  int nt = numThreads < numParticles ? numThreads : 1;
+  rowBlocks(nt, false, row_block);
+  RealVec zero3 = RealVec(0,0,0);
+  runThreads(nt, [&](int t){
+      CpuAGBNPThreadData& td = thread_data[t];
+      td.force.assign(numParticles, zero3);
+      td.acc1.assign(numParticles, 0.0);
+      td.acc2.assign(numParticles, 0.0);
+      for(int i = row_block[t]; i < row_block[t+1]; i++){
+	int n = gatherRow(i, false, pos, td);
+	if(n == 0) continue;
+	for(int m = 0; m < n; m++){
+	  int j = td.pj[m];
+	  td.tij[m] = type_screened[i] + type_screener[j];
+	  td.tji[m] = type_screened[j] + type_screener[i];
+	  td.p1[m] = ishydrogen[j] == 0 ? 1.0 : 0.0;
+	  td.p2[m] = td.p1[m]*volume_scaling_factor[j];
+	  td.p3[m] = der_weight[j];
+	}
+	RealOpenMM hi = ishydrogen[i] == 0 ? 1.0 : 0.0;
+	descreen_der_batch(n, dmax2, hi, hi*volume_scaling_factor[i], der_weight[i],
+			   &td.d2[0], &td.p1[0], &td.p2[0], &td.p3[0], &td.tij[0], &td.tji[0],
+			   &i4_table->coeff[0], i4_table->nintervals, i4_table->rmin, i4_table->inv_dx,
+			   &td.r1[0], &td.r2[0], &td.r3[0]);
+	RealVec fi = zero3;
+	RealOpenMM wi = 0.0, ui = 0.0;
+	for(int m = 0; m < n; m++){
+	  int j = td.pj[m];
+	  td.acc1[j] += evdw_der_brw[i]*td.r1[m];
+	  td.acc2[j] += egb_der_bru[i]*td.r1[m];
+	  wi += evdw_der_brw[j]*td.r2[m];
+	  ui += egb_der_bru[j]*td.r2[m];
+	  RealVec g = RealVec(td.dx[m], td.dy[m], td.dz[m]) * td.r3[m];
+	  fi += g;
+	  td.force[j] -= g;
+	}
+	td.force[i] += fi;
+	td.acc1[i] += wi;
+	td.acc2[i] += ui;
+      }
+    });
+
+  for(int i = 0; i < numParticles; i++){
+    evdw_der_W[i] = egb_der_U[i] = 0.0;
+  }
+  for(int t = 0; t < nt; t++){
+    CpuAGBNPThreadData& td = thread_data[t];
+    for(int i = 0; i < numParticles; i++){
+      force[i] += td.force[i];
+      evdw_der_W[i] += td.acc1[i];
+      egb_der_U[i] += td.acc2[i];
+    }
+  }
+}
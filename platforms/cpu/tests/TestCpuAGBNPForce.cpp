@@ -0,0 +1,125 @@
+/* -------------------------------------------------------------------------- *
+ *                              OpenMM-AGBNP                                 *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the CPU implementation of AGBNPForce against the Reference implementation.
+ */
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <map>
+#include "AGBNPForce.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+
+using namespace AGBNPPlugin;
+using namespace OpenMM;
+using namespace std;
+
+extern "C" OPENMM_EXPORT void registerAGBNPReferenceKernelFactories();
+extern "C" OPENMM_EXPORT void registerAGBNPCpuKernelFactories();
+
+//energy and forces of the system on the Reference platform and on the CPU platform with 2 threads
+void compareForce(System& system, AGBNPForce* force, vector<Vec3>& positions, int version, AGBNPForce::NonbondedMethod method) {
+    force->setVersion(version);
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(1.0);
+
+    VerletIntegrator integ1(1.0);
+    Context context1(system, integ1, Platform::getPlatformByName("Reference"));
+    context1.setPositions(positions);
+    State state1 = context1.getState(State::Energy | State::Forces);
+
+    map<string, string> properties;
+    properties["Threads"] = "2";
+    VerletIntegrator integ2(1.0);
+    Context context2(system, integ2, Platform::getPlatformByName("CPU"), properties);
+    context2.setPositions(positions);
+    State state2 = context2.getState(State::Energy | State::Forces);
+
+    std::cout << "Version " << version << " method " << method << " Energy Reference: " << state1.getPotentialEnergy()
+	      << " CPU: " << state2.getPotentialEnergy() << std::endl;
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1.e-8);
+    for(int i = 0; i < system.getNumParticles(); i++){
+      ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1.e-6);
+    }
+
+    //energy-only evaluation
+    double energy_only = context2.getState(State::Energy).getPotentialEnergy();
+    ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), energy_only, 1.e-10);
+}
+
+void testForce() {
+    System system;
+    NonbondedForce *nb = new NonbondedForce();
+    AGBNPForce* force = new AGBNPForce();
+    system.addForce(nb);
+    system.addForce(force);
+    //read from stdin
+    int numParticles = 0;
+    double id, x, y, z, radius, charge;
+    double gamma;
+    bool ishydrogen;
+    vector<Vec3> positions;
+    std::cin >> numParticles;
+    int ih;
+    double ang2nm = 0.1;
+    double kcalmol2kjmol = 4.184;
+
+    double sigmaw = 3.15365*ang2nm; /* LJ sigma of TIP4P water oxygen */
+    double epsilonw = 0.155*kcalmol2kjmol;        /* LJ epsilon of TIP4P water oxygen */
+    double rho = 0.033428/pow(ang2nm,3);   /* water number density */
+    double epsilon_LJ = 0.155*kcalmol2kjmol;
+    double sigma_LJ;
+
+    for(int i=0;i<numParticles;i++){
+      std::cin >> id >> x >> y >> z >> radius >> charge >> gamma >> ih;
+      system.addParticle(1.0);
+      positions.push_back(Vec3(x, y, z)*ang2nm);
+      ishydrogen = (ih > 0);
+      radius *= ang2nm;
+      gamma *= kcalmol2kjmol/(ang2nm*ang2nm);
+      sigma_LJ = 2.*radius;
+      double sij = sqrt(sigmaw*sigma_LJ);
+      double eij = sqrt(epsilonw*epsilon_LJ);
+      double alpha = - 16.0 * M_PI * rho * eij * pow(sij,6) / 3.0;
+      nb->addParticle(0.0,0.0,0.0);
+      force->addParticle(radius, gamma, alpha, charge, ishydrogen);
+    }
+
+    //the molecule straddles the faces of a box small enough for the images to interact
+    system.setDefaultPeriodicBoxVectors(Vec3(3.0, 0, 0), Vec3(0, 3.0, 0), Vec3(0, 0, 3.0));
+    for(int version = 1; version <= 2; version++){
+      compareForce(system, force, positions, version, AGBNPForce::NoCutoff);
+      compareForce(system, force, positions, version, AGBNPForce::CutoffNonPeriodic);
+      compareForce(system, force, positions, version, AGBNPForce::CutoffPeriodic);
+    }
+}
+
+int main() {
+  try {
+    Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+    try {
+      Platform::getPlatformByName("CPU");
+    }
+    catch(const OpenMMException& e) {
+      std::cout << "CPU platform not available, skipping test" << std::endl;
+      return 0;
+    }
+    registerAGBNPCpuKernelFactories();
+    registerAGBNPReferenceKernelFactories();
+    testForce();
+  }
+  catch(const std::exception& e) {
+    std::cout << "exception: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -9,12 +9,16 @@
 #include "openmm/opencl/OpenCLNonbondedUtilities.h"
 #include "openmm/opencl/OpenCLArray.h"
 #include "openmm/opencl/OpenCLForceInfo.h"
+#include "openmm/Platform.h"
 #include <cmath>
 #include <cfloat>
 
 #include <fstream>
 #include <iomanip>
+#include <sstream>
 #include <algorithm>
+#include <cstdio>
+#include <random>
 
 #include "openmm/reference/SimTKOpenMMRealType.h"
 #include "openmm/reference/RealVec.h"
@@ -37,6 +41,19 @@
 // conversion factors from spheres to Gaussians
 //#define KFC (2.2269859253)
 
+//first guess of the number of overlaps per atom to lay out the tree for the counting pass
+#define AGBNP_TREE_OVERLAPS_GUESS (64)
+
+//growth factor of the sections of the overlap tree that overflowed, and of the tree buffers
+//when they need to be reallocated
+#define AGBNP_TREE_HEADROOM (1.5)
+
+//number of times a step is replayed after tree overflows before giving up
+#define AGBNP_MAX_TREE_REPLAYS (10)
+
+//OpenCLContext::reorderAtoms() reorders the atoms every this many steps when a cutoff is used
+#define AGBNP_REORDER_INTERVAL (250)
+
 using namespace AGBNPPlugin;
 using namespace OpenMM;
 using namespace std;
@@ -63,6 +80,10 @@ OpenCLCalcAGBNPForceKernel::~OpenCLCalcAGBNPForceKernel() {
   if(gtreems != NULL) delete gtreems;
   if(MSparticle1 != NULL) delete MSparticle1;
   if(MSparticle2 != NULL) delete MSparticle2;
+  if(pinnedPanicButtonBuffer != NULL) delete pinnedPanicButtonBuffer;
+  if(savedPosq != NULL) delete savedPosq;
+  if(savedPosqCorrection != NULL) delete savedPosqCorrection;
+  if(savedVelm != NULL) delete savedVelm;
 }
 
 
@@ -243,6 +264,21 @@ void OpenCLCalcAGBNPForceKernel::OpenCLOverlapTree::init_tree_size(int padded_nu
 }
 
 
+//grows the sections that overflowed, those whose size reached the padded size, by scaling the
+//numbers of overlaps of their atoms. The scaled numbers are kept as the lower bounds of later
+//layouts. Returns true if the new layout fits in the tree buffers.
+bool OpenCLCalcAGBNPForceKernel::OpenCLOverlapTree::grow_tree_sections(vector<int>& section_sizes, int num_compute_units, int pad_modulo, double headroom){
+  for(int section = 0; section < num_sections; section++){
+    if(section_sizes[section] < padded_tree_size[section]) continue;
+    for(int i = first_atom[section]; i < first_atom[section] + natoms_in_tree[section]; i++){
+      saved_noverlaps[i] = (int)(headroom*saved_noverlaps[i]) + 1;
+    }
+  }
+  vector<int> noverlaps(num_atoms);
+  for(int i = 0; i < num_atoms; i++) noverlaps[i] = 0;
+  init_tree_size(num_atoms, padded_num_atoms, num_compute_units, pad_modulo, noverlaps);
+  return total_tree_size <= tree_capacity;
+}
 
 void OpenCLCalcAGBNPForceKernel::OpenCLOverlapTree::resize_tree_buffers(OpenMM::OpenCLContext& cl, int ov_work_group_size){
   if(ovAtomTreePointer) delete ovAtomTreePointer;
@@ -261,46 +297,50 @@ void OpenCLCalcAGBNPForceKernel::OpenCLOverlapTree::resize_tree_buffers(OpenMM::
   ovAtomTreeLock = OpenCLArray::create<cl_int>(cl, num_sections, "ovAtomTreeLock");
   if(ovFirstAtom) delete ovFirstAtom;
   ovFirstAtom = OpenCLArray::create<cl_int>(cl, num_sections, "ovFirstAtom");
+  //tree buffers are never shrunk so that the tree can later grow in place
+  if(tree_capacity < total_tree_size) tree_capacity = total_tree_size;
   if(ovLevel) delete ovLevel;
-  ovLevel = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovLevel");
+  ovLevel = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovLevel");
   if(ovG) delete ovG;
-  ovG = OpenCLArray::create<mm_float4>(cl, total_tree_size, "ovG"); //gaussian position + exponent
+  ovG = OpenCLArray::create<mm_float4>(cl, tree_capacity, "ovG"); //gaussian position + exponent
   if(ovVolume) delete ovVolume;
-  ovVolume = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovVolume");
+  ovVolume = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovVolume");
   if(ovVsp) delete ovVsp;
-  ovVsp = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovVsp");  
+  ovVsp = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovVsp");  
   if(ovVSfp) delete ovVSfp;
-  ovVSfp = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovVSfp");
+  ovVSfp = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovVSfp");
   if(ovSelfVolume) delete ovSelfVolume;
-  ovSelfVolume = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovSelfVolume");
+  ovSelfVolume = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovSelfVolume");
   if(ovVolEnergy) delete ovVolEnergy;
-  ovVolEnergy = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovVolEnergy");
+  ovVolEnergy = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovVolEnergy");
   if(ovGamma1i) delete ovGamma1i;
-  ovGamma1i = OpenCLArray::create<cl_float>(cl, total_tree_size, "ovGamma1i");
+  ovGamma1i = OpenCLArray::create<cl_float>(cl, tree_capacity, "ovGamma1i");
   if(ovDV1) delete ovDV1;
-  ovDV1 = OpenCLArray::create<mm_float4>(cl, total_tree_size, "ovDV1"); //dV12/dr1 + dV12/dV1 for each overlap
+  ovDV1 = OpenCLArray::create<mm_float4>(cl, tree_capacity, "ovDV1"); //dV12/dr1 + dV12/dV1 for each overlap
   if(ovDV2) delete ovDV2;
-  ovDV2 = OpenCLArray::create<mm_float4>(cl, total_tree_size, "ovDV2"); //volume gradient accumulator
+  ovDV2 = OpenCLArray::create<mm_float4>(cl, tree_capacity, "ovDV2"); //volume gradient accumulator
   if(ovPF) delete ovPF;
-  ovPF = OpenCLArray::create<mm_float4>(cl, total_tree_size, "ovPF"); //(P) and (F) auxiliary variables
+  ovPF = OpenCLArray::create<mm_float4>(cl, tree_capacity, "ovPF"); //(P) and (F) auxiliary variables
   if(ovLastAtom) delete ovLastAtom;
-  ovLastAtom = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovLastAtom");
+  ovLastAtom = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovLastAtom");
   if(ovRootIndex) delete ovRootIndex;
-  ovRootIndex = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovRootIndex");
+  ovRootIndex = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovRootIndex");
   if(ovChildrenStartIndex) delete ovChildrenStartIndex;
-  ovChildrenStartIndex = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovChildrenStartIndex");
+  ovChildrenStartIndex = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovChildrenStartIndex");
   if(ovChildrenCount) delete ovChildrenCount;
-  ovChildrenCount = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovChildrenCount");
+  ovChildrenCount = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovChildrenCount");
   if(ovChildrenCountTop) delete ovChildrenCountTop;
-  ovChildrenCountTop = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovChildrenCountTop");
+  ovChildrenCountTop = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovChildrenCountTop");
   if(ovChildrenCountBottom) delete ovChildrenCountBottom;
-  ovChildrenCountBottom = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovChildrenCountBottom");
+  ovChildrenCountBottom = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovChildrenCountBottom");
   if(ovProcessedFlag) delete ovProcessedFlag;
-  ovProcessedFlag = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovProcessedFlag");
+  ovProcessedFlag = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovProcessedFlag");
   if(ovOKtoProcessFlag) delete ovOKtoProcessFlag;
-  ovOKtoProcessFlag = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovOKtoProcessFlag");
+  ovOKtoProcessFlag = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovOKtoProcessFlag");
   if(ovChildrenReported) delete ovChildrenReported;
-  ovChildrenReported = OpenCLArray::create<cl_int>(cl, total_tree_size, "ovChildrenReported");
+  ovChildrenReported = OpenCLArray::create<cl_int>(cl, tree_capacity, "ovChildrenReported");
+  if(ovAtomOverlapCount) delete ovAtomOverlapCount;
+  ovAtomOverlapCount = OpenCLArray::create<cl_int>(cl, padded_num_atoms, "ovAtomOverlapCount");
   
   
   // atomic reduction buffers, one for each tree section
@@ -393,11 +433,18 @@ int OpenCLCalcAGBNPForceKernel::OpenCLOverlapTree::copy_tree_to_device(void){
 void OpenCLCalcAGBNPForceKernel::initialize(const System& system, const AGBNPForce& force) {
     verbose_level = 0; 
 
+    tree_overlaps_guess = AGBNP_TREE_OVERLAPS_GUESS;
+
     //save version
     version = force.getVersion();
     if(verbose_level > 0)
       cout << "OpenCLCalcAGBNPForceKernel::initialize(): AGBNP version " << version << endl;
 
+    //only the AGBNP1 pipeline has fused kernels
+    useFusedKernels = force.getUseFusedKernels() && version == 1;
+
+    program_cache_dir = force.getProgramCacheDirectory();
+
     //set radius offset
     if(version == 0){
       roffset = AGBNP_RADIUS_INCREMENT;
@@ -541,20 +588,327 @@ void OpenCLCalcAGBNPForceKernel::initialize(const System& system, const AGBNPFor
 double OpenCLCalcAGBNPForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
   double energy = 0.0;
   if (!hasCreatedKernels || !hasInitializedKernels) {
+    //lays out the overlap tree with the last counts of overlaps per atom, or a guess the first time,
+    //and counts the overlaps on the device, doubling the layout until the tree fits. Then lays out
+    //the tree again with the new counts.
+    bool guessed = tree_noverlaps.size() == 0;
+    if(hasCreatedKernels) ms_tree_section_size = -1; //re-estimates the MS tree
     executeInitKernels(context, includeForces, includeEnergy);
-    hasInitializedKernels = true;
     hasCreatedKernels = true;
+    vector<int> saved_noverlaps = gtree->saved_noverlaps;
+    while(!countOverlapTree()){
+      tree_noverlaps.resize(cl.getPaddedNumAtoms());
+      for(int i = 0; i < gtree->saved_noverlaps.size(); i++) tree_noverlaps[i] = 2*gtree->saved_noverlaps[i];
+      executeInitKernels(context, includeForces, includeEnergy);
+    }
+    //the guessed and doubled layouts are not lower bounds of the sizes of the tree, keep only
+    //the sizes that held before
+    if(guessed){
+      gtree->has_saved_noverlaps = false;
+    }else{
+      gtree->saved_noverlaps = saved_noverlaps;
+    }
+    executeInitKernels(context, includeForces, includeEnergy);
+    hasInitializedKernels = true;
   }
-  if(version == 0){
-    energy = executeGVolSA(context, includeForces, includeEnergy);
-  }else if(version == 1){
-    energy = executeAGBNP1(context, includeForces, includeEnergy);
-  }else if(version == 2){
-    energy = executeAGBNP2(context, includeForces, includeEnergy);
+  //validates the last evaluation, if its tree overflowed it is evaluated again
+  if(checkDeferredTreeOverflow(context, includeForces, includeEnergy)) return 0.0;
+  num_evaluations += 1;
+  //PanicButton is read without waiting only when the state this evaluation starts from can be
+  //restored at the next one, which is not the case if the atoms are reordered after this step
+  bool reorder_due = cl.getNonbondedUtilities().getUseCutoff() && cl.getStepsSinceReorder() >= AGBNP_REORDER_INTERVAL - 1;
+  synchronous_tree_check = includeEnergy || reorder_due;
+  if(!synchronous_tree_check){
+    //saves the state this evaluation starts from, its PanicButton is checked at the next evaluation
+    cl.getPosq().copyTo(*savedPosq);
+    if(savedPosqCorrection) cl.getPosqCorrection().copyTo(*savedPosqCorrection);
+    cl.getVelm().copyTo(*savedVelm);
+    deferred_step_count = cl.getStepCount();
+    deferred_force_count = cl.getComputeForceCount();
+  }
+  //if the overlap tree overflows, grows it and replays the step
+  for(int replay = 0; ; replay++){
+    hasTreeOverflow = false;
+    if(version == 0){
+      energy = executeGVolSA(context, includeForces, includeEnergy);
+    }else if(version == 1){
+      energy = executeAGBNP1(context, includeForces, includeEnergy);
+    }else if(version == 2){
+      energy = executeAGBNP2(context, includeForces, includeEnergy);
+    }
+    if(!hasTreeOverflow) break;
+    if(replay >= AGBNP_MAX_TREE_REPLAYS){
+      throw OpenMMException("AGBNP: the overlap tree keeps overflowing after being grown");
+    }
+    recoverTreeOverflow(context, includeForces, includeEnergy);
   }
   return 0.0;
 }
 
+void OpenCLCalcAGBNPForceKernel::launchKernel(cl::Kernel& kernel, int workUnits, int blockSize){
+  kernel_launch_count[kernel()] += 1;
+  cl.executeKernel(kernel, workUnits, blockSize);
+}
+
+//one line per kernel name with the number of launches and the launches per evaluation, the
+//launches made while initializing and replaying steps after a tree overflow are included
+string OpenCLCalcAGBNPForceKernel::getKernelLaunchReport(void){
+  map<string, int> counts;
+  int total = 0;
+  for(map<cl_kernel, int>::iterator it = kernel_launch_count.begin(); it != kernel_launch_count.end(); it++){
+    char name[256];
+    if(clGetKernelInfo(it->first, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL) != CL_SUCCESS) continue;
+    counts[string(name)] += it->second;
+    total += it->second;
+  }
+  double nev = num_evaluations > 0 ? num_evaluations : 1;
+  stringstream report;
+  report << "Kernel launches in " << num_evaluations << " evaluations, fused kernels " << (useFusedKernels ? "on" : "off") << endl;
+  for(map<string, int>::iterator it = counts.begin(); it != counts.end(); it++){
+    report << setw(40) << left << it->first << setw(10) << right << it->second << setw(10) << fixed << setprecision(2) << it->second/nev << endl;
+  }
+  report << setw(40) << left << "total" << setw(10) << right << total << setw(10) << fixed << setprecision(2) << total/nev << endl;
+  report << "Programs compiled: " << num_programs_compiled << ", loaded from the program cache: " << num_programs_from_cache << endl;
+  return report.str();
+}
+
+//first line of the files of the program cache, to be changed if their layout changes
+static const string program_cache_magic = "AGBNP OpenCL program binary 1";
+
+//64-bit FNV-1a hash, it names the files of the program cache
+static unsigned long long programCacheHash(const string& text){
+  unsigned long long hash = 14695981039346656037ULL;
+  for(size_t i = 0; i < text.size(); i++){
+    hash ^= (unsigned char) text[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+//lists what the binary of a program depends on. The source text enters through its hash. The
+//defines and options that OpenCLContext adds to it depend only on the device, the OpenMM version
+//and the precision.
+string OpenCLCalcAGBNPForceKernel::getProgramCacheKey(const string& source, const map<string, string>& defines){
+  cl::Device& device = cl.getDevice();
+  stringstream key;
+  key << "device: " << device.getInfo<CL_DEVICE_NAME>() << endl;
+  key << "vendor: " << device.getInfo<CL_DEVICE_VENDOR>() << endl;
+  key << "device version: " << device.getInfo<CL_DEVICE_VERSION>() << endl;
+  key << "driver version: " << device.getInfo<CL_DRIVER_VERSION>() << endl;
+  key << "OpenMM version: " << Platform::getOpenMMVersion() << endl;
+  key << "precision: " << (cl.getUseDoublePrecision() ? "double" : (cl.getUseMixedPrecision() ? "mixed" : "single")) << endl;
+  key << "64-bit atomics: " << cl.getSupports64BitGlobalAtomics() << endl;
+  key << "SIMD width: " << cl.getSIMDWidth() << endl;
+  key << "source: " << hex << setw(16) << setfill('0') << programCacheHash(source) << dec << " " << source.size() << endl;
+  for(map<string, string>::const_iterator it = defines.begin(); it != defines.end(); it++){
+    key << "define: " << it->first << " " << it->second << endl;
+  }
+  return key.str();
+}
+
+//on a cache miss the program is compiled and its binary is saved, failures of the cache are not
+//errors, they only cost a compilation
+cl::Program OpenCLCalcAGBNPForceKernel::createProgram(const string& source, const map<string, string>& defines){
+  if(program_cache_dir.empty()){
+    num_programs_compiled += 1;
+    return cl.createProgram(source, defines);
+  }
+  string key = getProgramCacheKey(source, defines);
+  stringstream filename;
+  filename << program_cache_dir << "/agbnp_" << hex << setw(16) << setfill('0') << programCacheHash(key) << ".bin";
+  cl::Program program;
+  if(loadProgramBinary(filename.str(), key, program)){
+    if(verbose_level > 0) cout << "loaded " << filename.str() << " from the program cache" << endl;
+    num_programs_from_cache += 1;
+    return program;
+  }
+  program = cl.createProgram(source, defines);
+  num_programs_compiled += 1;
+  saveProgramBinary(filename.str(), key, program);
+  return program;
+}
+
+//the file holds the magic line, a line with the sizes of the key and of the binary, the key
+//and the binary. The key is compared in full, the hash in the file name only locates it.
+bool OpenCLCalcAGBNPForceKernel::loadProgramBinary(const string& filename, const string& key, cl::Program& program){
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+  if(!file.is_open()) return false;
+  string magic;
+  size_t key_size = 0, binary_size = 0;
+  getline(file, magic);
+  file >> key_size >> binary_size;
+  file.get();
+  if(!file || magic != program_cache_magic || key_size != key.size() || binary_size == 0) return false;
+  string file_key(key_size, ' ');
+  vector<unsigned char> binary(binary_size);
+  file.read(&file_key[0], key_size);
+  file.read((char *) &binary[0], binary_size);
+  if(!file || file_key != key) return false;
+
+  cl_device_id device = cl.getDevice()();
+  const unsigned char *binary_ptr = &binary[0];
+  cl_int status, err;
+  cl_program prog = clCreateProgramWithBinary(cl.getContext()(), 1, &device, &binary_size, &binary_ptr, &status, &err);
+  if(err != CL_SUCCESS) return false;
+  if(status != CL_SUCCESS || clBuildProgram(prog, 1, &device, NULL, NULL, NULL) != CL_SUCCESS){
+    clReleaseProgram(prog);
+    return false;
+  }
+  program = cl::Program(prog);
+  return true;
+}
+
+void OpenCLCalcAGBNPForceKernel::saveProgramBinary(const string& filename, const string& key, cl::Program& program){
+  cl_uint num_devices = 0;
+  if(clGetProgramInfo(program(), CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &num_devices, NULL) != CL_SUCCESS || num_devices == 0) return;
+  vector<cl_device_id> devices(num_devices);
+  vector<size_t> sizes(num_devices);
+  if(clGetProgramInfo(program(), CL_PROGRAM_DEVICES, num_devices*sizeof(cl_device_id), &devices[0], NULL) != CL_SUCCESS) return;
+  if(clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, num_devices*sizeof(size_t), &sizes[0], NULL) != CL_SUCCESS) return;
+  cl_uint index = find(devices.begin(), devices.end(), cl.getDevice()()) - devices.begin();
+  if(index >= num_devices || sizes[index] == 0) return;
+  vector<vector<unsigned char> > binaries(num_devices);
+  vector<unsigned char *> binary_ptrs(num_devices);
+  for(cl_uint i = 0; i < num_devices; i++){
+    binaries[i].resize(sizes[i]);
+    binary_ptrs[i] = sizes[i] > 0 ? &binaries[i][0] : NULL;
+  }
+  if(clGetProgramInfo(program(), CL_PROGRAM_BINARIES, num_devices*sizeof(unsigned char *), &binary_ptrs[0], NULL) != CL_SUCCESS) return;
+
+  //writes a temporary file and renames it, so that the processes sharing the cache never
+  //read a partially written binary
+  stringstream tmpname;
+  tmpname << filename << ".tmp" << random_device()();
+  ofstream file(tmpname.str().c_str(), ios::out | ios::binary);
+  if(!file.is_open()) return;
+  file << program_cache_magic << endl << key.size() << " " << sizes[index] << endl;
+  file.write(key.data(), key.size());
+  file.write((const char *) &binaries[index][0], sizes[index]);
+  file.close();
+  if(file.fail() || rename(tmpname.str().c_str(), filename.c_str()) != 0){
+    remove(tmpname.str().c_str());
+  }
+}
+
+//reads PanicButton after the construction of the overlap tree. A synchronous read is waited for by
+//checkTreeOverflow(). Otherwise the read does not block, it goes to one of the two slots of the
+//pinned buffer and it is checked at the beginning of the next evaluation by
+//checkDeferredTreeOverflow().
+void OpenCLCalcAGBNPForceKernel::enqueuePanicButtonRead(bool synchronous){
+  if(synchronous){
+    cl.getQueue().enqueueReadBuffer(PanicButton->getDeviceBuffer(), CL_FALSE, 0, 2*sizeof(int), &panic_button[0], NULL, &downloadPanicButtonEvent);
+  }else{
+    int slot = panic_button_slot;
+    cl.getQueue().enqueueReadBuffer(PanicButton->getDeviceBuffer(), CL_FALSE, 0, 2*sizeof(int), &pinnedPanicButtonMemory[2*slot], NULL, &pendingPanicButtonEvent[slot]);
+    pending_panic_button_slot = slot;
+    panic_button_slot = 1 - slot;
+  }
+}
+
+//waits for a synchronous read of PanicButton, returns true if the tree overflowed
+bool OpenCLCalcAGBNPForceKernel::checkTreeOverflow(bool synchronous){
+  bool verbose = verbose_level > 0;
+  if(!synchronous) return false;
+  downloadPanicButtonEvent.wait();
+  if(panic_button[0] > 0){
+    if(verbose) cout << "Error: Tree size exceeded(2)!" << endl;
+    hasTreeOverflow = true; //the tree is grown and the step is replayed by execute()
+
+    if(panic_button[1] > 0){
+      if(verbose) cout << "Error: Temp Buffer exceeded(2)!" << endl;
+      gtree->hasExceededTempBuffer = true;//forces resizing of temp buffers
+    }
+    
+    if(verbose){
+      cout << "Tree sizes:" << endl;
+      vector<cl_int> size(gtree->num_sections);
+      gtree->ovAtomTreeSize->download(size);
+      for(int section=0;section < gtree->num_sections; section++){
+	cout << size[section] << " ";
+      }
+      cout << endl;
+    }
+    return true;
+  }
+  return false;
+}
+
+//checks the deferred read of PanicButton of the last evaluation. If its tree overflowed the tree is
+//grown. If this is the next force evaluation, in the step after that of the last evaluation, its
+//forces were used by that step only: the positions and velocities it started from are restored and
+//the forces are invalidated so that they are evaluated again from that state, returns true in that
+//case. Otherwise the state was set since and it is evaluated as is.
+bool OpenCLCalcAGBNPForceKernel::checkDeferredTreeOverflow(ContextImpl& context, bool includeForces, bool includeEnergy){
+  bool verbose = verbose_level > 0;
+  if(pending_panic_button_slot < 0) return false;
+  int slot = pending_panic_button_slot;
+  pending_panic_button_slot = -1;
+  pendingPanicButtonEvent[slot].wait(); //normally complete by now
+  int *panic = &pinnedPanicButtonMemory[2*slot];
+  if(panic[0] == 0) return false;
+
+  if(panic[1] > 0) gtree->hasExceededTempBuffer = true;//forces resizing of temp buffers
+  recoverTreeOverflow(context, includeForces, includeEnergy);
+  bool next_step = cl.getStepCount() == deferred_step_count + 1 && cl.getComputeForceCount() == deferred_force_count + 1;
+  if(!next_step){
+    if(verbose) cout << "Error: Tree size exceeded in an earlier evaluation, the state has been set since" << endl;
+    return false;
+  }
+  if(cl.getAtomsWereReordered()){
+    //reorders are anticipated by execute(), which does not defer the read before one
+    throw OpenMMException("AGBNP: the overlap tree overflowed in the step before the atoms were reordered, it cannot be rolled back");
+  }
+  if(verbose) cout << "Error: Tree size exceeded in the last evaluation, rolling back" << endl;
+  savedPosq->copyTo(cl.getPosq());
+  if(savedPosqCorrection) savedPosqCorrection->copyTo(cl.getPosqCorrection());
+  savedVelm->copyTo(cl.getVelm());
+  cl.setForcesValid(false);
+  return true;
+}
+
+//grows the overlap trees after PanicButton was raised. The sections of the atom tree that
+//overflowed are grown, the tree is laid out again within the current buffers if it fits, otherwise
+//the buffers are reallocated with some headroom and the kernel arguments are set again. The sections
+//of the MS tree are doubled if one of them overflowed. Kernels are not recompiled. PanicButton is
+//cleared so that the step can be evaluated again.
+void OpenCLCalcAGBNPForceKernel::recoverTreeOverflow(ContextImpl& context, bool includeForces, bool includeEnergy){
+  bool verbose = verbose_level > 0;
+
+  vector<cl_int> size(gtree->num_sections);
+  gtree->ovAtomTreeSize->download(size);
+  bool full = false;
+  for(int section = 0; section < gtree->num_sections; section++){
+    if(size[section] >= gtree->padded_tree_size[section]) full = true;
+  }
+  bool ms_full = false;
+  if(do_ms){
+    vector<cl_int> ms_size(gtreems->num_sections);
+    gtreems->ovAtomTreeSize->download(ms_size);
+    for(int section = 0; section < gtreems->num_sections; section++){
+      if(ms_size[section] >= gtreems->padded_tree_size[section]) ms_full = true;
+    }
+  }
+  //PanicButton does not tell which tree exceeded its temporary buffers, both are grown. If no
+  //overflow is found the buffers are grown all the same rather than accepting the step.
+  if(!full && !ms_full) gtree->hasExceededTempBuffer = true;
+  if(do_ms && gtree->hasExceededTempBuffer) gtreems->hasExceededTempBuffer = true;
+  if(ms_full) ms_tree_section_size *= 2;
+
+  num_tree_overflows += 1;
+  int pad_modulo = ov_work_group_size;
+  bool fits = gtree->grow_tree_sections(size, num_compute_units, pad_modulo, AGBNP_TREE_HEADROOM);
+  if(fits && !gtree->hasExceededTempBuffer && !ms_full){
+    gtree->copy_tree_to_device();
+    panic_button[0] = panic_button[1] = 0;
+    PanicButton->upload(panic_button);
+    if(verbose) cout << "Tree overflow " << num_tree_overflows << ": tree grown in place to " << gtree->total_tree_size << endl;
+  }else{
+    if(fits == false) gtree->tree_capacity = (int)(AGBNP_TREE_HEADROOM*gtree->total_tree_size);
+    executeInitKernels(context, includeForces, includeEnergy);
+    if(verbose) cout << "Tree overflow " << num_tree_overflows << ": tree buffers reallocated with size " << gtree->tree_capacity << endl;
+  }
+}
+
 
 void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool includeForces, bool includeEnergy) {
   OpenCLNonbondedUtilities& nb = cl.getNonbondedUtilities();
@@ -564,59 +918,15 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
   maxTiles = (nb.getUseCutoff() ? nb.getInteractingTiles().getSize() : 0);
   
       {
-      //run CPU version once to estimate sizes
-      GaussVol *gvol;
-      std::vector<RealVec> positions;
-      std::vector<int> ishydrogen;
-      std::vector<RealOpenMM> radii;
-      std::vector<RealOpenMM> gammas;
-      //outputs
-      RealOpenMM volume, vol_energy;
-      std::vector<RealOpenMM> free_volume, self_volume;
-      std::vector<RealVec> vol_force;
-      std::vector<RealOpenMM> vol_dv;
+      //sizes of the overlap trees
       int numParticles = cl.getNumAtoms();
-      //input lists
-      positions.resize(numParticles);
-      radii.resize(numParticles);
-      gammas.resize(numParticles);
-      ishydrogen.resize(numParticles);
-      //output lists
-      free_volume.resize(numParticles);
-      self_volume.resize(numParticles);
-      vol_force.resize(numParticles);
-      vol_dv.resize(numParticles);
-      
-      double energy_density_param = 4.184*1000.0/27; //about 1 kcal/mol for each water volume
-      for (int i = 0; i < numParticles; i++){
-	double r, g, alpha, q;
-	bool h;
-	gvol_force->getParticleParameters(i, r, g, alpha, q, h);
-	radii[i] = r + roffset;
-	gammas[i] = energy_density_param;
-	if(h) gammas[i] = 0.0;
-	ishydrogen[i] = h ? 1 : 0;
-      }
-      gvol = new GaussVol(numParticles, ishydrogen);
-      vector<mm_float4> posq; 
-      cl.getPosq().download(posq);
-      for(int i=0;i<numParticles;i++){
- 	positions[i] = RealVec((RealOpenMM)posq[i].x,(RealOpenMM)posq[i].y,(RealOpenMM)posq[i].z);
-      }
-      vector<RealOpenMM> volumes(numParticles);
-      for(int i = 0; i < numParticles; i++){
-	volumes[i] = 4.*M_PI*pow(radii[i],3)/3.;
-      }
-      gvol->setRadii(radii);      
-      gvol->setVolumes(volumes);
-      gvol->setGammas(gammas);
-      gvol->compute_tree(positions);
-      gvol->compute_volume(positions, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
-      vector<int> noverlaps(cl.getPaddedNumAtoms());
-      for(int i = 0; i<cl.getPaddedNumAtoms(); i++) noverlaps[i] = 0;
-      gvol->getstat(noverlaps);
-      //gvol->print_tree();
 
+      //numbers of overlaps per atom from the last counting pass on the device, or a guess to lay out
+      //the tree for the first counting pass (see countOverlapTree())
+      vector<int> noverlaps(cl.getPaddedNumAtoms());
+      for(int i = 0; i<cl.getPaddedNumAtoms(); i++){
+	noverlaps[i] = tree_noverlaps.size() > 0 ? tree_noverlaps[i] : tree_overlaps_guess;
+      }
       
       int nn = 0;
       for(int i = 0; i < noverlaps.size(); i++){
@@ -694,9 +1004,56 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 
 
       //MS model
-      if(do_ms){
-
-	//estimate size for MS particles buffers and overlap tree
+      if(do_ms && ms_tree_section_size < 0){
+
+	//estimate size for MS particles buffers and overlap tree from the CPU volume model,
+	//once per (re)initialization
+	GaussVol *gvol;
+	std::vector<RealVec> positions;
+	std::vector<int> ishydrogen;
+	std::vector<RealOpenMM> radii;
+	std::vector<RealOpenMM> gammas;
+	//outputs
+	RealOpenMM volume, vol_energy;
+	std::vector<RealOpenMM> free_volume, self_volume;
+	std::vector<RealVec> vol_force;
+	std::vector<RealOpenMM> vol_dv;
+	//input lists
+	positions.resize(numParticles);
+	radii.resize(numParticles);
+	gammas.resize(numParticles);
+	ishydrogen.resize(numParticles);
+	//output lists
+	free_volume.resize(numParticles);
+	self_volume.resize(numParticles);
+	vol_force.resize(numParticles);
+	vol_dv.resize(numParticles);
+	
+	double energy_density_param = 4.184*1000.0/27; //about 1 kcal/mol for each water volume
+	for (int i = 0; i < numParticles; i++){
+	  double r, g, alpha, q;
+	  bool h;
+	  gvol_force->getParticleParameters(i, r, g, alpha, q, h);
+	  radii[i] = r + roffset;
+	  gammas[i] = energy_density_param;
+	  if(h) gammas[i] = 0.0;
+	  ishydrogen[i] = h ? 1 : 0;
+	}
+	gvol = new GaussVol(numParticles, ishydrogen);
+	vector<mm_float4> posq; 
+	cl.getPosq().download(posq);
+	for(int i=0;i<numParticles;i++){
+	  positions[i] = RealVec((RealOpenMM)posq[i].x,(RealOpenMM)posq[i].y,(RealOpenMM)posq[i].z);
+	}
+	vector<RealOpenMM> volumes(numParticles);
+	for(int i = 0; i < numParticles; i++){
+	  volumes[i] = 4.*M_PI*pow(radii[i],3)/3.;
+	}
+	gvol->setRadii(radii);      
+	gvol->setVolumes(volumes);
+	gvol->setGammas(gammas);
+	gvol->compute_tree(positions);
+	gvol->compute_volume(positions, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
 
 	//recompute self-volumes with small radii
 	for(int i = 0; i < numParticles ; i++){
@@ -770,18 +1127,8 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 
 
 	
-	//allocates buffers for 1st MS particle list
-	int count = msparticles1.size();
-	int ntiles = cl.getPaddedNumAtoms()/OpenCLContext::TileSize;
-	int pad_modulo = ov_work_group_size;
-	int ms_tile_size = 512;//(count/ntiles)*4;//4-fold padding, first guess for size
-	ms_tile_size = pad_modulo*((ms_tile_size+pad_modulo-1)/pad_modulo);//pad to a multiple of warp size;
-	int size = ms_tile_size * ntiles;
-	MSparticle1 = new OpenCLMSParticle(count, size, ntiles, ms_tile_size, cl);
-	if(verbose){
-	  cout << "MS arrays size: " << size << " " << ntiles << " " << ms_tile_size << endl;
-	}
-	
+	ms_count_estimate = msparticles1.size();
+
 	//and retain only those with non-zero free volume
 	vector<MSParticle> msparticles2;
 	double ams = KFC/(radw*radw);
@@ -855,16 +1202,12 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	  gvolms->compute_tree(pos_ms);
 	  gvolms->compute_volume(pos_ms, vol_ms2, energy_ms2, forces_ms, vol_dv_ms, freevols_ms, selfvols_ms);
 	  
-	  noverlaps.resize(num_ms);
+	  vector<int> noverlaps(num_ms);
 	  gvolms->getstat(noverlaps);
 	  int nov = 0;
 	  for(int i=0; i<num_ms ; i++) nov += noverlaps[i];
 	  int nov_per_section = nov/num_compute_units;
-	  int tree_section_size = 10*nov_per_section;
-	  int padded_num_ms = ms_tile_size * ntiles;
-	  gtreems->init_tree_size(padded_num_ms, tree_section_size, num_compute_units, pad_modulo);
-	  gtreems->resize_tree_buffers(cl, ov_work_group_size);
-	  gtreems->copy_tree_to_device();
+	  ms_tree_section_size = 10*nov_per_section;
 
 	  if(verbose_level > 0) cout << "Number of MS particles 2: " << num_ms << endl;
 	  
@@ -876,6 +1219,33 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	    cout << "Number of MS overlaps: " << nn << endl;
 	  }
 	  
+	  delete gvolms; //no longer needed
+	}else{
+	  ms_tree_section_size = 0;
+	}
+
+	delete gvol; //no longer needed
+      }
+
+      if(do_ms){
+	if(ms_tree_section_size > 0){
+	  //allocates buffers for 1st MS particle list
+	  int ntiles = cl.getPaddedNumAtoms()/OpenCLContext::TileSize;
+	  int pad_modulo = ov_work_group_size;
+	  int ms_tile_size = 512;//(count/ntiles)*4;//4-fold padding, first guess for size
+	  ms_tile_size = pad_modulo*((ms_tile_size+pad_modulo-1)/pad_modulo);//pad to a multiple of warp size;
+	  int size = ms_tile_size * ntiles;
+	  if(MSparticle1) delete MSparticle1;
+	  MSparticle1 = new OpenCLMSParticle(ms_count_estimate, size, ntiles, ms_tile_size, cl);
+	  if(verbose){
+	    cout << "MS arrays size: " << size << " " << ntiles << " " << ms_tile_size << endl;
+	  }
+
+	  int padded_num_ms = ms_tile_size * ntiles;
+	  gtreems->init_tree_size(padded_num_ms, ms_tree_section_size, num_compute_units, pad_modulo);
+	  gtreems->resize_tree_buffers(cl, ov_work_group_size);
+	  gtreems->copy_tree_to_device();
+
 	  if(verbose_level > 0) std::cout << "MS Tree size: " << gtreems->total_tree_size << std::endl;
 
 	  if(verbose_level > 0){
@@ -888,16 +1258,10 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	      }
 	    }
 	  }
-
-
 	}else{
 	  do_ms = false; //turn off MS calculation
 	}
-
-	delete gvolms; //no longer needed
       }
-
-      delete gvol; //no longer needed
       
       //Sets up buffers
 
@@ -908,6 +1272,20 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       panic_button.resize(2);
       panic_button[0] = panic_button[1]  = 0;    //init with zero
       PanicButton->upload(panic_button);
+      if(pinnedPanicButtonBuffer == NULL){
+	//two slots for the deferred reads of PanicButton
+	pinnedPanicButtonBuffer = new cl::Buffer(cl.getContext(), CL_MEM_ALLOC_HOST_PTR, 4*sizeof(int));
+	pinnedPanicButtonMemory = (int*) cl.getQueue().enqueueMapBuffer(*pinnedPanicButtonBuffer, CL_TRUE, CL_MAP_READ, 0, 4*sizeof(int));
+      }
+
+      //copies of the positions and velocities to roll back an evaluation whose tree overflowed
+      if(savedPosq == NULL){
+	savedPosq = new OpenCLArray(cl, cl.getPosq().getSize(), cl.getPosq().getElementSize(), "savedPosq");
+	if(cl.getUseMixedPrecision()){
+	  savedPosqCorrection = new OpenCLArray(cl, cl.getPosqCorrection().getSize(), cl.getPosqCorrection().getElementSize(), "savedPosqCorrection");
+	}
+	savedVelm = new OpenCLArray(cl, cl.getVelm().getSize(), cl.getVelm().getElementSize(), "savedVelm");
+      }
 
       // atom-level properties
       if(selfVolume) delete selfVolume;
@@ -974,7 +1352,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
 	file = cl.replaceStrings(OpenCLAGBNPKernelSources::GVolResetTree, replacements);
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
 	//reset tree kernel
 	resetTreeKernel = cl::Kernel(program, kernel_name.c_str());
 	if(verbose) cout << " done. " << endl;
@@ -1009,7 +1387,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	kernel_name = "resetTree";
 	if(!hasCreatedKernels){
 	  if(verbose) cout << "compiling " << kernel_name << " ... ";
-	  program = cl.createProgram(file, defines);
+	  program = createProgram(file, defines);
 	  //reset tree kernel
 	  MSresetTreeKernel = cl::Kernel(program, kernel_name.c_str());
 	  if(verbose) cout << " done. " << endl;
@@ -1057,6 +1435,45 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->selfVolumeBuffer_long->getDeviceBuffer());
       if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->gradBuffers_long->getDeviceBuffer());
       
+      if(useFusedKernels){
+	//resetTree and resetBuffer in one launch
+	kernel_name = "resetTreeAndBuffer";
+	if(!hasCreatedKernels){
+	  if(verbose) cout << "compiling " << kernel_name << " ... ";
+	  resetTreeAndBufferKernel = cl::Kernel(program, kernel_name.c_str());
+	  if(verbose) cout << " done. " << endl;
+	}
+	index = 0;
+	kernel = resetTreeAndBufferKernel;
+	kernel.setArg<cl_int>(index++, gtree->num_sections);
+	kernel.setArg<cl::Buffer>(index++, gtree->ovTreePointer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreePointer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreeSize->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreePaddedSize->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovLevel->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovVolume->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovVsp->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovVSfp->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovSelfVolume->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovVolEnergy->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovLastAtom->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovRootIndex->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovChildrenStartIndex->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovChildrenCount->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovDV1->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovDV2->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovProcessedFlag->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovOKtoProcessFlag->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovChildrenReported->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreeLock->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->NIterations->getDeviceBuffer());
+	kernel.setArg<cl_int>(index++, cl.getPaddedNumAtoms());
+	kernel.setArg<cl_int>(index++, gtree->num_sections);
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomBuffer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->selfVolumeBuffer->getDeviceBuffer());
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->selfVolumeBuffer_long->getDeviceBuffer());
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->gradBuffers_long->getDeviceBuffer());
+      }
 
       if(do_ms){
 	//same but for MS tree
@@ -1424,7 +1841,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	replacements["KERNEL_NAME"] = kernel_name;
 
 	if(verbose) cout << "compiling GVolOverlapTree ..." ;
-	program = cl.createProgram(InitOverlapTreeSrc, pairValueDefines);
+	program = createProgram(InitOverlapTreeSrc, pairValueDefines);
 	if(verbose) cout << " done. " << endl;
 	
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
@@ -1468,7 +1885,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 
       if(!hasCreatedKernels){
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
-	program = cl.createProgram(InitOverlapTreeSrc, pairValueDefines);
+	program = createProgram(InitOverlapTreeSrc, pairValueDefines);
 	if(verbose) cout << " done. " << endl;
 	InitOverlapTreeKernel_1body_2 = cl::Kernel(program, kernel_name.c_str());
       }
@@ -1632,7 +2049,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	kernel_name = "resetComputeOverlapTree";
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
-	program = cl.createProgram(InitOverlapTreeSrc, pairValueDefines);
+	program = createProgram(InitOverlapTreeSrc, pairValueDefines);
 	resetComputeOverlapTreeKernel = cl::Kernel(program, kernel_name.c_str());
 	if(verbose) cout << " done. " << endl;
       }
@@ -1645,12 +2062,29 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreeSize->getDeviceBuffer());
       kernel.setArg<cl::Buffer>(index++, gtree->ovLevel->getDeviceBuffer());
 
+      //counts of overlaps per atom to size the tree, see countOverlapTree()
+      if(!hasCreatedKernels){
+	kernel_name = "CountOverlapTreeAtoms";
+	if(verbose) cout << "compiling " << kernel_name << " ... ";
+	CountOverlapTreeAtomsKernel = cl::Kernel(program, kernel_name.c_str());
+	if(verbose) cout << " done. " << endl;
+      }
+      index = 0;
+      kernel = CountOverlapTreeAtomsKernel;
+      kernel.setArg<cl_int>(index++, gtree->num_sections);
+      kernel.setArg<cl::Buffer>(index++, gtree->ovTreePointer->getDeviceBuffer());
+      kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreeSize->getDeviceBuffer());
+      kernel.setArg<cl::Buffer>(index++, gtree->ovLevel->getDeviceBuffer());
+      kernel.setArg<cl::Buffer>(index++, gtree->ovRootIndex->getDeviceBuffer());
+      kernel.setArg<cl::Buffer>(index++, gtree->ovLastAtom->getDeviceBuffer());
+      kernel.setArg<cl::Buffer>(index++, gtree->ovAtomOverlapCount->getDeviceBuffer());
+
       if(do_ms){
 	//same as above but for MS tree
 	if(!hasCreatedKernels){
 	  kernel_name = "resetComputeOverlapTree";
 	  if(verbose) cout << "compiling " << kernel_name << " ... ";
-	  program = cl.createProgram(InitOverlapTreeSrc, pairValueDefines);
+	  program = createProgram(InitOverlapTreeSrc, pairValueDefines);
 	  MSresetComputeOverlapTreeKernel = cl::Kernel(program, kernel_name.c_str());
 	  if(verbose) cout << " done. " << endl;
 	}
@@ -1839,6 +2273,25 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       kernel.setArg<cl::Buffer>(index++, gtree->ovOKtoProcessFlag->getDeviceBuffer());
       kernel.setArg<cl::Buffer>(index++, gtree->ovLevel->getDeviceBuffer());
 
+      if(useFusedKernels){
+	//ResetRescanOverlapTree and InitRescanOverlapTree in one launch
+	if(!hasCreatedKernels){
+	  kernel_name = "ResetInitRescanOverlapTree";
+	  if(verbose) cout << "compiling " << kernel_name << " ... ";
+	  ResetInitRescanOverlapTreeKernel = cl::Kernel(program, kernel_name.c_str());
+	  if(verbose) cout << " done. " << endl;
+	}
+	index = 0;
+	kernel = ResetInitRescanOverlapTreeKernel;
+	kernel.setArg<cl_int>(index++, gtree->num_sections);
+	kernel.setArg<cl::Buffer>(index++, gtree->ovTreePointer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreeSize->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreePaddedSize->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovProcessedFlag->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovOKtoProcessFlag->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovLevel->getDeviceBuffer());
+      }
+
       if(do_ms){
 	//same as InitRescanOverlapTreeKernel but for the MS tree
 	if(!hasCreatedKernels){
@@ -2010,7 +2463,9 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
 	file = cl.replaceStrings(OpenCLAGBNPKernelSources::GVolSelfVolume, replacements);
 	if(verbose) cout << "compiling file GVolSelfVolume.cl ... ";
 	defines["DO_SELF_VOLUMES"] = "1";
-	program = cl.createProgram(file, defines);
+	//the fused pipeline resets the tree counters in computeSelfVolumes
+	if(useFusedKernels) defines["RESET_TREE_COUNTERS"] = "1";
+	program = createProgram(file, defines);
 	//accumulates self volumes and volume energy function (and forces)
 	//with the energy-per-unit-volume parameters (Gamma1i) currently loaded into tree
 	if(verbose) cout << "compiling kernel " << kernel_name << " ... ";
@@ -2103,7 +2558,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       //same as above but w/o updating self volumes
       if(!hasCreatedKernels){
 	defines["DO_SELF_VOLUMES"] = "0";
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
 	string kernel_name = "computeSelfVolumes";
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
 	computeVolumeEnergyKernel = cl::Kernel(program, kernel_name.c_str());
@@ -2168,7 +2623,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	file = OpenCLAGBNPKernelSources::GVolReduceTree;
 	if(verbose) cout << "compiling file GVolReduceTree.cl ... ";
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
       
 	if(verbose) cout << "compiling " << kernel_name << " ... ";
 	reduceSelfVolumesKernel_buffer = cl::Kernel(program, kernel_name.c_str());
@@ -2235,7 +2690,32 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       kernel.setArg<cl::Buffer>(index++, (useLong ? cl.getLongForceBuffer().getDeviceBuffer() : cl.getForceBuffers().getDeviceBuffer())); //master force buffer      
       kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer());
 
-      
+      if(useFusedKernels){
+	//reduceSelfVolumes_buffer and updateSelfVolumesForces in one launch, also resets the buffers
+	kernel_name = "reduceSelfVolumesUpdateForces";
+	if(!hasCreatedKernels){
+	  if(verbose) cout << "compiling " << kernel_name << " ... ";
+	  reduceSelfVolumesUpdateForcesKernel = cl::Kernel(program, kernel_name.c_str());
+	  if(verbose) cout << " done. " << endl;
+	}
+	kernel = reduceSelfVolumesUpdateForcesKernel;
+	index = 0;
+	kernel.setArg<cl_int>(index++, update_energy);
+	kernel.setArg<cl_int>(index++, cl.getNumAtoms());
+	kernel.setArg<cl_int>(index++, cl.getPaddedNumAtoms());
+	kernel.setArg<cl_int>(index++, gtree->num_sections);
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomTreePointer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovAtomBuffer->getDeviceBuffer());
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->gradBuffers_long->getDeviceBuffer());
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->selfVolumeBuffer_long->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->selfVolumeBuffer->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, selfVolume->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, GaussianVolume->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, grad->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, gtree->ovVolEnergy->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, (useLong ? cl.getLongForceBuffer().getDeviceBuffer() : cl.getForceBuffers().getDeviceBuffer())); //master force buffer
+	kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer());
+      }
     }
 
     {
@@ -2276,7 +2756,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	if(verbose) cout << "compiling file AGBNPBornRadii.cl" << " ... ";
 	file = cl.replaceStrings(OpenCLAGBNPKernelSources::AGBNPBornRadii, replacements);
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
       }
       int itable = 21;
       int num_values = 4*i4_table_size;
@@ -2399,6 +2879,32 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       kernel.setArg<cl::Buffer>(index++, VdWDerBrW->getDeviceBuffer());
       kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer()); //master energy buffer
       kernel.setArg<cl::Buffer>(index++, testBuffer->getDeviceBuffer()); //VDw Energy for testing
+
+      if(useFusedKernels){
+	//reduceBornRadii and VdWEnergy in one launch, also resets the buffers for GBPairEnergy
+	if(!hasCreatedKernels){
+	  kernel_name = "reduceBornRadiiVdWEnergy";
+	  if(verbose) cout << "compiling " << kernel_name << " ... ";
+	  reduceBornRadiiVdWEnergyKernel = cl::Kernel(program, kernel_name.c_str());
+	  if(verbose) cout << " done. " << endl;
+	}
+	index = 0;
+	kernel = reduceBornRadiiVdWEnergyKernel;
+	kernel.setArg<cl_uint>(index++, cl.getPaddedNumAtoms()); //bufferSize
+	kernel.setArg<cl_uint>(index++, num_compute_units);     //numBuffers
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer1_long->getDeviceBuffer()); //invBornRadiusBuffer_long
+	kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer1_real->getDeviceBuffer()); //invBornRadiusBuffer
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer2_long->getDeviceBuffer()); //Y buffer (long)
+	kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer2_real->getDeviceBuffer()); //Y buffer
+	kernel.setArg<cl::Buffer>(index++, radiusParam2->getDeviceBuffer()); //van der Waals radii
+	kernel.setArg<cl::Buffer>(index++, invBornRadius->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, invBornRadius_fp->getDeviceBuffer()); //derivative of filter function
+	kernel.setArg<cl::Buffer>(index++, BornRadius->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, alphaParam->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, VdWDerBrW->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer()); //master energy buffer
+	kernel.setArg<cl::Buffer>(index++, testBuffer->getDeviceBuffer()); //VDw Energy for testing
+      }
       
       if(!hasCreatedKernels){
 	kernel_name = "initVdWGBDerBorn";
@@ -2531,7 +3037,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	if(verbose) cout << "compiling AGBNPGBEnergy.cl ... ";
 	file = cl.replaceStrings(OpenCLAGBNPKernelSources::AGBNPGBEnergy, replacements);
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
 	if(verbose) cout << " done. " << endl;
 
 	//initGBEnergy kernel
@@ -2607,6 +3113,30 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       kernel.setArg<cl::Buffer>(index++, GBDerBrU->getDeviceBuffer());
       kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer()); //master energy buffer
       if(verbose) cout << " done. " << endl;
+
+      if(useFusedKernels){
+	//reduceGBEnergy that also resets the buffers for VdWGBDerBorn
+	if(!hasCreatedKernels){
+	  kernel_name = "reduceGBEnergyResetBuffers";
+	  if(verbose) cout << "compiling kernel " << kernel_name << " ... " ;
+	  reduceGBEnergyResetBuffersKernel = cl::Kernel(program, kernel_name.c_str());
+	  if(verbose) cout << " done. " << endl;
+	}
+	index = 0;
+	kernel = reduceGBEnergyResetBuffersKernel;
+	kernel.setArg<cl_uint>(index++, cl.getPaddedNumAtoms()); //bufferSize
+	kernel.setArg<cl_uint>(index++, num_compute_units);     //numBuffers
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer1_long->getDeviceBuffer()); //GB Energy buffer (long)
+	kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer1_real->getDeviceBuffer()); //GB Energy buffer
+	kernel.setArg<cl::Buffer>(index++, chargeParam->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, BornRadius->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, invBornRadius_fp->getDeviceBuffer());
+	if(useLong) kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer2_long->getDeviceBuffer()); //Y buffer (long)
+	kernel.setArg<cl::Buffer>(index++, gtree->AccumulationBuffer2_real->getDeviceBuffer()); //Y buffer
+	kernel.setArg<cl::Buffer>(index++, GBDerY->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, GBDerBrU->getDeviceBuffer());
+	kernel.setArg<cl::Buffer>(index++, cl.getEnergyBuffer().getDeviceBuffer()); //master energy buffer
+      }
     }
 
     if(do_ms){
@@ -2758,7 +3288,7 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
       if(!hasCreatedKernels){
 	if(verbose) cout << "compiling file MSParticles.cl" << " ... ";
 	file = cl.replaceStrings(OpenCLAGBNPKernelSources::MSParticles, replacements);
-	program = cl.createProgram(file, defines);
+	program = createProgram(file, defines);
       }
       //reset number of MS particles for each tile
       kernel_name = "MSParticles1Reset";
@@ -3225,6 +3755,45 @@ void OpenCLCalcAGBNPForceKernel::executeInitKernels(ContextImpl& context, bool i
     
 }
 
+//builds the overlap tree with the current layout and counts the overlaps under each atom
+//on the device. Returns false if the tree or the temporary buffers overflowed, in which
+//case the counts are not valid.
+bool OpenCLCalcAGBNPForceKernel::countOverlapTree(void){
+  bool verbose = verbose_level > 0;
+
+  launchKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+
+  PanicButton->download(panic_button);
+  if(panic_button[0] > 0){
+    if(verbose) cout << "countOverlapTree(): tree size exceeded, growing the tree" << endl;
+    if(panic_button[1] > 0) gtree->hasExceededTempBuffer = true;//forces resizing of temp buffers
+    panic_button[0] = panic_button[1] = 0;
+    PanicButton->upload(panic_button);
+    return false;
+  }
+
+  vector<cl_int> counts(cl.getPaddedNumAtoms());
+  for(int i = 0; i < counts.size(); i++) counts[i] = 0;
+  gtree->ovAtomOverlapCount->upload(counts);
+  launchKernel(CountOverlapTreeAtomsKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  gtree->ovAtomOverlapCount->download(counts);
+
+  tree_noverlaps.resize(counts.size());
+  int nn = 0;
+  for(int i = 0; i < counts.size(); i++){
+    tree_noverlaps[i] = counts[i];
+    nn += counts[i];
+  }
+  if(verbose) cout << "countOverlapTree(): number of overlaps: " << nn << endl;
+  return true;
+}
 
 double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool includeForces, bool includeEnergy) {
   OpenCLNonbondedUtilities& nb = cl.getNonbondedUtilities();
@@ -3250,15 +3819,15 @@ double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool incl
   
   if(verbose_level > 1) cout << "Executing resetTreeKernel" << endl;
   //here workgroups cycle through tree sections to reset the tree section
-  cl.executeKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
   // resets either ovAtomBuffer and long energy buffer
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing InitOverlapTreeKernel_1body_1" << endl;
   //fills up tree with 1-body overlaps
-  cl.executeKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   // compute numbers of 2-body overlaps, that is children counts of 1-body overlaps
   if(verbose_level > 1) cout << "Executing InitOverlapTreeCountKernel" << endl;
@@ -3271,11 +3840,11 @@ double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing reduceovCountBufferKernel" << endl;
   // do a prefix sum of 2-body counts to compute children start indexes to store 2-body overlaps computed by InitOverlapTreeKernel below
-  cl.executeKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 4){
     float self_volume = 0.0;
@@ -3348,16 +3917,16 @@ double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing resetComputeOverlapTreeKernel" << endl;
-  cl.executeKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing ComputeOverlapTree_1passKernel" << endl;
-  cl.executeKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  //trigger non-blocking read of PanicButton, read it after next kernel below 
-  cl.getQueue().enqueueReadBuffer(PanicButton->getDeviceBuffer(), CL_TRUE, 0, 2*sizeof(int), &panic_button[0], NULL, &downloadPanicButtonEvent);
+  //reads PanicButton, it is checked below or at the next evaluation
+  enqueuePanicButtonRead(synchronous_tree_check);
 
   //------------------------------------------------------------------------------------------------------------
 
@@ -3366,44 +3935,23 @@ double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool incl
   // Volume energy function 1 (large radii)
   //
   if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-
-    //check the result of the non-blocking read of PanicButton above
-  downloadPanicButtonEvent.wait();
-  if(panic_button[0] > 0){
-    if(verbose) cout << "Error: Tree size exceeded(2)!" << endl;
-    hasInitializedKernels = false; //forces reinitialization
-    cl.setForcesValid(false); //invalidate forces
+  launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-    if(panic_button[1] > 0){
-      if(verbose) cout << "Error: Temp Buffer exceeded(2)!" << endl;
-      gtree->hasExceededTempBuffer = true;//forces resizing of temp buffers
-    }
-    
-    if(verbose){
-      cout << "Tree sizes:" << endl;
-      vector<cl_int> size(gtree->num_sections);
-      gtree->ovAtomTreeSize->download(size);
-      for(int section=0;section < gtree->num_sections; section++){
-	cout << size[section] << " ";
-      }
-      cout << endl;
-    }
-
-    return 0.0;
-  }
+  //check the result of the read of PanicButton above, deferred to the next evaluation
+  //when the energy is not requested (see execute())
+  if(checkTreeOverflow(synchronous_tree_check)) return 0.0;
 
   
   if(verbose_level > 1) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(false){
     vector<int> size(gtree->num_sections);
@@ -3448,33 +3996,33 @@ double OpenCLCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool incl
 
   //seeds tree with "negative" gammas and reduced radi
   if(verbose_level > 1) cout << "Executing InitOverlapTreeKernel_1body_2 " << endl;
-  cl.executeKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing ResetRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1) cout << "Executing InitRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1) cout << "Executing RescanOverlapTreeKernel" << endl;
-  cl.executeKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
   // zero self-volume accumulator
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //update energyBuffer with volume energy 2
   if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose){
     //print self volumes
@@ -3536,17 +4084,22 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   // Tree construction (large radii)
   //
 
-  if(verbose_level > 1) cout << "Executing resetTreeKernel" << endl;
-  //here workgroups cycle through tree sections to reset the tree section
-  cl.executeKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    if(verbose_level > 1) cout << "Executing resetTreeAndBufferKernel" << endl;
+    launchKernel(resetTreeAndBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing resetTreeKernel" << endl;
+    //here workgroups cycle through tree sections to reset the tree section
+    launchKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
-  // resets either ovAtomBuffer and long energy buffer
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
+    // resets either ovAtomBuffer and long energy buffer
+    launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 1) cout << "Executing InitOverlapTreeKernel_1body_1" << endl;
   //fills up tree with 1-body overlaps
-  cl.executeKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   // compute numbers of 2-body overlaps, that is children counts of 1-body overlaps
   if(verbose_level > 1) cout << "Executing InitOverlapTreeCountKernel" << endl;
@@ -3559,13 +4112,13 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   
  
   if(verbose_level > 1) cout << "Executing reduceovCountBufferKernel" << endl;
   // do a prefix sum of 2-body counts to compute children start indexes to store 2-body overlaps computed by InitOverlapTreeKernel below
-  cl.executeKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
 
@@ -3581,7 +4134,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
 
@@ -3590,13 +4143,13 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
 
   
   if(verbose_level > 1) cout << "Executing resetComputeOverlapTreeKernel" << endl;
-  cl.executeKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing ComputeOverlapTree_1passKernel" << endl;
-  cl.executeKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  //trigger non-blocking read of PanicButton, read it after next kernel below 
-  cl.getQueue().enqueueReadBuffer(PanicButton->getDeviceBuffer(), CL_TRUE, 0, 2*sizeof(int), &panic_button[0], NULL, &downloadPanicButtonEvent);
+  //reads PanicButton, it is checked below or at the next evaluation
+  enqueuePanicButtonRead(synchronous_tree_check);
   
   //------------------------------------------------------------------------------------------------------------
 
@@ -3604,44 +4157,30 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   //------------------------------------------------------------------------------------------------------------
   // Volume energy function 1 (large radii)
   //
-  if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
-  //this kernel is protected (returns with no other work) in case of panic
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-
-  //check the result of the non-blocking read of PanicButton above
-  downloadPanicButtonEvent.wait();
-  if(panic_button[0] > 0){
-    if(verbose) cout << "Error: Tree size exceeded(2)!" << endl;
-    hasInitializedKernels = false; //forces reinitialization
-    cl.setForcesValid(false); //invalidate forces
-
-    if(panic_button[1] > 0){
-      if(verbose) cout << "Error: Temp Buffer exceeded(2)!" << endl;
-      gtree->hasExceededTempBuffer = true;//forces resizing of temp buffers
-    }
-    
-    if(verbose){
-      cout << "Tree sizes:" << endl;
-      vector<cl_int> size(gtree->num_sections);
-      gtree->ovAtomTreeSize->download(size);
-      for(int section=0;section < gtree->num_sections; section++){
-	cout << size[section] << " ";
-      }
-      cout << endl;
-    }
-
-    return 0.0;
+  if(!useFusedKernels){
+    if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
+    //this kernel is protected (returns with no other work) in case of panic
+    launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   }
 
+  //check the result of the read of PanicButton above, deferred to the next evaluation
+  //when the energy is not requested (see execute())
+  if(checkTreeOverflow(synchronous_tree_check)) return 0.0;
+
 
   if(verbose_level > 1) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    if(verbose_level > 1) cout << "Executing reduceSelfVolumesUpdateForcesKernel" << endl;
+    launchKernel(reduceSelfVolumesUpdateForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
+    launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
+    launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   
   
@@ -3779,30 +4318,42 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
    
   //seeds tree with "negative" gammas and reduced radi
   if(verbose_level > 1) cout << "Executing InitOverlapTreeKernel_1body_2 " << endl;
-  cl.executeKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing ResetRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    if(verbose_level > 1) cout << "Executing ResetInitRescanOverlapTreeKernel" << endl;
+    launchKernel(ResetInitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing ResetRescanOverlapTreeKernel" << endl;
+    launchKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
-  if(verbose_level > 1) cout << "Executing InitRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing InitRescanOverlapTreeKernel" << endl;
+    launchKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
   
   if(verbose_level > 1) cout << "Executing RescanOverlapTreeKernel" << endl;
-  cl.executeKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
-  if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(!useFusedKernels){
+    if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
+    launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
-  // zero self-volume accumulator
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
+    // zero self-volume accumulator
+    launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
   
   if(verbose_level > 1) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //update energyBuffer with volume energy 2
-  if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    if(verbose_level > 1) cout << "Executing reduceSelfVolumesUpdateForcesKernel" << endl;
+    launchKernel(reduceSelfVolumesUpdateForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
+    launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 1){
     //print gradients
@@ -3815,8 +4366,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   }
 
 
-  if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(!useFusedKernels){
+    if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
+    launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
 
   if(verbose_level > 3){
@@ -3851,7 +4404,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
 
 #ifdef NOTNOW
   if(verbose) cout << "Executing testLookupKernel" << endl;
-  cl.executeKernel(testLookupKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(testLookupKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 3){
     // print lookup table results
@@ -3872,7 +4425,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   // Born radii
   //
   if(verbose_level > 1) cout << "Executing initBornRadiiKernel" << endl;
-  cl.executeKernel(initBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(initBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing inverseBornRadiiKernel" << endl;
   if(nb_reassign) {
@@ -3884,7 +4437,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(inverseBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(inverseBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   if(verbose_level > 5 && !useLong){
@@ -3907,8 +4460,14 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   }
 
   
-  if(verbose_level > 1) cout << "Executing reduceBornRadiiKernel" << endl;
-  cl.executeKernel(reduceBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    //also computes the van der Waals energy below and resets the buffers of GBPairEnergy
+    if(verbose_level > 1) cout << "Executing reduceBornRadiiVdWEnergyKernel" << endl;
+    launchKernel(reduceBornRadiiVdWEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing reduceBornRadiiKernel" << endl;
+    launchKernel(reduceBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 3){
     // prints out Born radii
@@ -3930,8 +4489,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   //Van der Waals dispersion energy function
   //
   //------------------------------------------------------------------------------------------------------------
-  if(verbose_level > 1) cout << "Executing vdwEnergyKernel" << endl;
-  cl.executeKernel(VdWEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(!useFusedKernels){
+    if(verbose_level > 1) cout << "Executing vdwEnergyKernel" << endl;
+    launchKernel(VdWEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 3){
     // get the VdW energy (sum over the atoms in the buffer)
@@ -3959,8 +4520,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
   //------------------------------------------------------------------------------------------------------------
   //GB energy function
   //
-  if(verbose_level > 1) cout << "Executing initGBEnergyKernel" << endl;
-  cl.executeKernel(initGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(!useFusedKernels){
+    if(verbose_level > 1) cout << "Executing initGBEnergyKernel" << endl;
+    launchKernel(initGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 1) cout << "Executing GBPairEnergyKernel" << endl;
   if(nb_reassign) {
@@ -3972,10 +4535,16 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(GBPairEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(GBPairEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing reduceGBEnergyKernel" << endl;
-  cl.executeKernel(reduceGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  if(useFusedKernels){
+    //also resets the buffers of VdWGBDerBorn
+    if(verbose_level > 1) cout << "Executing reduceGBEnergyResetBuffersKernel" << endl;
+    launchKernel(reduceGBEnergyResetBuffersKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }else{
+    if(verbose_level > 1) cout << "Executing reduceGBEnergyKernel" << endl;
+    launchKernel(reduceGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  }
 
   if(verbose_level > 5){
     // get the GB energy (sum over the atoms in the buffer)
@@ -4011,13 +4580,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
 
 
 
-  //------------------------------------------------------------------------------------------------------------
-  //Born-radii related derivatives
-  //
-  if(verbose_level > 1) cout << "Executing initVdWGBDerBornKernel" << endl;
-  cl.executeKernel(initVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-
-  if(verbose_level > 1) cout << "Executing VdWGBDerBornKernel" << endl;
+  //the derivative kernels use the neighbor list too, update it even if they are skipped in this step
   if(nb_reassign){
     int index = VdWGBDerBornKernel_first_nbarg;
     cl::Kernel kernel = VdWGBDerBornKernel;
@@ -4027,106 +4590,133 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool incl
     kernel.setArg<cl_uint>(index++, nb.getInteractingTiles().getSize());
     kernel.setArg<cl::Buffer>(index++, nb.getExclusionTiles().getDeviceBuffer());
   }
-  cl.executeKernel(VdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 5 && !useLong){
-    vector<mm_float4> f_buff(cl.getPaddedNumAtoms()*num_compute_units);
-    vector<mm_float4> ff(cl.getPaddedNumAtoms());
-    for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
-      ff[iatom].x = ff[iatom].y = ff[iatom].z = 0.;
+  //the rest computes the gradients only
+  if(includeForces){
+    //------------------------------------------------------------------------------------------------------------
+    //Born-radii related derivatives
+    //
+    if(!useFusedKernels){
+      if(verbose_level > 1) cout << "Executing initVdWGBDerBornKernel" << endl;
+      launchKernel(initVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
     }
-    cl.getForceBuffers().download(f_buff);
-    for(int cu=0;cu<num_compute_units;cu++){
+
+    if(verbose_level > 1) cout << "Executing VdWGBDerBornKernel" << endl;
+    launchKernel(VdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+
+    if(verbose_level > 5 && !useLong){
+      vector<mm_float4> f_buff(cl.getPaddedNumAtoms()*num_compute_units);
+      vector<mm_float4> ff(cl.getPaddedNumAtoms());
       for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
-	int i = cl.getPaddedNumAtoms()*cu + iatom;
-	cout << "F_buff: " << cu << " " << iatom << " " << f_buff[i].x << " " << f_buff[i].y << " " << f_buff[i].z << endl;
-	ff[iatom].x += f_buff[i].x;
-	ff[iatom].y += f_buff[i].y;
-	ff[iatom].z += f_buff[i].z;
+	ff[iatom].x = ff[iatom].y = ff[iatom].z = 0.;
+      }
+      cl.getForceBuffers().download(f_buff);
+      for(int cu=0;cu<num_compute_units;cu++){
+	for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
+	  int i = cl.getPaddedNumAtoms()*cu + iatom;
+	  cout << "F_buff: " << cu << " " << iatom << " " << f_buff[i].x << " " << f_buff[i].y << " " << f_buff[i].z << endl;
+	  ff[iatom].x += f_buff[i].x;
+	  ff[iatom].y += f_buff[i].y;
+	  ff[iatom].z += f_buff[i].z;
+	}
+      }
+      for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
+	  cout << "F: " << iatom << " " << ff[iatom].x << " " << ff[iatom].y << " " << ff[iatom].z << endl;
       }
     }
-    for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
-	cout << "F: " << iatom << " " << ff[iatom].x << " " << ff[iatom].y << " " << ff[iatom].z << endl;
-    }
-  }
 
 
   
-  if(verbose_level > 1) cout << "Executing reduceVdWGBDerBornKernel" << endl;
-  cl.executeKernel(reduceVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing reduceVdWGBDerBornKernel" << endl;
+    launchKernel(reduceVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
-  if(verbose_level > 3){
-    // get the U parameters
-    vector<float> u_params(cl.getPaddedNumAtoms());
-    GBDerU->download(u_params);
-    for(int i=0; i<numParticles; i++){
-      cout << "U: " << i << " " << u_params[i] << endl;
+    if(verbose_level > 3){
+      // get the U parameters
+      vector<float> u_params(cl.getPaddedNumAtoms());
+      GBDerU->download(u_params);
+      for(int i=0; i<numParticles; i++){
+	cout << "U: " << i << " " << u_params[i] << endl;
+      }
     }
-  }
 
 
-  if(verbose_level > 3){
-    // get the W parameters
-    vector<float> w_params(cl.getPaddedNumAtoms());
-    VdWDerW->download(w_params);
-    for(int i=0; i<numParticles; i++){
-      cout << "W: " << i << " " << w_params[i] << endl;
+    if(verbose_level > 3){
+      // get the W parameters
+      vector<float> w_params(cl.getPaddedNumAtoms());
+      VdWDerW->download(w_params);
+      for(int i=0; i<numParticles; i++){
+	cout << "W: " << i << " " << w_params[i] << endl;
+      }
     }
-  }
 
-  //------------------------------------------------------------------------------------------------------------
-  //Van der Waals and GB "volume" derivatives
-  //
+    //------------------------------------------------------------------------------------------------------------
+    //Van der Waals and GB "volume" derivatives
+    //
 
-  //seeds the top of the tree with van der Waals + GB gamma parameters
-  if(verbose_level > 1) cout << "Executing InitOverlapTreeGammasKernel_1body_W " << endl;
-  cl.executeKernel(InitOverlapTreeGammasKernel_1body_W, ov_work_group_size*num_compute_units, ov_work_group_size);
+    //seeds the top of the tree with van der Waals + GB gamma parameters
+    if(verbose_level > 1) cout << "Executing InitOverlapTreeGammasKernel_1body_W " << endl;
+    launchKernel(InitOverlapTreeGammasKernel_1body_W, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing ResetRescanOverlapTreeKernel " << endl;
-  cl.executeKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(useFusedKernels){
+      if(verbose_level > 1) cout << "Executing ResetInitRescanOverlapTreeKernel " << endl;
+      launchKernel(ResetInitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    }else{
+      if(verbose_level > 1) cout << "Executing ResetRescanOverlapTreeKernel " << endl;
+      launchKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
-  if(verbose_level > 1) cout << "Executing InitRescanOverlapTreeKernel " << endl;
-  cl.executeKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+      if(verbose_level > 1) cout << "Executing InitRescanOverlapTreeKernel " << endl;
+      launchKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    }
 
-  //propagates gamma atomic parameters from the top to the bottom
-  //of the overlap tree
-  if(verbose_level > 1) cout << "Executing RescanOverlapTreeGammasKernel " << endl;
-  cl.executeKernel(RescanOverlapTreeGammasKernel_W, ov_work_group_size*num_compute_units, ov_work_group_size);
+    //propagates gamma atomic parameters from the top to the bottom
+    //of the overlap tree
+    if(verbose_level > 1) cout << "Executing RescanOverlapTreeGammasKernel " << endl;
+    launchKernel(RescanOverlapTreeGammasKernel_W, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(!useFusedKernels){
+      if(verbose_level > 1) cout << "Executing resetSelfVolumesKernel" << endl;
+      launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
-  // zero gradient accumulator
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+      if(verbose_level > 1) cout << "Executing resetBufferKernel" << endl;
+      // zero gradient accumulator
+      launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    }
   
-  //collect derivatives from volume energy function with van der Waals gamma parameters
-  //we don't collect energies
-  {
-    int update_energy = 0;
-    updateSelfVolumesForcesKernel.setArg<cl_int>(0, update_energy);
-  }
-  if(verbose_level > 1) cout << "Executing computeVolumeEnergyKernel " << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-  if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
-  if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-  {
-    //restore default behavior
-    int update_energy = 1;
-    updateSelfVolumesForcesKernel.setArg<cl_int>(0, update_energy);
-  }
+    //collect derivatives from volume energy function with van der Waals gamma parameters
+    //we don't collect energies
+    {
+      int update_energy = 0;
+      updateSelfVolumesForcesKernel.setArg<cl_int>(0, update_energy);
+      if(useFusedKernels) reduceSelfVolumesUpdateForcesKernel.setArg<cl_int>(0, update_energy);
+    }
+    if(verbose_level > 1) cout << "Executing computeVolumeEnergyKernel " << endl;
+    launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(useFusedKernels){
+      if(verbose_level > 1) cout << "Executing reduceSelfVolumesUpdateForcesKernel" << endl;
+      launchKernel(reduceSelfVolumesUpdateForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    }else{
+      if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
+      launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+      if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
+      launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    }
+    {
+      //restore default behavior
+      int update_energy = 1;
+      updateSelfVolumesForcesKernel.setArg<cl_int>(0, update_energy);
+      if(useFusedKernels) reduceSelfVolumesUpdateForcesKernel.setArg<cl_int>(0, update_energy);
+    }
 
 
-  if(verbose_level > 1){
-    //print gradients
-    vector<mm_float4> gradv;
-    grad->download(gradv);
-    double energy = 0;
-    for(int i=0;i<numParticles;i++){
-      cout << "FrcGBV : " << i << " " << -gradv[i].x << " " << -gradv[i].y << " " << -gradv[i].z << endl;
+    if(verbose_level > 1){
+      //print gradients
+      vector<mm_float4> gradv;
+      grad->download(gradv);
+      double energy = 0;
+      for(int i=0;i<numParticles;i++){
+	cout << "FrcGBV : " << i << " " << -gradv[i].x << " " << -gradv[i].y << " " << -gradv[i].z << endl;
+      }
     }
   }
 
@@ -4249,32 +4839,35 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
     
   if(verbose) cout << "Executing resetTreeKernel" << endl;
   //here workgroups cycle through tree sections to reset the tree section
-  cl.executeKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing resetBufferKernel" << endl;
   // resets either ovAtomBuffer and long energy buffer
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing InitOverlapTreeKernel_1body_1" << endl;
   //fills up tree with 1-body overlaps
-  cl.executeKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_1, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing InitOverlapTreeCountKernel" << endl;
   // compute numbers of 2-body overlaps, that is children counts of 1-body overlaps
-  cl.executeKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeCountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing reduceovCountBufferKernel" << endl;
   // do a prefix sum of 2-body counts to compute children start indexes to store 2-body overlaps computed by InitOverlapTreeKernel below
-  cl.executeKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing InitOverlapTreeKernel" << endl;
-  cl.executeKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing resetComputeOverlapTreeKernel" << endl;
-  cl.executeKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing ComputeOverlapTree_1passKernel" << endl;
-  cl.executeKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+
+  enqueuePanicButtonRead(synchronous_tree_check);
+  if(checkTreeOverflow(synchronous_tree_check)) return 0.0;
   
   //    pinnedCountBuffer = new cl::Buffer(context.getContext(), CL_MEM_ALLOC_HOST_PTR, sizeof(int));
   //    pinnedCountMemory = (int*) context.getQueue().enqueueMapBuffer(*pinnedCountBuffer, CL_TRUE, CL_MAP_READ, 0, sizeof(int));
@@ -4300,15 +4893,15 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   // Self volumes, volume scaling parameters, and volume energy function 1 (with large radii)
   //
   if(verbose) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   if(verbose) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   if(verbose){
@@ -4348,33 +4941,33 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   
   //seeds tree with "negative" gammas and reduced radi
   if(verbose) cout << "Executing InitOverlapTreeKernel_1body_2 " << endl;
-  cl.executeKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitOverlapTreeKernel_1body_2, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing ResetRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing InitRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing RescanOverlapTreeKernel" << endl;
-  cl.executeKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(RescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing resetBufferKernel" << endl;
   // zero self-volume accumulator
-  cl.executeKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(resetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing computeSelfVolumesKernel" << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //update energyBuffer with volume energy 2
   if(verbose) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1) cout << "Executing updateSelfVolumesForces" << endl;
-  cl.executeKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(updateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //-------------------------------------------------------------------------------------------------  
 
@@ -4475,7 +5068,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
 #ifdef NOTNOW
   if(verbose_level > 2) cout << "Executing testLookupKernel" << endl;
-  cl.executeKernel(testLookupKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(testLookupKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose){
     // print lookup table results
@@ -4493,7 +5086,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 #endif
 
   /*
-  cl.executeKernel(TestScanWarpKernel, ov_work_group_size, ov_work_group_size);
+  launchKernel(TestScanWarpKernel, ov_work_group_size, ov_work_group_size);
   vector<cl_uint> input;
   test_input_buffer->download(input);
   for(int i=0;i<ov_work_group_size;i++){
@@ -4508,22 +5101,22 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
   //reset energy buffer
   if(verbose) cout << "Executing MSinitEnergyBufferKernel" << endl;
-  cl.executeKernel(MSinitEnergyBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSinitEnergyBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   //MS particles 1
   if(verbose) cout << "Executing MSParticles1ResetKernel" << endl;
   //reset MSCount array
-  cl.executeKernel(MSParticles1ResetKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles1ResetKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   /*
   if(verbose) cout << "Executing MSParticles1CountKernel" << endl;
   //count of MS particles
-  cl.executeKernel(MSParticles1CountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles1CountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   
   if(verbose) cout << "Executing MSParticles1CountReduceKernel" << endl;
   //prefix sum of MS particles counts to get storage pointers
-  cl.executeKernel(MSParticles1CountReduceKernel, cl.getPaddedNumAtoms(), ov_work_group_size);
+  launchKernel(MSParticles1CountReduceKernel, cl.getPaddedNumAtoms(), ov_work_group_size);
   
   if(verbose_level > 0){
     vector<unsigned int> mscounts;
@@ -4537,7 +5130,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   */
   
   if(verbose) cout << "Executing MSParticles1StoreKernel" << endl;
-  cl.executeKernel(MSParticles1StoreKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles1StoreKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   if(verbose) cout << "done executing MSParticles1StoreKernel" << endl;
   
   if(verbose_level > 0){
@@ -4553,12 +5146,12 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
   //free volumes of MS particles with vdW and large atomic radii
   if(verbose) cout << "Executing MSParticles1VfreeKernel" << endl;
-  cl.executeKernel(MSParticles1VfreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles1VfreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   //smoothly turns off MS spheres below a certain volume
   if(verbose) cout << "Executing MSParticles1VolsKernel" << endl;
-  cl.executeKernel(MSParticles1VolsKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles1VolsKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1){
     double volms0 = 0.;
@@ -4585,7 +5178,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
   if(verbose) cout << "Executing MSParticles2CountKernel" << endl;
   //count of MS particles
-  cl.executeKernel(MSParticles2CountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSParticles2CountKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1){
     vector<int> mscounts;
@@ -4605,44 +5198,48 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   
   if(verbose) cout << "Executing MSResetTreeCountKernel" << endl;
   //count of MS particles
-  cl.executeKernel(MSResetTreeCountKernel, ov_work_group_size, ov_work_group_size);
+  launchKernel(MSResetTreeCountKernel, ov_work_group_size, ov_work_group_size);
 
   if(verbose) cout << "Executing MSresetTreeKernel" << endl;
   //here workgroups cycle through tree sections to reset the tree section
-  cl.executeKernel(MSresetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSresetTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing MSresetBufferKernel" << endl;
-  cl.executeKernel(MSresetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSresetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing MSInitOverlapTreeVdW_1body_1Kernel" << endl;
   //seed MS overlap tree with MS volumes with small atomic radii
-  cl.executeKernel(MSInitOverlapTreeVdW_1body_1Kernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSInitOverlapTreeVdW_1body_1Kernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing MSInitOverlapTreeCountKernel" << endl;
   //count of 2-body overlaps MS particles
-  cl.executeKernel(MSInitOverlapTreeCountKernel, ov_work_group_size, ov_work_group_size);
+  launchKernel(MSInitOverlapTreeCountKernel, ov_work_group_size, ov_work_group_size);
 
    if(verbose) cout << "Executing MSreduceovCountBufferKernel" << endl;
   // do a prefix sum of 2-body counts to compute children start indexes to store 2-body overlaps computed by InitOverlapTreeKernel below
-  cl.executeKernel(MSreduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
+  launchKernel(MSreduceovCountBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
 
   
   if(verbose) cout << "Executing MSInitOverlapTreeKernel" << endl;
   // 2-body
-  cl.executeKernel(MSInitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
+  launchKernel(MSInitOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
 
   if(verbose) cout << "Executing MSresetComputeOverlapTreeKernel" << endl;
-  cl.executeKernel(MSresetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
+  launchKernel(MSresetComputeOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
   
   if(verbose) cout << "Executing MSComputeOverlapTree_1passKernel" << endl;
-  cl.executeKernel(MSComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
+  launchKernel(MSComputeOverlapTree_1passKernel, ov_work_group_size*num_compute_units, ov_work_group_size); 
+
+  //the MS tree raises the same PanicButton, this read supersedes the one of the atom tree
+  enqueuePanicButtonRead(synchronous_tree_check);
+  if(checkTreeOverflow(synchronous_tree_check)) return 0.0;
   
   // Self volumes of MS particles
   if(verbose) cout << "Executing MSresetSelfVolumesKernel" << endl;
-  cl.executeKernel(MSresetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);//ok
+  launchKernel(MSresetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);//ok
 
   if(verbose) cout << "Executing MScomputeSelfVolumesKernel" << endl;
-  cl.executeKernel(MScomputeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MScomputeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 3){
     float self_volume = 0.0;
@@ -4703,10 +5300,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   }
 
   if(verbose) cout << "Executing MSreduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(MSreduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSreduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing MSupdateSelfVolumesForces" << endl;
-  cl.executeKernel(MSupdateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSupdateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   //----------------------------------------------------------------------------------------------------------------------------
   
@@ -4785,11 +5382,11 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
   
   if(verbose) cout << "Executing MSaddSelfVolumesKernel" << endl;
-  cl.executeKernel(MSaddSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSaddSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(useLong){
     if(verbose) cout << "Executing MSaddSelfVolumesFromLongKernel" << endl;
-    cl.executeKernel(MSaddSelfVolumesFromLongKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    launchKernel(MSaddSelfVolumesFromLongKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   }
 
   if(verbose_level > 1){
@@ -4812,10 +5409,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   // Born radii
   //
   if(verbose_level > 2) cout << "Executing initBornRadiiKernel" << endl;
-  cl.executeKernel(initBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(initBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 2) cout << "Executing inverseBornRadiiKernel" << endl;
-  cl.executeKernel(inverseBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(inverseBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //------------------------------------------------------------------------------------------------------------
   
@@ -4839,7 +5436,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   }
   
   if(verbose_level > 2) cout << "Executing reduceBornRadiiKernel" << endl;
-  cl.executeKernel(reduceBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceBornRadiiKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 2){
     vector<float> inv_br_buffer(cl.getPaddedNumAtoms());
@@ -4868,7 +5465,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   //
 
   if(verbose_level > 2) cout << "Executing vdwEnergyKernel" << endl;
-  cl.executeKernel(VdWEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(VdWEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //------------------------------------------------------------------------------------------------------------
 
@@ -4902,10 +5499,10 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   //
   
   if(verbose_level > 2) cout << "Executing initGBEnergyKernel" << endl;
-  cl.executeKernel(initGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(initGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 2) cout << "Executing GBPairEnergyKernel" << endl;
-  cl.executeKernel(GBPairEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(GBPairEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
   if(verbose_level > 3 && !useLong){
@@ -4919,7 +5516,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   }
   
   if(verbose_level > 2) cout << "Executing reduceGBEnergyKernel" << endl;
-  cl.executeKernel(reduceGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(reduceGBEnergyKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   //------------------------------------------------------------------------------------------------------------
 
@@ -4959,82 +5556,85 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
 
   
-  //------------------------------------------------------------------------------------------------------------
-  //Born radii-related derivatives
-  //
-  if(verbose_level > 2) cout << "Executing initVdWGBDerBornKernel" << endl;
-  cl.executeKernel(initVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-
-  if(verbose_level > 2) cout << "Executing VdWGBDerBornKernel" << endl;
-  cl.executeKernel(VdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-
-
-  if(verbose && !useLong){
-    vector<float> gbderu_buffer(cl.getPaddedNumAtoms()*num_compute_units);
-    gtree->AccumulationBuffer2_real->download(gbderu_buffer);
-    for(int cu=0;cu<num_compute_units;cu++){
-      for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
-	cout << "U_buff: " << cu << " " << iatom << " " << gbderu_buffer[cl.getPaddedNumAtoms()*cu + iatom] << endl;
+  //the rest of the GB and van der Waals terms computes the gradients only
+  if(includeForces){
+    //------------------------------------------------------------------------------------------------------------
+    //Born radii-related derivatives
+    //
+    if(verbose_level > 2) cout << "Executing initVdWGBDerBornKernel" << endl;
+    launchKernel(initVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+
+    if(verbose_level > 2) cout << "Executing VdWGBDerBornKernel" << endl;
+    launchKernel(VdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+
+
+    if(verbose && !useLong){
+      vector<float> gbderu_buffer(cl.getPaddedNumAtoms()*num_compute_units);
+      gtree->AccumulationBuffer2_real->download(gbderu_buffer);
+      for(int cu=0;cu<num_compute_units;cu++){
+	for(int iatom = 0; iatom < cl.getPaddedNumAtoms(); iatom++){
+	  cout << "U_buff: " << cu << " " << iatom << " " << gbderu_buffer[cl.getPaddedNumAtoms()*cu + iatom] << endl;
+	}
       }
     }
-  }
 
-  if(verbose_level > 2) cout << "Executing reduceVdWGBDerBornKernel" << endl;
-  cl.executeKernel(reduceVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 2) cout << "Executing reduceVdWGBDerBornKernel" << endl;
+    launchKernel(reduceVdWGBDerBornKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  //------------------------------------------------------------------------------------------------------------
+    //------------------------------------------------------------------------------------------------------------
   
 
-  if(verbose_level > 1){
-    // get the U parameters
-    vector<float> u_params(cl.getPaddedNumAtoms());
-    GBDerU->download(u_params);
-    for(int i=0; i<numParticles; i++){
-      cout << "U: " << i << " " << u_params[i] << endl;
+    if(verbose_level > 1){
+      // get the U parameters
+      vector<float> u_params(cl.getPaddedNumAtoms());
+      GBDerU->download(u_params);
+      for(int i=0; i<numParticles; i++){
+	cout << "U: " << i << " " << u_params[i] << endl;
+      }
     }
-  }
 
 
-  if(verbose_level > 1){
-    // get the W parameters
-    vector<float> w_params(cl.getPaddedNumAtoms());
-    VdWDerW->download(w_params);
-    for(int i=0; i<numParticles; i++){
-      cout << "W: " << i << " " << w_params[i] << endl;
+    if(verbose_level > 1){
+      // get the W parameters
+      vector<float> w_params(cl.getPaddedNumAtoms());
+      VdWDerW->download(w_params);
+      for(int i=0; i<numParticles; i++){
+	cout << "W: " << i << " " << w_params[i] << endl;
+      }
     }
-  }
 
-  //------------------------------------------------------------------------------------------------------------
-  //Van der Waals and GB "volume" derivatives
-  //  IN PROGRESS
+    //------------------------------------------------------------------------------------------------------------
+    //Van der Waals and GB "volume" derivatives
+    //  IN PROGRESS
 
-  //seeds the top of the tree with van der Waals + GB gamma parameters
-  if(verbose_level > 2) cout << "Executing InitOverlapTreeGammasKernel_1body_W " << endl;
-  cl.executeKernel(InitOverlapTreeGammasKernel_1body_W, ov_work_group_size*num_compute_units, ov_work_group_size);
+    //seeds the top of the tree with van der Waals + GB gamma parameters
+    if(verbose_level > 2) cout << "Executing InitOverlapTreeGammasKernel_1body_W " << endl;
+    launchKernel(InitOverlapTreeGammasKernel_1body_W, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 2) cout << "Executing ResetRescanOverlapTreeKernel " << endl;
-  cl.executeKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 2) cout << "Executing ResetRescanOverlapTreeKernel " << endl;
+    launchKernel(ResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
-  if(verbose_level > 2) cout << "Executing InitRescanOverlapTreeKernel " << endl;
-  cl.executeKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 2) cout << "Executing InitRescanOverlapTreeKernel " << endl;
+    launchKernel(InitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  //propagates gamma atomic parameters from the top to the bottom
-  //of the overlap tree
-  if(verbose_level > 2) cout << "Executing RescanOverlapTreeGammasKernel " << endl;
-  cl.executeKernel(RescanOverlapTreeGammasKernel_W, ov_work_group_size*num_compute_units, ov_work_group_size);
+    //propagates gamma atomic parameters from the top to the bottom
+    //of the overlap tree
+    if(verbose_level > 2) cout << "Executing RescanOverlapTreeGammasKernel " << endl;
+    launchKernel(RescanOverlapTreeGammasKernel_W, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  if(verbose_level > 2) cout << "Executing resetSelfVolumesKernel" << endl;
-  cl.executeKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 2) cout << "Executing resetSelfVolumesKernel" << endl;
+    launchKernel(resetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
-  //collect derivatives from volume energy function with van der Waals gamma parameters
-  //we don't collect self volumes and energies
-  if(verbose_level > 1) cout << "Executing computeVolumeEnergyKernel " << endl;
-  cl.executeKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
-  if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+    //collect derivatives from volume energy function with van der Waals gamma parameters
+    //we don't collect self volumes and energies
+    if(verbose_level > 1) cout << "Executing computeVolumeEnergyKernel " << endl;
+    launchKernel(computeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+    if(verbose_level > 1) cout << "Executing reduceSelfVolumesKernel_buffer" << endl;
+    launchKernel(reduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
-  //------------------------------------------------------------------------------------------------------------
+    //------------------------------------------------------------------------------------------------------------
+  }
 
 #endif //AGBNP2_DO_GBVDW
 
@@ -5069,34 +5669,34 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
   
   if(verbose) cout << "Executing MSInitOverlapTreeLargeR_1body_1Kernel" << endl;
   //seed MS overlap tree with MS volumes with large atomic radii
-  cl.executeKernel(MSInitRescanOverlapTreeLargeR_1body_1Kernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSInitRescanOverlapTreeLargeR_1body_1Kernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing MSResetRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(MSResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSResetRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing MSresetBufferKernel" << endl;
-  cl.executeKernel(MSresetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSresetBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose) cout << "Executing MSInitRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(MSInitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSInitRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
 
 
   
   if(verbose) cout << "Executing MSRescanOverlapTreeKernel" << endl;
-  cl.executeKernel(MSRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSRescanOverlapTreeKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing MSresetSelfVolumesKernel" << endl;
-  cl.executeKernel(MSresetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);//ok
+  launchKernel(MSresetSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);//ok
 
   if(verbose) cout << "Executing MScomputeSelfVolumesKernel" << endl;
-  cl.executeKernel(MScomputeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MScomputeSelfVolumesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose) cout << "Executing MSreduceSelfVolumesKernel_buffer" << endl;
-  cl.executeKernel(MSreduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSreduceSelfVolumesKernel_buffer, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   if(verbose_level > 1) cout << "Executing MSupdateSelfVolumesForces" << endl;
-  cl.executeKernel(MSupdateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSupdateSelfVolumesForcesKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
   
   if(verbose_level > 1){
     //print MS self volumes with large radii 
@@ -5333,7 +5933,7 @@ double OpenCLCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool incl
 
   //update energy buffer
   if(verbose) cout << "Executing MSupdateEnergyBufferKernel" << endl;
-  cl.executeKernel(MSupdateEnergyBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
+  launchKernel(MSupdateEnergyBufferKernel, ov_work_group_size*num_compute_units, ov_work_group_size);
 
   
   
@@ -10,6 +10,7 @@
 #include "openmm/opencl/OpenCLContext.h"
 #include "openmm/opencl/OpenCLArray.h"
 #include "openmm/reference/RealVec.h"
+#include <map>
 using namespace std;
 
 namespace AGBNPPlugin {
@@ -59,6 +60,14 @@ public:
     PanicButton = NULL;
     pinnedPanicButtonBuffer = NULL;
     pinnedPanicButtonMemory = NULL;
+    panic_button_slot = 0;
+    pending_panic_button_slot = -1;
+    synchronous_tree_check = true;
+    deferred_step_count = -1;
+    deferred_force_count = -1;
+    savedPosq = NULL;
+    savedPosqCorrection = NULL;
+    savedVelm = NULL;
 
     do_ms = false;
     MSparticle1 = NULL;
@@ -66,6 +75,19 @@ public:
     
     MScount1 = NULL;
     MScount2 = NULL;
+
+    tree_overlaps_guess = 0;
+    ms_tree_section_size = -1;
+    ms_count_estimate = 0;
+
+    hasTreeOverflow = false;
+    num_tree_overflows = 0;
+
+    useFusedKernels = false;
+    num_evaluations = 0;
+
+    num_programs_compiled = 0;
+    num_programs_from_cache = 0;
   }
 
     ~OpenCLCalcAGBNPForceKernel();
@@ -92,6 +114,16 @@ public:
      * @param force      the AGBNPForce to copy the parameters from
      */
     void copyParametersToContext(OpenMM::ContextImpl& context, const AGBNPForce& force);
+    /**
+     * Get the number of times the overlap tree overflowed and was grown.
+     */
+    int getNumTreeOverflows(void) {
+      return num_tree_overflows;
+    }
+    /**
+     * Get a report of the numbers of launches of each kernel.
+     */
+    std::string getKernelLaunchReport(void);
 
     class OpenCLOverlapTree {
     public:
@@ -124,6 +156,7 @@ public:
 	ovProcessedFlag = NULL;
 	ovOKtoProcessFlag = NULL;
 	ovChildrenReported = NULL;
+	ovAtomOverlapCount = NULL;
 
 	ovAtomBuffer = NULL;	    
 	EnergyBuffer_long = NULL;
@@ -136,6 +169,7 @@ public:
 	gradBuffers_long = NULL;
 	
 	temp_buffer_size = -1;
+	tree_capacity = 0;
 	gvol_buffer_temp = NULL;
 	tree_pos_buffer_temp = NULL;
 	i_buffer_temp = NULL;
@@ -177,6 +211,7 @@ public:
 	delete ovProcessedFlag;
 	delete ovOKtoProcessFlag;
 	delete ovChildrenReported;
+	delete ovAtomOverlapCount;
 
 	delete ovAtomBuffer;	    
 	delete selfVolumeBuffer_long;
@@ -200,6 +235,9 @@ public:
       //simpler version with precomputed tree sizes
       void init_tree_size(int padded_num_atoms, int tree_section_size, int num_compute_units, int pad_modulo);
       
+      //grows the sections that overflowed, returns false if the tree buffers need to be reallocated
+      bool grow_tree_sections(vector<int>& section_sizes, int num_compute_units, int pad_modulo, double headroom);
+
       //resizes tree buffers
       void resize_tree_buffers(OpenMM::OpenCLContext& cl, int ov_work_group_size);
       
@@ -212,6 +250,7 @@ public:
       int padded_num_atoms;
       int total_atoms_in_tree;
       int total_tree_size;
+      int tree_capacity; //allocated size of the tree buffers, at least total_tree_size
       int num_sections;
       vector<int> tree_size;
       vector<int> padded_tree_size;
@@ -251,6 +290,7 @@ public:
       OpenMM::OpenCLArray* ovProcessedFlag;
       OpenMM::OpenCLArray* ovOKtoProcessFlag;
       OpenMM::OpenCLArray* ovChildrenReported;
+      OpenMM::OpenCLArray* ovAtomOverlapCount; //number of overlaps under each atom, counted on the device
 
       OpenMM::OpenCLArray* ovAtomBuffer;
       OpenMM::OpenCLArray* EnergyBuffer_long;
@@ -567,12 +607,63 @@ private:
     double executeAGBNP1(ContextImpl& context, bool includeForces, bool includeEnergy);
     double executeAGBNP2(ContextImpl& context, bool includeForces, bool includeEnergy); 
 
+    //builds the overlap tree and counts the overlaps of each atom into tree_noverlaps,
+    //returns false if the tree or the temporary buffers overflowed
+    bool countOverlapTree(void);
+    cl::Kernel CountOverlapTreeAtomsKernel;
+    vector<int> tree_noverlaps; //numbers of overlaps per atom from the last count on the device
+    int tree_overlaps_guess;    //per-atom guess used before the first count
+    int ms_tree_section_size;   //size of the MS tree sections from the CPU estimate, -1 to re-estimate
+    int ms_count_estimate;      //number of MS particles from the CPU estimate
+
+    //grows the overlap trees after an overflow so that the step can be replayed
+    void recoverTreeOverflow(ContextImpl& context, bool includeForces, bool includeEnergy);
+    bool hasTreeOverflow;   //set by the execute functions when the tree overflowed
+    int num_tree_overflows; //number of overflows of the overlap tree
+
     //flag to give up
     OpenMM::OpenCLArray* PanicButton;
     vector<cl_int> panic_button;
     cl::Buffer* pinnedPanicButtonBuffer;
     int* pinnedPanicButtonMemory;
     cl::Event downloadPanicButtonEvent;
+    //deferred reads of PanicButton go alternately to two slots of the pinned buffer
+    int panic_button_slot;         //slot of the next read
+    int pending_panic_button_slot; //slot of the read of the last evaluation not yet checked, -1 if none
+    cl::Event pendingPanicButtonEvent[2];
+    bool synchronous_tree_check;    //set by execute(), PanicButton is read right away if true
+    long long deferred_step_count;  //step and force evaluation counts of the last deferred evaluation
+    int deferred_force_count;
+    void enqueuePanicButtonRead(bool synchronous);
+    bool checkTreeOverflow(bool synchronous);
+    bool checkDeferredTreeOverflow(ContextImpl& context, bool includeForces, bool includeEnergy);
+    //positions and velocities at the start of the last evaluation, restored if its tree overflowed
+    OpenMM::OpenCLArray* savedPosq;
+    OpenMM::OpenCLArray* savedPosqCorrection;
+    OpenMM::OpenCLArray* savedVelm;
+
+    //fused kernels of the AGBNP1 pipeline, they replace the reset, init and reduce
+    //kernels indicated in the kernel sources
+    bool useFusedKernels;
+    cl::Kernel resetTreeAndBufferKernel;
+    cl::Kernel ResetInitRescanOverlapTreeKernel;
+    cl::Kernel reduceSelfVolumesUpdateForcesKernel;
+    cl::Kernel reduceBornRadiiVdWEnergyKernel;
+    cl::Kernel reduceGBEnergyResetBuffersKernel;
+
+    //launches a kernel and counts the launch
+    void launchKernel(cl::Kernel& kernel, int workUnits, int blockSize = -1);
+    map<cl_kernel, int> kernel_launch_count;
+    int num_evaluations;
+
+    //builds a program like cl.createProgram(), with a binary from the program cache if there is one
+    cl::Program createProgram(const string& source, const map<string, string>& defines);
+    string getProgramCacheKey(const string& source, const map<string, string>& defines);
+    bool loadProgramBinary(const string& filename, const string& key, cl::Program& program);
+    void saveProgramBinary(const string& filename, const string& key, cl::Program& program);
+    string program_cache_dir;    //directory of the program cache, empty if the cache is off
+    int num_programs_compiled;   //programs compiled from source
+    int num_programs_from_cache; //programs built from cached binaries
 
     bool do_ms; //flag to turn off MS model if no MS particles
     OpenCLMSParticle *MSparticle1;
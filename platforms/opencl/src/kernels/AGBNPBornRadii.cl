@@ -821,6 +821,67 @@ __kernel void VdWEnergy(__global const  real* restrict alphaParam, //VdW alpha p
  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
 }
 
+//reduceBornRadii() and VdWEnergy() in one launch. The inverse Born radii accumulation buffer is
+//zeroed as it is read and the "Y" buffer is zeroed too, they are the GB energy accumulation buffers
+//of GBPairEnergy() which then does not need initGBEnergy()
+__kernel void reduceBornRadiiVdWEnergy(unsigned const int bufferSize, unsigned const int numBuffers, 
+#ifdef SUPPORTS_64_BIT_ATOMICS
+				       __global        long* restrict invBornRadiusBuffer_long,
+#endif
+				       __global        real* restrict invBornRadiusBuffer,
+#ifdef SUPPORTS_64_BIT_ATOMICS
+				       __global        long* restrict GBDerYBuffer_long,
+#endif
+				       __global        real* restrict GBDerYBuffer,
+				       __global const  real* restrict radiusParam, //van der Waals radius
+				       __global        real* restrict invBornRadius,
+				       __global        real* restrict invBornRadius_fp,
+				       __global        real* restrict BornRadius,
+				       __global const  real* restrict alphaParam, //VdW alpha parameter
+				       __global        real* restrict VdWDerBrW,
+				       __global        mixed* restrict energyBuffer,
+				       __global        real* restrict testBuffer){
+  uint id = get_global_id(0);
+  real pifac = -1./(4.*PI);
+  real pifac_vdw = 1./(4.*PI);
+  int totalSize = bufferSize*numBuffers;
+  real scale = 1/(real) 0x100000000;
+
+  uint atom = id;
+  while (atom < bufferSize) {
+#ifdef SUPPORTS_64_BIT_ATOMICS
+    real b1 = scale*invBornRadiusBuffer_long[atom];
+    invBornRadiusBuffer_long[atom] = 0;
+    GBDerYBuffer_long[atom] = 0;
+#else
+    real b1 = 0;
+    for (int i = atom; i < totalSize; i += bufferSize){
+      b1 += invBornRadiusBuffer[i];
+      invBornRadiusBuffer[i] = 0;
+      GBDerYBuffer[i] = 0;
+    }
+#endif
+    if(atom < NUM_ATOMS){
+      //scale and add 1/Rvdw
+      invBornRadius[atom] = (1./radiusParam[atom]) + pifac*b1;
+      real2 res = agbnp_swf_invbr(invBornRadius[atom]);
+      BornRadius[atom] = 1./res.x;
+      invBornRadius_fp[atom] = res.y;
+
+      //van der Waals energy
+      real rbr = BornRadius[atom]+AGBNP_HB_RADIUS;
+      real rbr3 = rbr*rbr*rbr;
+      real rbr4 = rbr3*rbr;
+      real bb = BornRadius[atom]*BornRadius[atom];
+      real evdw = alphaParam[atom]/rbr3;
+      VdWDerBrW[atom] = -pifac_vdw*3.0*alphaParam[atom]*bb*invBornRadius_fp[atom]/rbr4;
+      testBuffer[atom] = evdw;
+      energyBuffer[atom] += evdw;
+    }
+    atom += get_global_size(0);
+  }
+}
+
 //initializes accumulators for derivatives
 __kernel void initVdWGBDerBorn(unsigned const int             bufferSize,
 			       unsigned const int             numBuffers,
@@ -741,3 +741,64 @@ __kernel void reduceGBEnergy(unsigned const int bufferSize, unsigned const int n
 
   barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);    
 }
+
+
+//reduceGBEnergy() that also zeroes the accumulation buffers as it reads them. They are the
+//accumulation buffers of VdWGBDerBorn() which then does not need initVdWGBDerBorn()
+__kernel void reduceGBEnergyResetBuffers(unsigned const int bufferSize, unsigned const int numBuffers, 
+#ifdef SUPPORTS_64_BIT_ATOMICS
+					 __global       long* restrict GBEnergyBuffer_long,
+#endif
+					 __global       real* restrict GBEnergyBuffer,
+
+					 __global const real* restrict chargeParam,
+					 __global const real* restrict BornRadius,
+					 __global const real* restrict invBornRadius_fp,
+
+#ifdef SUPPORTS_64_BIT_ATOMICS
+					 __global       long* restrict GBDerYBuffer_long,
+#endif
+					 __global       real* restrict GBDerYBuffer,
+
+					 __global       real* restrict GBDerY,
+					 __global       real* restrict GBDerBrU,
+			     
+					 __global mixed*  restrict energyBuffer
+){
+  uint id = get_global_id(0);
+
+  int totalSize = bufferSize*numBuffers;
+  real scale = 1/(real) 0x100000000;
+
+  real dielectric_factor = AGBNP_DIELECTRIC_FACTOR;
+  real fac = -dielectric_factor/(4.*PI);
+
+  uint atom = id;
+  while (atom < bufferSize) {
+#ifdef SUPPORTS_64_BIT_ATOMICS
+    real egb = scale*GBEnergyBuffer_long[atom];
+    real y = scale*GBDerYBuffer_long[atom];
+    GBEnergyBuffer_long[atom] = 0;
+    GBDerYBuffer_long[atom] = 0;
+#else
+    real egb = 0;
+    real y = 0;
+    for (int i = atom; i < totalSize; i += bufferSize){
+      egb += GBEnergyBuffer[i];
+      y += GBDerYBuffer[i];
+      GBEnergyBuffer[i] = 0;
+      GBDerYBuffer[i] = 0;
+    }
+#endif
+    if(atom < NUM_ATOMS){
+      //GB energy with the self energy
+      real qq = dielectric_factor*chargeParam[atom]*chargeParam[atom];
+      energyBuffer[atom] += egb + qq/BornRadius[atom];
+
+      //GB Y and BrU variables (for 2nd component of GB forces)
+      GBDerY[atom] = y;
+      GBDerBrU[atom] = fac*(chargeParam[atom]*chargeParam[atom]+y*BornRadius[atom])*invBornRadius_fp[atom];
+    }
+    atom += get_global_size(0);
+  }
+}
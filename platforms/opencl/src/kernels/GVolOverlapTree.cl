@@ -938,6 +938,36 @@ __kernel void resetComputeOverlapTree(const int ntrees,
   }
 }
 
+//counts the overlaps under each atom (the overlaps of level 2 and higher whose
+//1-body ancestor is the atom). Used to size the tree sections.
+//ovAtomOverlapCount is assumed to be zeroed.
+__kernel void CountOverlapTreeAtoms(const int ntrees,
+    __global const int*   restrict ovTreePointer,
+    __global const int*   restrict ovAtomTreeSize,
+    __global const int*   restrict ovLevel,
+    __global const int*   restrict ovRootIndex,
+    __global const int*   restrict ovLastAtom,
+    __global       int*   restrict ovAtomOverlapCount
+){
+  uint local_id = get_local_id(0);
+  int tree = get_group_id(0);
+  while( tree < ntrees ){
+    uint tree_ptr = ovTreePointer[tree];
+    uint tree_size = ovAtomTreeSize[tree];
+    uint endslot = tree_ptr + tree_size;
+    uint slot = tree_ptr + local_id;
+    while(slot < endslot){
+      if(ovLevel[slot] > 1){
+	int root = slot;
+	while(root >= 0 && ovLevel[root] > 1) root = ovRootIndex[root];
+	if(root >= 0) atomic_inc(&ovAtomOverlapCount[ovLastAtom[root]]);
+      }
+      slot += get_local_size(0);
+    }
+    tree += get_num_groups(0);
+  }
+}
+
 //===================================================
 //Utilities to do parallel prefix sum of an array ("scan").
 //The input is an integer array and the output is the sum of
@@ -1447,8 +1477,8 @@ __kernel __attribute__((reqd_work_group_size(OV_WORK_GROUP_SIZE,1,1)))
       barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE); //to sync ovProcessedFlag etc.
     }
     barrier(CLK_LOCAL_MEM_FENCE);
-    //stores tree size in global mem
-    if(local_id == 0) ovAtomTreeSize[tree] = tree_size;
+    //stores tree size in global mem, a section that overflowed is reported as full
+    if(local_id == 0) ovAtomTreeSize[tree] = panic > 0 ? ovAtomTreePaddedSize[tree] : tree_size;
     barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
 
     //next tree
@@ -1545,6 +1575,35 @@ __kernel void InitRescanOverlapTree(const int ntrees,
 #endif
 }
 
+//ResetRescanOverlapTree() and InitRescanOverlapTree() in one launch: 1-body overlaps are
+//marked as processed, 2-body overlaps as ready for processing and all other slots are cleared
+__kernel void ResetInitRescanOverlapTree(const int ntrees,
+    __global const int*   restrict ovTreePointer,
+    __global const int*   restrict ovAtomTreeSize,
+    __global const int*   restrict ovAtomTreePaddedSize,
+    __global       int*   restrict ovProcessedFlag,
+    __global       int*   restrict ovOKtoProcessFlag,
+    __global const int*   restrict ovLevel
+){
+  uint local_id = get_local_id(0);
+  int tree = get_group_id(0);
+
+  while( tree < ntrees){
+    uint tree_ptr = ovTreePointer[tree];
+    uint endslot = tree_ptr + ovAtomTreeSize[tree];
+    uint endpadded = tree_ptr + ovAtomTreePaddedSize[tree];
+    uint slot = tree_ptr + local_id;
+    while(slot < endpadded){
+      int level = slot < endslot ? ovLevel[slot] : 0;
+      ovProcessedFlag[slot] = (level == 1) ? 1 : 0;
+      ovOKtoProcessFlag[slot] = (level == 2) ? 1 : 0;
+      slot += get_local_size(0);
+    }
+    tree += get_num_groups(0);
+    barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+  }
+}
+
 //this kernel recomputes the overlap volumes of the current tree
 //it does not modify the tree in any other way
 __kernel __attribute__((reqd_work_group_size(OV_WORK_GROUP_SIZE,1,1)))
@@ -125,3 +125,83 @@ __kernel void updateSelfVolumesForces(int update_energy,
  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);    
  
 }
+
+
+//reduceSelfVolumes_buffer() and updateSelfVolumesForces() in one launch. The accumulation buffers
+//are zeroed as they are read, so that the next computeSelfVolumes() does not need resetBuffer()
+__kernel void reduceSelfVolumesUpdateForces(int update_energy,
+					    int num_atoms, int padded_num_atoms,
+					    int numBuffers, 
+					    __global const int*   restrict ovAtomTreePointer,
+					    __global       real4* restrict ovAtomBuffer,
+#ifdef SUPPORTS_64_BIT_ATOMICS
+					    __global       long*  restrict gradBuffers_long,
+					    __global       long*  restrict selfVolumeBuffer_long,
+#endif
+					    __global       real*  restrict selfVolumeBuffer,
+					    __global       real*  restrict selfVolume,
+					    __global const real* restrict global_gaussian_volume, //atomic Gaussian volume
+					    __global       real4* restrict grad, //gradient wrt to atom positions and volume
+					    __global const real* restrict ovVolEnergy,
+#ifdef SUPPORTS_64_BIT_ATOMICS
+					    __global long*   restrict forceBuffers,
+#else
+					    __global real4* restrict forceBuffers,
+#endif
+					    __global mixed*  restrict energyBuffer
+){
+  uint id = get_global_id(0);
+  int totalSize = padded_num_atoms*numBuffers;
+#ifdef SUPPORTS_64_BIT_ATOMICS
+  real scale = 1/(real) 0x100000000;
+#endif
+
+  uint atom = id;
+  while (atom < num_atoms) {
+    real4 g;
+#ifdef SUPPORTS_64_BIT_ATOMICS
+    selfVolume[atom] = scale*selfVolumeBuffer_long[atom];
+    g.x = scale*gradBuffers_long[atom];
+    g.y = scale*gradBuffers_long[atom+padded_num_atoms];
+    g.z = scale*gradBuffers_long[atom+2*padded_num_atoms];
+    g.w = scale*gradBuffers_long[atom+3*padded_num_atoms];
+    selfVolumeBuffer_long[atom] = 0;
+    gradBuffers_long[atom                   ] = 0;
+    gradBuffers_long[atom+  padded_num_atoms] = 0;
+    gradBuffers_long[atom+2*padded_num_atoms] = 0;
+    gradBuffers_long[atom+3*padded_num_atoms] = 0;
+#else
+    real sum = 0;
+    real4 sum4 = 0;
+    for (int i = atom; i < totalSize; i += padded_num_atoms){
+      sum += selfVolumeBuffer[i];
+      sum4 += ovAtomBuffer[i];
+      selfVolumeBuffer[i] = 0;
+      ovAtomBuffer[i] = (real4)0;
+    }
+    selfVolume[atom] = sum;
+    g = sum4;
+#endif
+    // divide gradient with respect to volume by volume of atom
+    if(global_gaussian_volume[atom] > 0){
+      g.w = g.w/global_gaussian_volume[atom];
+    }else{
+      g.w = 0;
+    }
+    grad[atom] = g;
+
+    // volume energy is stored at the 1-body level
+    if(update_energy > 0){
+      uint slot = ovAtomTreePointer[atom];
+      energyBuffer[id] += ovVolEnergy[slot];
+    }
+#ifdef SUPPORTS_64_BIT_ATOMICS
+    atom_add(&forceBuffers[atom                     ], (long)(-g.x*0x100000000));
+    atom_add(&forceBuffers[atom +   padded_num_atoms], (long)(-g.y*0x100000000));
+    atom_add(&forceBuffers[atom + 2*padded_num_atoms], (long)(-g.z*0x100000000));
+#else
+    forceBuffers[atom].xyz -= g.xyz;
+#endif
+    atom += get_global_size(0);
+  }
+}
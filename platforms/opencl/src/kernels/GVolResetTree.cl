@@ -114,15 +114,15 @@ void resetTreeSection(
 }
 
 
-__kernel void resetBuffer(unsigned const int             bufferSize,
-			  unsigned const int             numBuffers,
-			  __global       real4* restrict ovAtomBuffer,
-			  __global        real* restrict selfVolumeBuffer
+//zeroes the self volume and gradient accumulation buffers
+void resetAtomBuffers(unsigned const int             bufferSize,
+		      unsigned const int             numBuffers,
+		      __global       real4* restrict ovAtomBuffer,
+		      __global        real* restrict selfVolumeBuffer
 #ifdef SUPPORTS_64_BIT_ATOMICS
-			  ,
-			  __global long*   restrict selfVolumeBuffer_long,
-			  __global long*   restrict gradBuffers_long
-
+		      ,
+		      __global long*   restrict selfVolumeBuffer_long,
+		      __global long*   restrict gradBuffers_long
 #endif
 ){
   unsigned int id = get_global_id(0);
@@ -142,6 +142,24 @@ __kernel void resetBuffer(unsigned const int             bufferSize,
     id += get_global_size(0);
   }
 #endif
+}
+
+__kernel void resetBuffer(unsigned const int             bufferSize,
+			  unsigned const int             numBuffers,
+			  __global       real4* restrict ovAtomBuffer,
+			  __global        real* restrict selfVolumeBuffer
+#ifdef SUPPORTS_64_BIT_ATOMICS
+			  ,
+			  __global long*   restrict selfVolumeBuffer_long,
+			  __global long*   restrict gradBuffers_long
+
+#endif
+){
+  resetAtomBuffers(bufferSize, numBuffers, ovAtomBuffer, selfVolumeBuffer
+#ifdef SUPPORTS_64_BIT_ATOMICS
+		   , selfVolumeBuffer_long, gradBuffers_long
+#endif
+		   );
   barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
 }
 
@@ -203,3 +221,74 @@ __kernel void resetTree(const int ntrees,
     section += get_num_groups(0); //next section  
   }
 }
+
+
+//resetTree() and resetBuffer() in one launch
+__kernel void resetTreeAndBuffer(const int ntrees,
+			__global const int*   restrict ovTreePointer,
+			__global const int*   restrict ovAtomTreePointer,
+			__global       int*   restrict ovAtomTreeSize,
+			__global const int*   restrict ovAtomTreePaddedSize,
+			__global       int*   restrict ovLevel,
+			__global       real*  restrict ovVolume,
+			__global       real*  restrict ovVsp,
+			__global       real*  restrict ovVSfp,
+			__global       real*  restrict ovSelfVolume,
+			__global       real*  restrict ovVolEnergy,
+			__global       int*   restrict ovLastAtom,
+			__global       int*   restrict ovRootIndex,
+			__global       int*   restrict ovChildrenStartIndex,
+			__global       int*   restrict ovChildrenCount,
+			__global       real4* restrict ovDV1,
+			__global       real4* restrict ovDV2,
+
+			__global       int*  restrict ovProcessedFlag,
+			__global       int*  restrict ovOKtoProcessFlag,
+			__global       int*  restrict ovChildrenReported,
+			__global       int*  restrict ovAtomTreeLock,
+			__global       int*  restrict NIterations,
+
+			unsigned const int             bufferSize,
+			unsigned const int             numBuffers,
+			__global       real4* restrict ovAtomBuffer,
+			__global        real* restrict selfVolumeBuffer
+#ifdef SUPPORTS_64_BIT_ATOMICS
+			,
+			__global long*   restrict selfVolumeBuffer_long,
+			__global long*   restrict gradBuffers_long
+#endif
+			){
+  unsigned int section = get_group_id(0);
+  while(section < ntrees){
+    unsigned int offset = ovTreePointer[section];
+    unsigned int padded_tree_size = ovAtomTreePaddedSize[section];
+    resetTreeSection(padded_tree_size, offset, 
+		     ovLevel,
+		     ovVolume,
+		     ovVsp,
+		     ovVSfp,
+		     ovSelfVolume,
+		     ovVolEnergy,
+		     ovLastAtom,
+		     ovRootIndex,
+		     ovChildrenStartIndex,
+		     ovChildrenCount,
+		     ovDV1,
+		     ovDV2,
+		     ovProcessedFlag,
+		     ovOKtoProcessFlag,
+		     ovChildrenReported
+		     );
+    if(get_local_id(0) == 0){
+      ovAtomTreeLock[section] = 0;
+      NIterations[section] = 0;
+    }
+    section += get_num_groups(0);
+  }
+
+  resetAtomBuffers(bufferSize, numBuffers, ovAtomBuffer, selfVolumeBuffer
+#ifdef SUPPORTS_64_BIT_ATOMICS
+		   , selfVolumeBuffer_long, gradBuffers_long
+#endif
+		   );
+}
@@ -60,6 +60,16 @@ void computeSelfVolumes(const int ntrees,
     uint nsections = padded_tree_size/gsize;    
     uint ov_count = 0;
 
+#ifdef RESET_TREE_COUNTERS
+    //resets the counters of this tree section as resetSelfVolumes() does, saving its launch
+    for(uint slot = offset + id; slot < offset + padded_tree_size; slot += gsize){
+      ovProcessedFlag[slot] = (slot >= offset + tree_size) ? 1 : 0;
+      ovOKtoProcessFlag[slot] = (slot >= offset + tree_size) ? 0 : (ovChildrenCount[slot] == 0 ? 1 : 0);
+      ovChildrenReported[slot] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+#endif
+
     // The tree for this atom is divided into sections each the size of a workgroup
     // The tree is walked bottom up one section at a time
     for(int isection=nsections-1;isection >= 0; isection--){
@@ -14,8 +14,17 @@
 #include "openmm/VerletIntegrator.h"
 #include "openmm/NonbondedForce.h"
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
 
 using namespace AGBNPPlugin;
 using namespace OpenMM;
@@ -23,6 +32,197 @@ using namespace std;
 
 extern "C" OPENMM_EXPORT void registerAGBNPOpenCLKernelFactories();
 
+//numbers of programs compiled and loaded from the program cache in a Context
+void getProgramCounts(AGBNPForce* force, Context& context, int& compiled, int& cached) {
+    string report = force->getKernelLaunchReport(context);
+    size_t pos = report.find("Programs compiled:");
+    ASSERT(pos != string::npos);
+    ASSERT_EQUAL(2, sscanf(report.c_str() + pos, "Programs compiled: %d, loaded from the program cache: %d", &compiled, &cached));
+}
+
+//creates a new empty directory in the temporary directory
+string makeTempDirectory() {
+#ifdef _WIN32
+    char* name = _tempnam(NULL, "AGBNPProgramCache");
+    ASSERT(name != NULL);
+    string dir = name;
+    free(name);
+    ASSERT(_mkdir(dir.c_str()) == 0);
+#else
+    const char* tmpdir = getenv("TMPDIR");
+    string name = string(tmpdir != NULL ? tmpdir : "/tmp") + "/AGBNPProgramCacheXXXXXX";
+    vector<char> buffer(name.begin(), name.end());
+    buffer.push_back(0);
+    ASSERT(mkdtemp(&buffer[0]) != NULL);
+    string dir = &buffer[0];
+#endif
+    return dir;
+}
+
+//removes a directory and the files in it
+void removeDirectory(const string& dir) {
+#ifdef _WIN32
+    struct _finddata_t entry;
+    intptr_t handle = _findfirst((dir + "/*").c_str(), &entry);
+    if(handle != -1){
+      do{
+	string name = entry.name;
+	if(name != "." && name != "..") _unlink((dir + "/" + name).c_str());
+      }while(_findnext(handle, &entry) == 0);
+      _findclose(handle);
+    }
+    _rmdir(dir.c_str());
+#else
+    DIR* d = opendir(dir.c_str());
+    if(d != NULL){
+      struct dirent* entry;
+      while((entry = readdir(d)) != NULL){
+	string name = entry->d_name;
+	if(name != "." && name != "..") unlink((dir + "/" + name).c_str());
+      }
+      closedir(d);
+    }
+    rmdir(dir.c_str());
+#endif
+}
+
+//the first Context compiles its programs into an empty program cache, a second Context for the same
+//system loads them from the cache
+void testProgramCache(System& system, AGBNPForce* force, vector<Vec3>& positions, Platform& platform, map<string,string>& properties) {
+    string cache_dir = makeTempDirectory();
+    force->setProgramCacheDirectory(cache_dir);
+    try{
+      State state1, state2;
+      int compiled, cached;
+      {
+	VerletIntegrator integ(1.0);
+	Context context(system, integ, platform, properties);
+	context.setPositions(positions);
+	state1 = context.getState(State::Energy | State::Forces);
+	getProgramCounts(force, context, compiled, cached);
+	std::cout << "Cold start: programs compiled: " << compiled << " cached: " << cached << std::endl;
+      }
+      ASSERT(compiled > 0);
+      ASSERT_EQUAL(0, cached);
+      {
+	VerletIntegrator integ(1.0);
+	Context context(system, integ, platform, properties);
+	context.setPositions(positions);
+	state2 = context.getState(State::Energy | State::Forces);
+	getProgramCounts(force, context, compiled, cached);
+	std::cout << "Warm start: programs compiled: " << compiled << " cached: " << cached << std::endl;
+      }
+      ASSERT_EQUAL(0, compiled);
+      ASSERT(cached > 0);
+      ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1.e-6);
+      for(int i = 0; i < system.getNumParticles(); i++){
+	ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1.e-5);
+      }
+    }catch(...){
+      force->setProgramCacheDirectory("");
+      removeDirectory(cache_dir);
+      throw;
+    }
+    force->setProgramCacheDirectory("");
+    removeDirectory(cache_dir);
+}
+
+//positions scaled about their centre, an expanded configuration has fewer overlaps
+vector<Vec3> scalePositions(const vector<Vec3>& positions, double scale) {
+    Vec3 center;
+    for(int i = 0; i < positions.size(); i++) center += positions[i];
+    center *= 1.0/positions.size();
+    vector<Vec3> scaled(positions.size());
+    for(int i = 0; i < positions.size(); i++) scaled[i] = center + (positions[i] - center)*scale;
+    return scaled;
+}
+
+//the overlap tree of a Context is laid out on the device for its first configuration. Laid out for
+//an expanded configuration, it overflows with the original one, the step is replayed and the results
+//match those of a Context laid out for the original configuration.
+void testTreeOverflow(System& system, AGBNPForce* force, vector<Vec3>& positions, Platform& platform, map<string,string>& properties) {
+    vector<Vec3> expanded = scalePositions(positions, 1.5);
+    State state1, state2;
+    {
+      VerletIntegrator integ(0.001);
+      Context context(system, integ, platform, properties);
+      context.setPositions(positions);
+      state1 = context.getState(State::Energy | State::Forces);
+      ASSERT_EQUAL(0, force->getNumTreeOverflows(context));
+    }
+    {
+      VerletIntegrator integ(0.001);
+      Context context(system, integ, platform, properties);
+      context.setPositions(expanded);
+      context.getState(State::Energy);
+      context.setPositions(positions);
+      state2 = context.getState(State::Energy | State::Forces);
+      int overflows = force->getNumTreeOverflows(context);
+      std::cout << "Version " << force->getVersion() << ": tree overflows: " << overflows << std::endl;
+      ASSERT(overflows > 0);
+    }
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1.e-5);
+    for(int i = 0; i < system.getNumParticles(); i++){
+      ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1.e-4);
+    }
+}
+
+//a step whose tree overflowed without being checked right away is rolled back at the next step and
+//evaluated again, the trajectory is that of a Context whose tree did not overflow
+void testDeferredRollback(System& system, AGBNPForce* force, vector<Vec3>& positions, Platform& platform, map<string,string>& properties) {
+    vector<Vec3> expanded = scalePositions(positions, 1.5);
+    State state1, state2;
+    {
+      VerletIntegrator integ(0.001);
+      Context context(system, integ, platform, properties);
+      context.setPositions(positions);
+      integ.step(1);
+      state1 = context.getState(State::Positions | State::Velocities);
+    }
+    {
+      VerletIntegrator integ(0.001);
+      Context context(system, integ, platform, properties);
+      context.setPositions(expanded);
+      context.getState(State::Energy);
+      context.setPositions(positions);
+      integ.step(1); //the forces of this step are evaluated with a tree that overflows
+      integ.step(1); //rolls back the last step and evaluates it again
+      ASSERT(force->getNumTreeOverflows(context) > 0);
+      state2 = context.getState(State::Positions | State::Velocities);
+    }
+    for(int i = 0; i < system.getNumParticles(); i++){
+      ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1.e-6);
+      ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1.e-4);
+    }
+}
+
+//the fused and the unfused AGBNP1 pipelines give the same energies and forces along a trajectory,
+//with energy-only evaluations between the steps
+void testFusedKernels(System& system, AGBNPForce* force, vector<Vec3>& positions, Platform& platform, map<string,string>& properties) {
+    bool fused = force->getUseFusedKernels();
+    VerletIntegrator integ1(0.001), integ2(0.001);
+    force->setUseFusedKernels(true);
+    Context context1(system, integ1, platform, properties);
+    force->setUseFusedKernels(false);
+    Context context2(system, integ2, platform, properties);
+    force->setUseFusedKernels(fused);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    for(int step = 0; step < 6; step++){
+      int types = (step % 2 == 0) ? State::Energy : State::Energy | State::Forces;
+      State state1 = context1.getState(types);
+      State state2 = context2.getState(types);
+      ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1.e-5);
+      if(types & State::Forces){
+	for(int i = 0; i < system.getNumParticles(); i++){
+	  ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1.e-4);
+	}
+      }
+      integ1.step(1);
+      integ2.step(1);
+    }
+}
+
 void testForce() {
     bool verbose = true;
     bool veryverbose = false;
@@ -99,6 +299,16 @@ void testForce() {
     std::cout << "Energy Change from Gradient: " <<  de  << std::endl;
 #endif
 
+    for(int version = 1; version <= 2; version++){
+      force->setVersion(version);
+      testTreeOverflow(system, force, positions, platform, properties);
+    }
+    force->setVersion(1);
+    testDeferredRollback(system, force, positions, platform, properties);
+    testFusedKernels(system, force, positions, platform, properties);
+
+    testProgramCache(system, force, positions, platform, properties);
+
 }
 
 int main() {
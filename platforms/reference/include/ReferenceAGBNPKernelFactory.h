@@ -17,6 +17,11 @@ namespace OpenMM {
 class ReferenceAGBNPKernelFactory : public KernelFactory {
 public:
     KernelImpl* createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const;
+    /**
+     * The number of threads of the AGBNP kernel: the "Threads" property of the platform if it has
+     * one (as the CPU platform does), otherwise the AGBNP_NUM_THREADS environment variable, otherwise one.
+     */
+    static int getNumThreads(const Platform& platform, ContextImpl& context);
 };
 
 } // namespace OpenMM
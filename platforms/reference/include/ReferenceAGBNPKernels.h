@@ -12,17 +12,81 @@
 
 namespace AGBNPPlugin {
 
+ //class to record MS particles
+ class MSParticle {
+ public:
+   double vol;
+   double vol_large;
+   double vol_vdw;
+   double vol0;
+   double ssp_large;
+   double ssp_vdw;
+   RealVec pos;
+   int parent1;
+   int parent2;
+   RealVec gder;//used for volume derivatives
+   RealVec hder;//used for positional derivatives
+   double fms;
+   double G0_vdw; //accumulator for derivatives
+   double G0_large;
+ };
+
+/* tree of the charged atoms for the treecode evaluation of the GB pair energy without cutoff. Far from
+   a cluster of atoms the GB pair term 1/sqrt(d^2 + bb*exp(-d^2/4bb)) becomes the Coulomb term 1/d,
+   which is expanded in Cartesian multipoles of the cluster about its center. */
+class AGBNPGBPairTree {
+ public:
+  class Node {
+  public:
+    RealVec center;
+    RealOpenMM radius;
+    RealOpenMM max_born_radius;
+    int first, last; //range of the node's atoms in atoms[]
+    int child;       //index of the first of the two children, -1 for a leaf
+  };
+  //builds the tree of the atoms with nonzero charge with multipoles up to the given order
+  void build(const std::vector<RealVec>& pos, const std::vector<RealOpenMM>& charge,
+	     const std::vector<RealOpenMM>& born_radius, int order);
+  /* sum over the atoms j != self of qj/sqrt(d^2 + bb*exp(-d^2/4bb)) at x for an atom of Born radius bi and,
+     if gradient is set, its gradient grad with respect to x and the sum ysum of qj*(bb+d^2/4)*exp(-d^2/4bb)/f^3
+     for the Born radii derivatives. Clusters with radius smaller than theta times their distance, and far
+     enough that the GB term differs from the Coulomb one by less than theta^(order+1), are expanded in
+     multipoles; the far field does not contribute to ysum. stack and b are workspace. */
+  RealOpenMM potential(int self, const RealVec& x, RealOpenMM bi, RealOpenMM theta, bool gradient,
+		       RealVec& grad, RealOpenMM& ysum, std::vector<int>& stack, std::vector<RealOpenMM>& b) const;
+
+  std::vector<Node> nodes;
+  std::vector<int> atoms;
+  //positions, charges and Born radii of the atoms, in the order of atoms[]
+  std::vector<RealVec> atom_pos;
+  std::vector<RealOpenMM> atom_charge, atom_born_radius;
+  //multipole moments sum_j qj*(center - xj)^k, nterms per node
+  std::vector<RealOpenMM> moments;
+  int order;
+  //Cartesian multi-indexes k of degree up to order+1 (the first nterms up to order) by increasing degree,
+  //with the indexes of k-e_i, k-2e_i and k+e_i (-1 if not defined)
+  int nterms, nterms1;
+  std::vector<int> term_k, term_degree, term_m1, term_m2, term_p1;
+};
+
 /**
  * This kernel is invoked by AGBNPForce to calculate the forces acting 
  * on the system and the energy of the system.
  */
 class ReferenceCalcAGBNPForceKernel : public CalcAGBNPForceKernel {
 public:
-    ReferenceCalcAGBNPForceKernel(std::string name, const OpenMM::Platform& platform) : CalcAGBNPForceKernel(name, platform) {
+    ReferenceCalcAGBNPForceKernel(std::string name, const OpenMM::Platform& platform, int numThreads = 1) : CalcAGBNPForceKernel(name, platform) {
     gvol = 0;
+    gvolms = 0;
+    i4_lut = 0;
+    i4_table = 0;
+    this->numThreads = numThreads > 0 ? numThreads : 1;
     }
   ~ReferenceCalcAGBNPForceKernel(){
     if(gvol) delete gvol;
+    if(gvolms) delete gvolms;
+    if(i4_table) delete i4_table;
+    if(i4_lut) delete i4_lut;
     positions.clear();
     ishydrogen.clear();
     radii_vdw.clear();
@@ -65,8 +129,10 @@ public:
      */
     void copyParametersToContext(OpenMM::ContextImpl& context, const AGBNPForce& force);
  
-private:
+protected:
     GaussVol *gvol; // gaussvol instance
+    int numThreads; //number of threads for the overlap tree and the GB pair loop
+    GThreadPool pool;
     unsigned int version; //1 or 2
     //inputs
     int numParticles;
@@ -84,14 +150,100 @@ private:
     std::vector<RealOpenMM> free_volume_large, self_volume_large;
     std::vector<RealVec> vol_force;
     std::vector<RealOpenMM> vol_dv;
+    //parameters and results of GaussVol::compute_volume_channels()
+    std::vector< std::vector<RealOpenMM> > ch_radii, ch_volumes, ch_gammas;
+    std::vector<RealOpenMM> ch_volume, ch_energy;
+    std::vector< std::vector<RealVec> > ch_force;
+    std::vector< std::vector<RealOpenMM> > ch_dv, ch_free_volume, ch_self_volume;
     AGBNPI42DLookupTable *i4_lut;
+    AGBNPI4UniformTable *i4_table; //uniform-grid version of i4_lut used in the Born radii loops
     std::vector<RealOpenMM> volume_scaling_factor;
     std::vector<RealOpenMM> inverse_born_radius;
     std::vector<RealOpenMM> inverse_born_radius_fp;
     std::vector<RealOpenMM> born_radius;
     double roffset;
     double solvent_radius;
+
+    //nonbonded method
+    bool useCutoff;
+    bool usePeriodic;
+    double cutoffDistance;
+    RealVec boxVectors[3];
+    //Verlet neighbor list of pairs (i,j>i), built with cutoff + skin and rebuilt
+    //when an atom has moved more than half the skin or the periodic box has changed
+    double neighborSkin;
+    std::vector<int> neighbor_start, neighbor_list;
+    std::vector<RealVec> neighbor_positions;
+    RealVec neighbor_box[3];
+    //cell grid of all the atoms for the neighbor list (wrapped into the box if periodic)
+    //and the lattice translations of the periodic images to search
+    GCellGrid nb_grid;
+    std::vector<int> nb_grid_active, nb_candidates;
+    std::vector<RealVec> nb_grid_pos, nb_shifts;
+    //treecode evaluation of the GB pair energy without cutoff (accuracy parameter, 0 if all pairs,
+    //and expansion order), its tree and per-thread workspaces
+    double gb_treecode_theta;
+    int gb_treecode_order;
+    AGBNPGBPairTree gb_tree;
+    std::vector< std::vector<int> > tree_stack;
+    std::vector< std::vector<RealOpenMM> > gb_tree_b;
+    //volumes from radii: with large and van der Waals radii for the overlap tree (zero for hydrogens)
+    //and van der Waals sphere volumes for the volume scaling factors
+    std::vector<RealOpenMM> volumes_large, volumes_vdw, vdw_volume;
+    //Gaussian exponents of the atoms with large and van der Waals radii
+    std::vector<RealOpenMM> a_large, a_vdw;
+    //per-step workspace, sized in initialize() or grown as needed so that steps do not allocate
+    std::vector<RealOpenMM> egb_der_Y, evdw_der_brw, egb_der_bru, evdw_der_W, egb_der_U;
+    std::vector<RealOpenMM> numsder, svadd;
+    //MS particles and their GaussVol instance (AGBNP2)
+    std::vector<MSParticle> msparticles1, msparticles2;
+    GaussVol *gvolms;
+    std::vector<RealOpenMM> radii_ms, volumes_ms, gammas_ms;
+    std::vector<int> ishydrogen_ms;
+    std::vector<RealVec> pos_ms, forces_ms;
+    std::vector<RealOpenMM> vol_dv_ms, freevols_ms, selfvols_ms;
+    //cell grid of the heavy atoms for the MS particle pairs, when the one of the overlap tree cannot
+    //be used, and for the free volumes of the MS particles
+    GCellGrid ms_grid;
+    std::vector<int> ms_grid_active, ms_candidates;
+    //per-thread force, Y and energy buffers of the GB pair loop
+    std::vector< std::vector<RealVec> > thread_force;
+    std::vector< std::vector<RealOpenMM> > thread_Y;
+    std::vector<RealOpenMM> thread_energy;
+    std::vector<int> gb_row_block;
     
+    //volume energy functions with large and small radii in one traversal of the overlap tree
+    void computeVolumes(std::vector<RealVec>& pos);
+
+    //neighbor list, pair displacements (minimum image if periodic)
+    void updateNeighborList(OpenMM::ContextImpl& context, std::vector<RealVec>& pos);
+    virtual void buildNeighborList(std::vector<RealVec>& pos);
+    void initNeighborGrid(std::vector<RealVec>& pos, RealOpenMM rlist);
+    int neighborRow(int i, std::vector<RealVec>& pos, RealOpenMM rlist2,
+		    std::vector<int>& candidates, std::vector<int>& list);
+    RealVec pairDelta(const RealVec& posi, const RealVec& posj) const;
+
+    //Born radii, GB pair energy and Born radii gradients over the neighbor list
+    //(the pair stages are overridden by the CPU platform kernel)
+    virtual void computeBornRadii(std::vector<RealVec>& pos);
+    void setBornRadii();
+    bool useGBPairTreecode() const {
+      return gb_treecode_theta > 0 && !useCutoff;
+    }
+    RealOpenMM computeGBPairEnergyTreecode(std::vector<RealVec>& pos, std::vector<RealVec>& force,
+					   RealOpenMM dielectric_factor, RealOpenMM w_egb,
+					   std::vector<RealOpenMM>& egb_der_Y, bool includeForces);
+    virtual RealOpenMM computeGBPairEnergy(std::vector<RealVec>& pos, std::vector<RealVec>& force,
+				   RealOpenMM dielectric_factor, RealOpenMM w_egb,
+				   std::vector<RealOpenMM>& egb_der_Y, bool includeForces = true);
+    RealOpenMM computeGBPairEnergyRows(int first, int last, std::vector<RealVec>& pos, std::vector<RealVec>& force,
+				       RealOpenMM dielectric_factor, RealOpenMM w_egb,
+				       std::vector<RealOpenMM>& egb_der_Y, bool includeForces = true);
+    virtual void computeBornRadiiDerivatives(std::vector<RealVec>& pos, std::vector<RealVec>& force,
+				     std::vector<RealOpenMM>& evdw_der_brw, std::vector<RealOpenMM>& egb_der_bru,
+				     RealOpenMM w_vdw, RealOpenMM w_egb,
+				     std::vector<RealOpenMM>& evdw_der_W, std::vector<RealOpenMM>& egb_der_U);
+
     double executeGVolSA(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
     double executeAGBNP1(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
     double executeAGBNP2(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
@@ -101,24 +253,6 @@ private:
 };
 
 
- //class to record MS particles
- class MSParticle {
- public:
-   double vol;
-   double vol_large;
-   double vol_vdw;
-   double vol0;
-   double ssp_large;
-   double ssp_vdw;
-   RealVec pos;
-   int parent1;
-   int parent2;
-   RealVec gder;//used for volume derivatives
-   RealVec hder;//used for positional derivatives
-   double fms;
-   double G0_vdw; //accumulator for derivatives
-   double G0_large;
- };
 
  
 } // namespace AGBNPPlugin
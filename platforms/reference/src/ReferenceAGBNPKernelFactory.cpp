@@ -7,6 +7,7 @@
 #include "openmm/reference/ReferencePlatform.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/OpenMMException.h"
+#include <cstdlib>
 
 using namespace AGBNPPlugin;
 using namespace OpenMM;
@@ -14,9 +15,13 @@ using namespace OpenMM;
 extern "C" OPENMM_EXPORT void registerPlatforms() {
 }
 
-extern "C" OPENMM_EXPORT void registerKernelFactories() {
+/* registers for the Reference platform and the platforms derived from it, except those
+   (such as CPU) that already have their own AGBNP kernels */
+extern "C" OPENMM_EXPORT void registerAGBNPReferenceKernelFactories() {
     for (int i = 0; i < Platform::getNumPlatforms(); i++) {
         Platform& platform = Platform::getPlatform(i);
+        if (platform.getName() != "Reference" && platform.supportsKernels(std::vector<std::string>(1, CalcAGBNPForceKernel::Name())))
+            continue;
         if (dynamic_cast<ReferencePlatform*>(&platform) != NULL) {
             ReferenceAGBNPKernelFactory* factory = new ReferenceAGBNPKernelFactory();
             platform.registerKernelFactory(CalcAGBNPForceKernel::Name(), factory);
@@ -24,13 +29,26 @@ extern "C" OPENMM_EXPORT void registerKernelFactories() {
     }
 }
 
-extern "C" OPENMM_EXPORT void registerAGBNPReferenceKernelFactories() {
-    registerKernelFactories();
+extern "C" OPENMM_EXPORT void registerKernelFactories() {
+    registerAGBNPReferenceKernelFactories();
+}
+
+/* one thread by default, as the Reference platform is single threaded */
+int ReferenceAGBNPKernelFactory::getNumThreads(const Platform& platform, ContextImpl& context) {
+    const std::vector<std::string>& names = platform.getPropertyNames();
+    for (int i = 0; i < (int) names.size(); i++) {
+        if (names[i] == "Threads")
+            return atoi(platform.getPropertyValue(context.getOwner(), "Threads").c_str());
+    }
+    char* threadsEnv = getenv("AGBNP_NUM_THREADS");
+    if (threadsEnv != NULL)
+        return atoi(threadsEnv);
+    return 1;
 }
 
 KernelImpl* ReferenceAGBNPKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     ReferencePlatform::PlatformData& data = *static_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
     if (name == CalcAGBNPForceKernel::Name())
-        return new ReferenceCalcAGBNPForceKernel(name, platform);
+        return new ReferenceCalcAGBNPForceKernel(name, platform, getNumThreads(platform, context));
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <cmath>
 #include <cfloat>
+#include <algorithm>
 //#include "openmm/reference/SimTKOpenMMRealType.h"
 #include "AGBNPUtils.h"
 #include "ReferenceAGBNPKernels.h"
@@ -23,6 +24,10 @@ using namespace AGBNPPlugin;
 using namespace OpenMM;
 using namespace std;
 
+//skin of the Verlet neighbor list (nm)
+#define AGBNP_NEIGHBOR_SKIN (0.1)
+//maximum number of atoms in a leaf of the descreening tree
+#define AGBNP_TREE_LEAF_SIZE (8)
 
 static vector<RealVec>& extractPositions(ContextImpl& context) {
     ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
@@ -120,12 +125,15 @@ void ReferenceCalcAGBNPForceKernel::initialize(const System& system, const AGBNP
     //create and saves GaussVol instance
     //radii, volumes, etc. will be set in execute()
     gvol = new GaussVol(numParticles, ishydrogen);
+    gvol->setNumThreads(numThreads);
+    gvol->setSkin(force.getTreeSkin());
 
     //initializes I4 lookup table for Born-radii calculation
     double rmin = 0.;
     double rmax = AGBNP_I4LOOKUP_MAXA;
     int i4size = AGBNP_I4LOOKUP_NA;
     i4_lut = new AGBNPI42DLookupTable(vdwrad, ishydrogen, i4size, rmin, rmax, version);
+    i4_table = new AGBNPI4UniformTable(*i4_lut);
 
     //volume scaling factors and born radii
     volume_scaling_factor.resize(numParticles);
@@ -133,7 +141,56 @@ void ReferenceCalcAGBNPForceKernel::initialize(const System& system, const AGBNP
     inverse_born_radius_fp.resize(numParticles);
     born_radius.resize(numParticles);
 
+    //volumes from radii, hydrogens have no volume in the overlap tree
+    volumes_large.resize(numParticles);
+    volumes_vdw.resize(numParticles);
+    vdw_volume.resize(numParticles);
+    for(int i = 0; i < numParticles; i++){
+      volumes_large[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_large[i],3)/3.;
+      volumes_vdw[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_vdw[i],3)/3.;
+      vdw_volume[i] = 4.*M_PI*pow(radii_vdw[i],3)/3.;
+    }
+    //Gaussian exponents
+    a_large.resize(numParticles);
+    a_vdw.resize(numParticles);
+    for(int i = 0; i < numParticles; i++){
+      a_large[i] = KFC/(radii_large[i]*radii_large[i]);
+      a_vdw[i] = KFC/(radii_vdw[i]*radii_vdw[i]);
+    }
+
+    //per-step workspace
+    ch_radii.resize(2);
+    ch_volumes.resize(2);
+    ch_gammas.resize(2);
+    for(int c = 0; c < 2; c++){
+      ch_gammas[c].resize(numParticles);
+    }
+    egb_der_Y.resize(numParticles);
+    evdw_der_brw.resize(numParticles);
+    egb_der_bru.resize(numParticles);
+    evdw_der_W.resize(numParticles);
+    egb_der_U.resize(numParticles);
+    numsder.resize(numParticles);
+    svadd.resize(numParticles);
+    if(version == 2){
+      //GaussVol instance for the MS particles, resized at each step
+      vector<int> noatoms;
+      gvolms = new GaussVol(0, noatoms);
+      msparticles1.reserve(numParticles);
+      msparticles2.reserve(numParticles);
+    }
+
     solvent_radius = force.getSolventRadius();
+
+    //nonbonded method and neighbor list
+    useCutoff = (force.getNonbondedMethod() != AGBNPForce::NoCutoff);
+    usePeriodic = (force.getNonbondedMethod() == AGBNPForce::CutoffPeriodic);
+    cutoffDistance = force.getCutoffDistance();
+    neighborSkin = AGBNP_NEIGHBOR_SKIN;
+    neighbor_positions.clear();
+
+    gb_treecode_theta = force.getGBPairTreecodeAccuracy();
+    gb_treecode_order = force.getGBPairTreecodeOrder();
 }
 
 double ReferenceCalcAGBNPForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
@@ -149,6 +206,542 @@ double ReferenceCalcAGBNPForceKernel::execute(ContextImpl& context, bool include
 }
 
 
+/* volume energy function 1 (large radii) and 2 (small radii) computed as two channels of a single
+   traversal of the overlap tree built with the large radii. Results are in the ch_* arrays,
+   channel 0 for large radii and channel 1 for small radii. The tree is left set up with small radii. */
+void ReferenceCalcAGBNPForceKernel::computeVolumes(vector<RealVec>& pos){
+  ch_radii[0] = radii_large;
+  ch_radii[1] = radii_vdw;
+  ch_volumes[0] = volumes_large;
+  ch_volumes[1] = volumes_vdw;
+  for(int i = 0; i < numParticles; i++){
+    ch_gammas[0][i] = gammas[i]/roffset;
+    ch_gammas[1][i] = -gammas[i]/roffset;
+  }
+
+  gvol->setRadii(ch_radii[0]);
+  gvol->setVolumes(ch_volumes[0]);
+  gvol->setGammas(ch_gammas[0]);
+  gvol->compute_tree(pos);
+  gvol->compute_volume_channels(pos, ch_radii, ch_volumes, ch_gammas,
+				ch_volume, ch_energy, ch_force, ch_dv, ch_free_volume, ch_self_volume);
+}
+
+/* rebuilds the Verlet neighbor list of pairs (i,j>i) within the list radius if this is the
+   first call, if the periodic box has changed, or if any atom has moved by more than half
+   the skin since the last rebuild. The list radius is the cutoff distance or, with no cutoff,
+   the range of the I4 descreening function (the GB pair energy is then computed over all pairs). */
+void ReferenceCalcAGBNPForceKernel::updateNeighborList(ContextImpl& context, vector<RealVec>& pos){
+  bool rebuild = (neighbor_positions.size() != numParticles);
+  if(usePeriodic){
+    Vec3 a, b, c;
+    context.getPeriodicBoxVectors(a, b, c);
+    boxVectors[0] = RealVec(a[0], a[1], a[2]);
+    boxVectors[1] = RealVec(b[0], b[1], b[2]);
+    boxVectors[2] = RealVec(c[0], c[1], c[2]);
+    double minwidth = min(a[0], min(b[1], c[2]));
+    if(cutoffDistance > 0.5*minwidth){
+      throw OpenMMException("AGBNPForce: The cutoff distance cannot be greater than half the periodic box size.");
+    }
+    for(int k = 0; k < 3; k++){
+      RealVec db = boxVectors[k] - neighbor_box[k];
+      if(db.dot(db) > 0.0) rebuild = true;
+    }
+  }
+  if(!rebuild){
+    RealOpenMM maxd2 = 0.25*neighborSkin*neighborSkin;
+    for(int i = 0; i < numParticles; i++){
+      RealVec dx = pos[i] - neighbor_positions[i];
+      if(dx.dot(dx) > maxd2){
+	rebuild = true;
+	break;
+      }
+    }
+  }
+  if(!rebuild) return;
+
+  buildNeighborList(pos);
+  neighbor_positions = pos;
+  for(int k = 0; k < 3; k++) neighbor_box[k] = boxVectors[k];
+}
+
+/* neighbor list of pairs (i,j>i) within the list radius, j increasing within each row */
+void ReferenceCalcAGBNPForceKernel::buildNeighborList(vector<RealVec>& pos){
+  RealOpenMM rlist = (useCutoff ? cutoffDistance : AGBNP_I4LOOKUP_MAXA) + neighborSkin;
+  initNeighborGrid(pos, rlist);
+  neighbor_start.resize(numParticles+1);
+  neighbor_list.clear();
+  for(int i = 0; i < numParticles; i++){
+    neighbor_start[i] = neighbor_list.size();
+    neighborRow(i, pos, rlist*rlist, nb_candidates, neighbor_list);
+  }
+  neighbor_start[numParticles] = neighbor_list.size();
+}
+
+/* bins the atoms in a cell grid with cells of the list radius. With a periodic box the
+   atoms are first wrapped into the box, and the grid is searched around each of the
+   lattice translations of an atom that can bring one of its images within the list radius
+   of an atom of the box. */
+void ReferenceCalcAGBNPForceKernel::initNeighborGrid(vector<RealVec>& pos, RealOpenMM rlist){
+  nb_grid_pos.resize(numParticles);
+  nb_shifts.clear();
+  if(!usePeriodic){
+    for(int i = 0; i < numParticles; i++) nb_grid_pos[i] = pos[i];
+    nb_shifts.push_back(RealVec(0,0,0));
+  }else{
+    for(int i = 0; i < numParticles; i++){
+      RealVec p = pos[i];
+      p -= boxVectors[2]*floor(p[2]/boxVectors[2][2]);
+      p -= boxVectors[1]*floor(p[1]/boxVectors[1][1]);
+      p -= boxVectors[0]*floor(p[0]/boxVectors[0][0]);
+      nb_grid_pos[i] = p;
+    }
+    //the wrapped atoms are within [0,a_x) x [0,b_y) x [0,c_z)
+    RealVec extent(boxVectors[0][0], boxVectors[1][1], boxVectors[2][2]);
+    for(int nc = -2; nc <= 2; nc++){
+      for(int nb = -2; nb <= 2; nb++){
+	for(int na = -2; na <= 2; na++){
+	  RealVec s = boxVectors[0]*na + boxVectors[1]*nb + boxVectors[2]*nc;
+	  if(fabs(s[0]) < extent[0] + rlist && fabs(s[1]) < extent[1] + rlist && fabs(s[2]) < extent[2] + rlist){
+	    nb_shifts.push_back(s);
+	  }
+	}
+      }
+    }
+  }
+  nb_grid_active.assign(numParticles, 1);
+  nb_grid.build(nb_grid_pos, nb_grid_active, rlist);
+}
+
+/* appends to list the atoms j > i within the list radius of atom i, in increasing order,
+   and returns their number. candidates is workspace. */
+int ReferenceCalcAGBNPForceKernel::neighborRow(int i, vector<RealVec>& pos, RealOpenMM rlist2,
+					       vector<int>& candidates, vector<int>& list){
+  int start = list.size();
+  for(int s = 0; s < (int)nb_shifts.size(); s++){
+    nb_grid.neighbors(nb_grid_pos[i] + nb_shifts[s], i, candidates);
+    for(int jj = 0; jj < (int)candidates.size(); jj++){
+      int j = candidates[jj];
+      //with no cutoff the list is used only for descreening, which excludes hydrogens
+      if(!useCutoff && ishydrogen[i] > 0 && ishydrogen[j] > 0) continue;
+      RealVec dist = pairDelta(pos[i], pos[j]);
+      if(dist.dot(dist) < rlist2) list.push_back(j);
+    }
+  }
+  //an atom may be found around more than one image
+  if(nb_shifts.size() > 1){
+    sort(list.begin() + start, list.end());
+    list.erase(unique(list.begin() + start, list.end()), list.end());
+  }
+  return list.size() - start;
+}
+
+//posj - posi, minimum image convention for a (possibly triclinic) periodic box
+RealVec ReferenceCalcAGBNPForceKernel::pairDelta(const RealVec& posi, const RealVec& posj) const {
+  RealVec dist = posj - posi;
+  if(usePeriodic){
+    dist -= boxVectors[2]*floor(dist[2]/boxVectors[2][2]+0.5);
+    dist -= boxVectors[1]*floor(dist[1]/boxVectors[1][1]+0.5);
+    dist -= boxVectors[0]*floor(dist[0]/boxVectors[0][0]+0.5);
+  }
+  return dist;
+}
+
+/* inverse Born radii and Born radii from the volume scaling factors. Each pair of
+   the neighbor list is visited once and descreens both atoms. */
+void ReferenceCalcAGBNPForceKernel::computeBornRadii(vector<RealVec>& pos){
+  RealOpenMM pifac = 1./(4.*M_PI);
+  RealOpenMM dmax = AGBNP_I4LOOKUP_MAXA;
+  if(useCutoff && cutoffDistance < dmax) dmax = cutoffDistance;
+  RealOpenMM dmax2 = dmax*dmax;
+  for(int i = 0; i < numParticles; i++){
+    inverse_born_radius[i] = 1./radii_vdw[i];
+  }
+  for(int i = 0; i < numParticles; i++){
+    for(int k = neighbor_start[i]; k < neighbor_start[i+1]; k++){
+      int j = neighbor_list[k];
+      RealVec dist = pairDelta(pos[i], pos[j]);
+      RealOpenMM d2 = dist.dot(dist);
+      if(d2 >= dmax2) continue;
+      RealOpenMM d = sqrt(d2);
+      if(ishydrogen[j] == 0){ //j descreens i
+	inverse_born_radius[i] -= pifac*volume_scaling_factor[j]*
+	  i4_table->eval(d, i4_lut->radius_type_screened[i], i4_lut->radius_type_screener[j]);
+      }
+      if(ishydrogen[i] == 0){ //i descreens j
+	inverse_born_radius[j] -= pifac*volume_scaling_factor[i]*
+	  i4_table->eval(d, i4_lut->radius_type_screened[j], i4_lut->radius_type_screener[i]);
+      }
+    }
+  }
+  setBornRadii();
+}
+
+//Born radii from the inverse Born radii, switched so that they stay finite and positive
+void ReferenceCalcAGBNPForceKernel::setBornRadii(){
+  for(int i = 0; i < numParticles; i++){
+    RealOpenMM fp;
+    born_radius[i] = 1./agbnp_swf_invbr(inverse_born_radius[i], fp);
+    inverse_born_radius_fp[i] = fp;
+  }
+}
+
+/* GB pair energy and its gradient at constant Born radii for the rows first <= i < last.
+   Accumulates the Y parameters for the Born radii gradients unless includeForces is false.
+   With a cutoff the pairs come from the neighbor list, otherwise all pairs are included. */
+RealOpenMM ReferenceCalcAGBNPForceKernel::computeGBPairEnergyRows(int first, int last, vector<RealVec>& pos, vector<RealVec>& force,
+								   RealOpenMM dielectric_factor, RealOpenMM w_egb,
+								   vector<RealOpenMM>& egb_der_Y, bool includeForces){
+  RealOpenMM pt25 = 0.25;
+  RealOpenMM cutoff2 = cutoffDistance*cutoffDistance;
+  RealOpenMM gb_pair_energy = 0.0;
+  for(int i = first; i < last; i++){
+    int nj = useCutoff ? neighbor_start[i+1] - neighbor_start[i] : numParticles - i - 1;
+    for(int k = 0; k < nj; k++){
+      int j = useCutoff ? neighbor_list[neighbor_start[i]+k] : i + 1 + k;
+      RealVec dist = pairDelta(pos[i], pos[j]);
+      RealOpenMM d2 = dist.dot(dist);
+      if(useCutoff && d2 >= cutoff2) continue;
+      RealOpenMM qqf = charge[j]*charge[i];
+      RealOpenMM qq = dielectric_factor*qqf;
+      RealOpenMM bb = born_radius[i]*born_radius[j];
+      RealOpenMM etij = exp(-pt25*d2/bb);
+      RealOpenMM fgb = 1./sqrt(d2 + bb*etij);
+      RealOpenMM egb = 2.*qq*fgb;
+      gb_pair_energy += egb;
+      if(!includeForces) continue;
+      RealOpenMM fgb3 = fgb*fgb*fgb;
+      RealOpenMM mw = -2.0*qq*(1.0-pt25*etij)*fgb3;
+      RealVec g = dist * mw;
+      force[i] += g * w_egb;
+      force[j] -= g * w_egb;
+      RealOpenMM ytij = qqf*(bb+pt25*d2)*etij*fgb3;
+      egb_der_Y[i] += ytij;
+      egb_der_Y[j] += ytij;
+    }
+  }
+  return gb_pair_energy;
+}
+
+void AGBNPGBPairTree::build(const vector<RealVec>& pos, const vector<RealOpenMM>& charge,
+			    const vector<RealOpenMM>& born_radius, int order){
+  //multi-indexes by increasing degree
+  if(term_k.size() == 0 || this->order != order){
+    this->order = order;
+    term_k.clear();
+    term_degree.clear();
+    for(int n = 0; n <= order + 1; n++){
+      if(n == order + 1) nterms = term_degree.size();
+      for(int kx = n; kx >= 0; kx--){
+	for(int ky = n - kx; ky >= 0; ky--){
+	  term_k.push_back(kx);
+	  term_k.push_back(ky);
+	  term_k.push_back(n - kx - ky);
+	  term_degree.push_back(n);
+	}
+      }
+    }
+    nterms1 = term_degree.size();
+    vector<int> index((order+3)*(order+3)*(order+3), -1);
+    for(int t = 0; t < nterms1; t++){
+      index[(term_k[3*t]*(order+3) + term_k[3*t+1])*(order+3) + term_k[3*t+2]] = t;
+    }
+    term_m1.assign(3*nterms1, -1);
+    term_m2.assign(3*nterms1, -1);
+    term_p1.assign(3*nterms1, -1);
+    for(int t = 0; t < nterms1; t++){
+      for(int i = 0; i < 3; i++){
+	int k[3] = { term_k[3*t], term_k[3*t+1], term_k[3*t+2] };
+	k[i] -= 1;
+	if(k[i] >= 0) term_m1[3*t+i] = index[(k[0]*(order+3) + k[1])*(order+3) + k[2]];
+	k[i] -= 1;
+	if(k[i] >= 0) term_m2[3*t+i] = index[(k[0]*(order+3) + k[1])*(order+3) + k[2]];
+	k[i] += 3;
+	if(term_degree[t] <= order) term_p1[3*t+i] = index[(k[0]*(order+3) + k[1])*(order+3) + k[2]];
+      }
+    }
+  }
+
+  atoms.clear();
+  nodes.clear();
+  for(int i = 0; i < (int)pos.size(); i++){
+    if(charge[i] != 0) atoms.push_back(i);
+  }
+  if(atoms.size() > 0){
+    Node root;
+    root.first = 0;
+    root.last = atoms.size();
+    root.child = -1;
+    nodes.push_back(root);
+  }
+  //as in the descreening tree, about the geometric centers of the nodes
+  for(int n = 0; n < (int)nodes.size(); n++){
+    int first = nodes[n].first, last = nodes[n].last;
+    RealVec lo = pos[atoms[first]], hi = lo;
+    RealVec c = RealVec(0,0,0);
+    RealOpenMM bmax = 0.0;
+    for(int k = first; k < last; k++){
+      int a = atoms[k];
+      for(int l = 0; l < 3; l++){
+	if(pos[a][l] < lo[l]) lo[l] = pos[a][l];
+	if(pos[a][l] > hi[l]) hi[l] = pos[a][l];
+      }
+      c += pos[a];
+      if(born_radius[a] > bmax) bmax = born_radius[a];
+    }
+    c = c*(1./(last - first));
+    RealOpenMM r2 = 0.0;
+    for(int k = first; k < last; k++){
+      RealVec dist = pos[atoms[k]] - c;
+      if(dist.dot(dist) > r2) r2 = dist.dot(dist);
+    }
+    nodes[n].center = c;
+    nodes[n].radius = sqrt(r2);
+    nodes[n].max_born_radius = bmax;
+    if(last - first <= AGBNP_TREE_LEAF_SIZE) continue;
+
+    int axis = 0;
+    for(int l = 1; l < 3; l++){
+      if(hi[l] - lo[l] > hi[axis] - lo[axis]) axis = l;
+    }
+    int mid = (first + last)/2;
+    nth_element(atoms.begin() + first, atoms.begin() + mid, atoms.begin() + last,
+		[&pos, axis](int a, int b){ return pos[a][axis] < pos[b][axis]; });
+    Node left, right;
+    left.first = first;
+    left.last = right.first = mid;
+    right.last = last;
+    left.child = right.child = -1;
+    nodes[n].child = nodes.size();
+    nodes.push_back(left);
+    nodes.push_back(right);
+  }
+  atom_pos.resize(atoms.size());
+  atom_charge.resize(atoms.size());
+  atom_born_radius.resize(atoms.size());
+  for(int k = 0; k < (int)atoms.size(); k++){
+    atom_pos[k] = pos[atoms[k]];
+    atom_charge[k] = charge[atoms[k]];
+    atom_born_radius[k] = born_radius[atoms[k]];
+  }
+  moments.assign(nodes.size()*nterms, 0.0);
+  RealOpenMM px[11], py[11], pz[11]; //order <= 10
+  for(int n = 0; n < (int)nodes.size(); n++){
+    RealOpenMM *m = &moments[n*nterms];
+    for(int k = nodes[n].first; k < nodes[n].last; k++){
+      RealVec dist = nodes[n].center - atom_pos[k];
+      px[0] = atom_charge[k];
+      py[0] = pz[0] = 1.0;
+      for(int l = 1; l <= order; l++){
+	px[l] = px[l-1]*dist[0];
+	py[l] = py[l-1]*dist[1];
+	pz[l] = pz[l-1]*dist[2];
+      }
+      for(int t = 0; t < nterms; t++){
+	m[t] += px[term_k[3*t]]*py[term_k[3*t+1]]*pz[term_k[3*t+2]];
+      }
+    }
+  }
+}
+
+RealOpenMM AGBNPGBPairTree::potential(int self, const RealVec& x, RealOpenMM bi, RealOpenMM theta, bool gradient,
+				      RealVec& grad, RealOpenMM& ysum, vector<int>& stack, vector<RealOpenMM>& b) const {
+  RealOpenMM pt25 = 0.25;
+  RealOpenMM phi = 0.0;
+  grad = RealVec(0,0,0);
+  ysum = 0.0;
+  //the GB term is within eps = theta^(order+1) of the Coulomb one when d^2 > 4*bb*log(1/eps)
+  RealOpenMM gbfar = theta > 0 ? -4.*(order + 1)*log(theta)*bi : 0.0;
+  b.resize(nterms1);
+  stack.clear();
+  if(nodes.size() > 0) stack.push_back(0);
+  while(stack.size() > 0){
+    int n = stack.back();
+    stack.pop_back();
+    const Node& node = nodes[n];
+    RealVec r = x - node.center;
+    RealOpenMM d2 = r.dot(r);
+    RealOpenMM d = sqrt(d2);
+    RealOpenMM dfar = d - node.radius;
+    if(node.radius < theta*d && dfar*dfar > gbfar*node.max_born_radius){
+      /* Taylor coefficients b_k = D^k(1/|r|)/k! from the recurrence
+	 |k| r^2 b_k + (2|k|-1) sum_i r_i b_{k-e_i} + (|k|-1) sum_i b_{k-2e_i} = 0,
+	 the potential is sum_k b_k M_k and its gradient sum_k M_k (k_i+1) b_{k+e_i} */
+      int nt = gradient ? nterms1 : nterms;
+      b[0] = 1./d;
+      for(int t = 1; t < nt; t++){
+	int deg = term_degree[t];
+	RealOpenMM s1 = 0.0, s2 = 0.0;
+	for(int i = 0; i < 3; i++){
+	  if(term_m1[3*t+i] >= 0) s1 += r[i]*b[term_m1[3*t+i]];
+	  if(term_m2[3*t+i] >= 0) s2 += b[term_m2[3*t+i]];
+	}
+	b[t] = -((2*deg - 1)*s1 + (deg - 1)*s2)/(deg*d2);
+      }
+      const RealOpenMM *m = &moments[n*nterms];
+      for(int t = 0; t < nterms; t++){
+	phi += b[t]*m[t];
+	if(!gradient) continue;
+	for(int i = 0; i < 3; i++){
+	  grad[i] += m[t]*(term_k[3*t+i] + 1)*b[term_p1[3*t+i]];
+	}
+      }
+    }else if(node.child < 0){
+      for(int k = node.first; k < node.last; k++){
+	if(atoms[k] == self) continue;
+	RealVec dist = atom_pos[k] - x;
+	RealOpenMM dd2 = dist.dot(dist);
+	RealOpenMM bb = bi*atom_born_radius[k];
+	RealOpenMM etij = exp(-pt25*dd2/bb);
+	RealOpenMM fgb = 1./sqrt(dd2 + bb*etij);
+	phi += atom_charge[k]*fgb;
+	if(!gradient) continue;
+	RealOpenMM fgb3 = fgb*fgb*fgb;
+	grad += dist*(atom_charge[k]*(1.0-pt25*etij)*fgb3);
+	ysum += atom_charge[k]*(bb+pt25*dd2)*etij*fgb3;
+      }
+    }else{
+      stack.push_back(node.child);
+      stack.push_back(node.child + 1);
+    }
+  }
+  return phi;
+}
+
+/* GB pair energy without cutoff with the treecode. Each atom collects the GB terms of all the
+   other atoms, its gradient and its Y parameter, so the atoms are independent and are split
+   among the threads; every pair is seen from both atoms and the energy is half of the sum. */
+RealOpenMM ReferenceCalcAGBNPForceKernel::computeGBPairEnergyTreecode(vector<RealVec>& pos, vector<RealVec>& force,
+								       RealOpenMM dielectric_factor, RealOpenMM w_egb,
+								       vector<RealOpenMM>& egb_der_Y, bool includeForces){
+  gb_tree.build(pos, charge, born_radius, gb_treecode_order);
+  int nt = numThreads < numParticles ? numThreads : 1;
+  tree_stack.resize(nt);
+  gb_tree_b.resize(nt);
+  thread_energy.resize(nt);
+  auto gbpair = [this, nt, &pos, &force, &egb_der_Y, dielectric_factor, w_egb, includeForces](int t){
+    int first = (long)t*numParticles/nt;
+    int last = (long)(t+1)*numParticles/nt;
+    RealVec grad;
+    RealOpenMM ysum;
+    thread_energy[t] = 0.0;
+    for(int i = first; i < last; i++){
+      if(charge[i] == 0) continue;
+      RealOpenMM phi = gb_tree.potential(i, pos[i], born_radius[i], gb_treecode_theta, includeForces,
+					 grad, ysum, tree_stack[t], gb_tree_b[t]);
+      thread_energy[t] += dielectric_factor*charge[i]*phi;
+      if(!includeForces) continue;
+      force[i] -= grad*(2.*dielectric_factor*charge[i]*w_egb);
+      egb_der_Y[i] += charge[i]*ysum;
+    }
+  };
+  pool.run(nt, gbpair);
+  RealOpenMM gb_pair_energy = 0.0;
+  for(int t = 0; t < nt; t++) gb_pair_energy += thread_energy[t];
+
+  return gb_pair_energy;
+}
+
+/* GB pair energy over all rows. With more than one thread the rows are split in blocks
+   with about the same number of pairs, each thread accumulates into its own force and Y
+   buffers, and the buffers are then reduced in thread order. */
+RealOpenMM ReferenceCalcAGBNPForceKernel::computeGBPairEnergy(vector<RealVec>& pos, vector<RealVec>& force,
+							      RealOpenMM dielectric_factor, RealOpenMM w_egb,
+							      vector<RealOpenMM>& egb_der_Y, bool includeForces){
+  if(useGBPairTreecode()){
+    return computeGBPairEnergyTreecode(pos, force, dielectric_factor, w_egb, egb_der_Y, includeForces);
+  }
+  int nt = numThreads < numParticles ? numThreads : 1;
+  if(nt <= 1){
+    return computeGBPairEnergyRows(0, numParticles, pos, force, dielectric_factor, w_egb, egb_der_Y, includeForces);
+  }
+
+  //row blocks with about the same number of pairs
+  long total = useCutoff ? neighbor_start[numParticles] : (long)numParticles*(numParticles-1)/2;
+  vector<int>& block = gb_row_block;
+  block.resize(nt+1);
+  block[0] = 0;
+  long sum = 0;
+  int t = 1;
+  for(int i = 0; i < numParticles && t < nt; i++){
+    sum += useCutoff ? neighbor_start[i+1] - neighbor_start[i] : numParticles - i - 1;
+    if(sum*nt >= total*t) block[t++] = i+1;
+  }
+  while(t <= nt) block[t++] = numParticles;
+
+  thread_force.resize(nt);
+  thread_Y.resize(nt);
+  thread_energy.resize(nt);
+  RealVec zero3 = RealVec(0,0,0);
+  pool.run(nt, [this, &block, &pos, dielectric_factor, w_egb, zero3, includeForces](int t){
+      if(includeForces){
+	thread_force[t].assign(numParticles, zero3);
+	thread_Y[t].assign(numParticles, 0.0);
+      }
+      thread_energy[t] = computeGBPairEnergyRows(block[t], block[t+1], pos, thread_force[t],
+						 dielectric_factor, w_egb, thread_Y[t], includeForces);
+    });
+
+  RealOpenMM gb_pair_energy = 0.0;
+  for(int t = 0; t < nt; t++){
+    gb_pair_energy += thread_energy[t];
+    if(!includeForces) continue;
+    for(int i = 0; i < numParticles; i++){
+      force[i] += thread_force[t][i];
+      egb_der_Y[i] += thread_Y[t][i];
+    }
+  }
+  return gb_pair_energy;
+}
+
+/* components of the gradients of the van der Waals and GB energies due to the variations
+   of the Born radii with positions at constant self volumes. Also accumulates the W's and U's
+   for the self-volume components of the gradients. */
+void ReferenceCalcAGBNPForceKernel::computeBornRadiiDerivatives(vector<RealVec>& pos, vector<RealVec>& force,
+								 vector<RealOpenMM>& evdw_der_brw, vector<RealOpenMM>& egb_der_bru,
+								 RealOpenMM w_vdw, RealOpenMM w_egb,
+								 vector<RealOpenMM>& evdw_der_W, vector<RealOpenMM>& egb_der_U){
+  RealOpenMM dmax = AGBNP_I4LOOKUP_MAXA;
+  if(useCutoff && cutoffDistance < dmax) dmax = cutoffDistance;
+  RealOpenMM dmax2 = dmax*dmax;
+  for(int i = 0; i < numParticles; i++){
+    evdw_der_W[i] = egb_der_U[i] = 0.0;
+  }
+  for(int i = 0; i < numParticles; i++){
+    for(int k = neighbor_start[i]; k < neighbor_start[i+1]; k++){
+      int j = neighbor_list[k];
+      RealVec dist = pairDelta(pos[i], pos[j]);
+      RealOpenMM d2 = dist.dot(dist);
+      if(d2 >= dmax2) continue;
+      RealOpenMM d = sqrt(d2);
+      if(ishydrogen[j] == 0){
+	// Qji: j descreens i
+	int rad_typei = i4_lut->radius_type_screened[i];
+	int rad_typej = i4_lut->radius_type_screener[j];
+	double Qji, dQji;
+	i4_table->evalboth(d, rad_typei, rad_typej, Qji, dQji);
+	evdw_der_W[j] += evdw_der_brw[i]*Qji;
+	egb_der_U[j] += egb_der_bru[i]*Qji;
+	RealVec w = dist * ((w_vdw*evdw_der_brw[i] + w_egb*egb_der_bru[i])*volume_scaling_factor[j]*dQji/d);
+	force[i] += w;
+	force[j] -= w;
+      }
+      if(ishydrogen[i] == 0){
+	// Qij: i descreens j
+	int rad_typej = i4_lut->radius_type_screened[j];
+	int rad_typei = i4_lut->radius_type_screener[i];
+	double Qij, dQij;
+	i4_table->evalboth(d, rad_typej, rad_typei, Qij, dQij);
+	evdw_der_W[i] += evdw_der_brw[j]*Qij;
+	egb_der_U[i] += egb_der_bru[j]*Qij;
+	RealVec w = dist * ((w_vdw*evdw_der_brw[j] + w_egb*egb_der_bru[j])*volume_scaling_factor[i]*dQij/d);
+	force[i] += w;
+	force[j] -= w;
+      }
+    }
+  }
+}
+
 double ReferenceCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool includeForces, bool includeEnergy) {
 
   //sequence: volume1->volume2
@@ -163,9 +756,6 @@ double ReferenceCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool i
     int verbose_level = 0;
     int init = 0; 
 
-    vector<RealOpenMM> nu(numParticles);
-
-
     if(verbose_level > 0) cout << "Executing GVolSA" << endl;
     
     if(verbose_level > 0){
@@ -173,92 +763,26 @@ double ReferenceCalcAGBNPForceKernel::executeGVolSA(ContextImpl& context, bool i
     } 
 
     
-    // volume energy function 1 (large radii)
-    RealOpenMM volume1, vol_energy1;
+    // volume energy functions 1 (large radii) and 2 (small radii)
+    computeVolumes(pos);
 
-    gvol->setRadii(radii_large);
-
-    vector<RealOpenMM> volumes_large(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      volumes_large[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_large[i],3)/3.;
-    }
-    gvol->setVolumes(volumes_large);
-    
-    for(int i = 0; i < numParticles; i++){
-      nu[i] = gammas[i]/roffset;
-    }
-    gvol->setGammas(nu);
-    
-    gvol->compute_tree(pos);
-    gvol->compute_volume(pos, volume1, vol_energy1, vol_force, vol_dv, free_volume, self_volume);
-      
+    RealOpenMM vol_energy1 = ch_energy[0];
     //returns energy and gradients from volume energy function
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol;
+    if(includeForces){
+      for(int i = 0; i < numParticles; i++){
+	force[i] += ch_force[0][i] * w_evol;
+      }
     }
     energy += vol_energy1 * w_evol;
     if(verbose_level > 0){
       cout << "Volume energy 1: " << vol_energy1 << endl;
     }
 
-#ifdef NOTNOW
-    //test of vol_dv
-    vector<RealOpenMM> vol_dv2(numParticles);
-    double energy_save = vol_energy1;
-    for(int test_atom = 0; test_atom < numParticles; test_atom++){
-      if(ishydrogen[test_atom]>0) continue;
-      double deltav = -0.001*volumes_large[test_atom];
-      double save_vol = volumes_large[test_atom];
-      volumes_large[test_atom] += deltav;
-      gvol->setVolumes(volumes_large);
-      gvol->compute_tree(pos);
-      gvol->compute_volume(pos, volume1, vol_energy1, vol_force, vol_dv2, free_volume, self_volume);
-      cout << "DVV " << test_atom << " " << vol_energy1 - energy_save << " " << deltav*vol_dv[test_atom] << endl;
-      volumes_large[test_atom] = save_vol;
-    }
-#endif
-    
-    // volume energy function 2 (small radii)
-    RealOpenMM vol_energy2, volume2;
-
-    gvol->setRadii(radii_vdw);
-
-    vector<RealOpenMM> volumes_vdw(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      volumes_vdw[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_vdw[i],3)/3.;
-    }
-    gvol->setVolumes(volumes_vdw);
-    
-    for(int i = 0; i < numParticles; i++){
-      nu[i] = -gammas[i]/roffset;
-    }
-    gvol->setGammas(nu);
-
-    gvol->rescan_tree_volumes(pos);
-    gvol->compute_volume(pos, volume2, vol_energy2, vol_force, vol_dv, free_volume, self_volume);
-
-
- #ifdef NOTNOW
-    //test of vol_dv
-    vector<RealOpenMM> vol_dv2(numParticles);
-    double energy_save = vol_energy2;
-    for(int test_atom = 0; test_atom < numParticles; test_atom++){
-      if(ishydrogen[test_atom]>0) continue;
-      double deltav = -0.001*volumes_vdw[test_atom];
-      double save_vol = volumes_vdw[test_atom];
-      volumes_vdw[test_atom] += deltav;
-      gvol->setVolumes(volumes_vdw);
-      gvol->compute_tree(pos);
-      gvol->compute_volume(pos, volume2, vol_energy2, vol_force, vol_dv2, free_volume, self_volume);
-      cout << "DVV " << test_atom << " " << vol_energy2 - energy_save << " " << deltav*vol_dv[test_atom] << endl;
-      volumes_vdw[test_atom] = save_vol;
-    }
-#endif
-
-
-    
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol;
+    RealOpenMM vol_energy2 = ch_energy[1];
+    if(includeForces){
+      for(int i = 0; i < numParticles; i++){
+	force[i] += ch_force[1][i] * w_evol;
+      }
     }
     energy += vol_energy2 * w_evol;
     if(verbose_level > 0){
@@ -287,29 +811,13 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
       cout << "-----------------------------------------------" << endl;
     } 
     
-    // volume energy function 1 (large radii)
-    RealOpenMM volume1, vol_energy1;
-
-    gvol->setRadii(radii_large);
-    
-    vector<RealOpenMM> nu(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      nu[i] = gammas[i]/roffset;
-    }
-    gvol->setGammas(nu);
-    
-    vector<RealOpenMM> volumes_large(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      volumes_large[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_large[i],3)/3.;
-    }
-    gvol->setVolumes(volumes_large);
-    
-    gvol->compute_tree(pos);
+    // volume energy functions 1 (large radii) and 2 (small radii)
+    computeVolumes(pos);
     if(verbose_level > 4){
       gvol->print_tree();
     }
-    gvol->compute_volume(pos, volume1, vol_energy1, vol_force, vol_dv, free_volume, self_volume);
 
+    RealOpenMM vol_energy1 = ch_energy[0];
 
     if(verbose_level > 0){
       vector<int> noverlaps(numParticles);
@@ -327,14 +835,16 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
 
     if(verbose_level > 0){
       for(int i = 0; i < numParticles; i++){
-	cout << "FrcEV1 : " << i << " " << vol_force[i][0] << " " << vol_force[i][1] << " " << vol_force[i][2] << endl;
+	cout << "FrcEV1 : " << i << " " << ch_force[0][i][0] << " " << ch_force[0][i][1] << " " << ch_force[0][i][2] << endl;
       }
     }
 
     
     //returns energy and gradients from volume energy function
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol;
+    if(includeForces){
+      for(int i = 0; i < numParticles; i++){
+	force[i] += ch_force[0][i] * w_evol;
+      }
     }
     energy += vol_energy1 * w_evol;
     if(verbose_level > 0){
@@ -344,38 +854,22 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     double tot_vol = 0;
     double vol_energy = 0;
     for(int i = 0; i < numParticles; i++){
-      tot_vol += self_volume[i];
-      vol_energy += nu[i]*self_volume[i];
+      tot_vol += ch_self_volume[0][i];
+      vol_energy += ch_gammas[0][i]*ch_self_volume[0][i];
     }
     if(verbose_level > 0){
       cout << "Volume from self volumes(1): " << tot_vol << endl;
       cout << "Volume energy from self volumes(1): " << vol_energy << endl;
     }
 
-
-
-    
-    // volume energy function 2 (small radii)
-    RealOpenMM vol_energy2, volume2;
-
-    gvol->setRadii(radii_vdw);
-    
-    for(int i = 0; i < numParticles; i++){
-      nu[i] = -gammas[i]/roffset;
-    }
-    gvol->setGammas(nu);
-    
-    vector<RealOpenMM> volumes_vdw(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      volumes_vdw[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_vdw[i],3)/3.;
-    }
-    gvol->setVolumes(volumes_vdw);
-
-    gvol->rescan_tree_volumes(pos);
-    gvol->compute_volume(pos, volume2, vol_energy2, vol_force, vol_dv, free_volume, self_volume);
+    RealOpenMM vol_energy2 = ch_energy[1];
+    free_volume = ch_free_volume[1];
+    self_volume = ch_self_volume[1];
     
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol;
+    if(includeForces){
+      for(int i = 0; i < numParticles; i++){
+	force[i] += ch_force[1][i] * w_evol;
+      }
     }
     energy += vol_energy2 * w_evol;
     if(verbose_level > 0){
@@ -385,7 +879,7 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
 
     if(verbose_level > 0){
       for(int i = 0; i < numParticles; i++){
-	cout << "FrcEV2 : " << i << " " << vol_force[i][0] << " " << vol_force[i][1] << " " << vol_force[i][2] << endl;
+	cout << "FrcEV2 : " << i << " " << ch_force[1][i][0] << " " << ch_force[1][i][1] << " " << ch_force[1][i][2] << endl;
       }
     }
     
@@ -420,9 +914,7 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     //volume scaling factors from self volumes (with small radii)
     tot_vol = 0;
     for(int i = 0; i < numParticles; i++){
-      RealOpenMM rad = radii_vdw[i];
-      RealOpenMM vol = (4./3.)*M_PI*rad*rad*rad;
-      volume_scaling_factor[i] = self_volume[i]/vol;
+      volume_scaling_factor[i] = self_volume[i]/vdw_volume[i];
       if(verbose_level > 3){
 	cout << "SV " << i << " " << self_volume[i] << endl;
       }
@@ -434,24 +926,9 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
 
     RealOpenMM pifac = 1./(4.*M_PI);
 
-    //compute inverse Born radii, prototype, no cutoff
-    for(int i = 0; i < numParticles; i++){
-      inverse_born_radius[i] = 1./radii_vdw[i];
-      for(int j = 0; j < numParticles; j++){
-	if(i == j) continue;
-	if(ishydrogen[j] > 0) continue;
-	RealVec dist = pos[j] - pos[i];
-	RealOpenMM d = sqrt(dist.dot(dist));
-	if(d < AGBNP_I4LOOKUP_MAXA){
-	  int rad_typei = i4_lut->radius_type_screened[i];
-	  int rad_typej = i4_lut->radius_type_screener[j];
-	  inverse_born_radius[i] -= pifac*volume_scaling_factor[j]*i4_lut->eval(d, rad_typei, rad_typej);
-	}	
-      }
-      RealOpenMM fp;
-      born_radius[i] = 1./agbnp_swf_invbr(inverse_born_radius[i], fp);
-      inverse_born_radius_fp[i] = fp;
-    }
+    //compute inverse Born radii over the neighbor list
+    updateNeighborList(context, pos);
+    computeBornRadii(pos);
 
     if(verbose_level > 3){
       cout << "Born radii:" << endl;
@@ -467,35 +944,14 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     RealOpenMM tokjmol = 4.184*332.0/10.0; //the factor of 10 is the conversion of 1/r from nm to Ang
     RealOpenMM dielectric_factor = tokjmol*(-0.5)*(1./dielectric_in - 1./dielectric_out);
     RealOpenMM pt25 = 0.25;
-    vector<RealOpenMM> egb_der_Y(numParticles);
     for(int i = 0; i < numParticles; i++){
       egb_der_Y[i] = 0.0;
     }
     RealOpenMM gb_self_energy = 0.0;
-    RealOpenMM gb_pair_energy = 0.0;
     for(int i = 0; i < numParticles; i++){
-      double uself = dielectric_factor*charge[i]*charge[i]/born_radius[i];
-      gb_self_energy += uself;
-      for(int j = i+1; j < numParticles; j++){
-	RealVec dist = pos[j] - pos[i];
-	RealOpenMM d2 = dist.dot(dist);
-	RealOpenMM qqf = charge[j]*charge[i];
-	RealOpenMM qq = dielectric_factor*qqf;
-	RealOpenMM bb = born_radius[i]*born_radius[j];
-	RealOpenMM etij = exp(-pt25*d2/bb);
-	RealOpenMM fgb = 1./sqrt(d2 + bb*etij);
-	RealOpenMM egb = 2.*qq*fgb;
-	gb_pair_energy += egb;
-	RealOpenMM fgb3 = fgb*fgb*fgb;
-	RealOpenMM mw = -2.0*qq*(1.0-pt25*etij)*fgb3;
-	RealVec g = dist * mw;
-	force[i] += g * w_egb;
-	force[j] -= g * w_egb;
-	RealOpenMM ytij = qqf*(bb+pt25*d2)*etij*fgb3;
-	egb_der_Y[i] += ytij;
-	egb_der_Y[j] += ytij;
-      }
+      gb_self_energy += dielectric_factor*charge[i]*charge[i]/born_radius[i];
     }
+    RealOpenMM gb_pair_energy = computeGBPairEnergy(pos, force, dielectric_factor, w_egb, egb_der_Y, includeForces);
     if(verbose_level > 0){
       cout << "GB self energy: " << gb_self_energy << endl;
       cout << "GB pair energy: " << gb_pair_energy << endl;
@@ -520,8 +976,10 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     }
     energy += w_vdw*evdw;
 
+    //the rest computes the gradients only
+    if(!includeForces) return (double)energy;
+
     //compute atom-level property for the calculation of the gradients of Evdw and Egb
-    vector<RealOpenMM> evdw_der_brw(numParticles);
     for(int i = 0; i < numParticles; i++){
       RealOpenMM br = born_radius[i];
       evdw_der_brw[i] = -pifac*3.*vdw_alpha[i]*br*br*inverse_born_radius_fp[i]/pow(br+AGBNP_HB_RADIUS,4);
@@ -534,7 +992,6 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     }
 
     
-    vector<RealOpenMM> egb_der_bru(numParticles);
     for(int i = 0; i < numParticles; i++){
       RealOpenMM br = born_radius[i];
       RealOpenMM qi = charge[i];
@@ -552,45 +1009,14 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     //compute the component of the gradients of the van der Waals and GB energies due to
     //variations of Born radii
     //also accumulates W's and U's for self-volume components of the gradients later
-    vector<RealOpenMM> evdw_der_W(numParticles);
-    vector<RealOpenMM> egb_der_U(numParticles);
-    for(int i = 0; i < numParticles; i++){
-      evdw_der_W[i] = egb_der_U[i] = 0.0;
-    }
-    for(int i = 0; i < numParticles; i++){
-      for(int j = 0; j < numParticles; j++){
-	if(i == j) continue;
-	if(ishydrogen[j]>0) continue;
-	RealVec dist = pos[j] - pos[i];
-	RealOpenMM d = sqrt(dist.dot(dist));
-	double Qji = 0.0, dQji = 0.0;
-	// Qji: j descreens i
-	if(d < AGBNP_I4LOOKUP_MAXA){
-	  int rad_typei = i4_lut->radius_type_screened[i];
-	  int rad_typej = i4_lut->radius_type_screener[j];
-	  Qji = i4_lut->eval(d, rad_typei, rad_typej); 
-	  dQji = i4_lut->evalderiv(d, rad_typei, rad_typej); 
-	}
-	RealVec w;
-	//van der Waals stuff
-	evdw_der_W[j] += evdw_der_brw[i]*Qji;
-	w = dist * evdw_der_brw[i]*volume_scaling_factor[j]*dQji/d;
-	force[i] += w * w_vdw;
-	force[j] -= w * w_vdw;
-	//GB stuff
-	egb_der_U[j] += egb_der_bru[i]*Qji;
-	w = dist * egb_der_bru[i]*volume_scaling_factor[j]*dQji/d;
-	force[i] += w * w_egb;
-	force[j] -= w * w_egb;
-      }
-    }
+    computeBornRadiiDerivatives(pos, force, evdw_der_brw, egb_der_bru, w_vdw, w_egb, evdw_der_W, egb_der_U);
 
     
 
     if(verbose_level > 3){
       cout << "U parameters: " << endl;
       for(int i = 0; i < numParticles; i++){
-	RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
+	RealOpenMM vol = vdw_volume[i];
 	cout << "U: " << i << " " << egb_der_U[i]/vol << endl;      
       }
     }
@@ -598,7 +1024,7 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
     if(verbose_level > 3){
       cout << "W parameters: " << endl;
       for(int i = 0; i < numParticles; i++){
-	RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
+	RealOpenMM vol = vdw_volume[i];
 	cout << "W: " << i << " " << evdw_der_W[i]/vol << endl;      
       }
     }
@@ -711,44 +1137,27 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP1(ContextImpl& context, bool i
       }
     }
 	  
-    RealOpenMM volume_tmp, vol_energy_tmp;
-    //set up the parameters of the pseudo-volume energy function and
-    //compute the component of the gradient of Evdw due to the variations
-    //of self volumes
-    for(int i = 0; i < numParticles; i++){
-      RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-      nu[i] = evdw_der_W[i]/vol;
-    }
-    gvol->setGammas(nu);
-    gvol->rescan_tree_gammas();
-    gvol->compute_volume(pos, volume_tmp, vol_energy_tmp, vol_force, vol_dv, free_volume, self_volume);
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_vdw;
-    }
-
-    if(verbose_level > 0){
-      for(int i = 0; i < numParticles; i++){
-	forceGBV[i] += vol_force[i] * w_vdw;
-      }
-    }
-    
-    //set up the parameters of the pseudo-volume energy function and
-    //compute the component of the gradient of Egb due to the variations
-    //of self volumes
+    //set up the parameters of the pseudo-volume energy functions and
+    //compute the components of the gradients of Evdw (channel 0) and Egb (channel 1)
+    //due to the variations of self volumes
+    ch_radii[0] = radii_vdw;
+    ch_volumes[0] = ch_volumes[1];
     for(int i = 0; i < numParticles; i++){
-      RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-      nu[i] = egb_der_U[i]/vol;
+      RealOpenMM vol = vdw_volume[i];
+      ch_gammas[0][i] = evdw_der_W[i]/vol;
+      ch_gammas[1][i] = egb_der_U[i]/vol;
     }
-    gvol->setGammas(nu);
-    gvol->rescan_tree_gammas();
-    gvol->compute_volume(pos, volume_tmp, vol_energy_tmp, vol_force, vol_dv, free_volume, self_volume);
+    gvol->compute_volume_channels(pos, ch_radii, ch_volumes, ch_gammas,
+				  ch_volume, ch_energy, ch_force, ch_dv, ch_free_volume, ch_self_volume);
     for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_egb;
+      force[i] += ch_force[0][i] * w_vdw;
+      force[i] += ch_force[1][i] * w_egb;
     }
 
     if(verbose_level > 0){
       for(int i = 0; i < numParticles; i++){
-	forceGBV[i] += vol_force[i] * w_vdw;
+	forceGBV[i] += ch_force[0][i] * w_vdw;
+	forceGBV[i] += ch_force[1][i] * w_vdw;
       }
     }
 
@@ -810,31 +1219,20 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   } 
 
 
-  // volume energy function 1 (large radii)
-  RealOpenMM volume1, vol_energy1;
-
-  gvol->setRadii(radii_large);
-  
-  vector<RealOpenMM> nu(numParticles);
-  for(int i = 0; i < numParticles; i++) {
-    nu[i] = gammas[i]/roffset;
-  }
-  gvol->setGammas(nu);
-
-  vector<RealOpenMM> volumes_large(numParticles);
-  for(int i = 0; i < numParticles; i++){
-    volumes_large[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_large[i],3)/3.;
-  }
-  gvol->setVolumes(volumes_large);
-  
-  gvol->compute_tree(pos);
+  // volume energy functions 1 (large radii) and 2 (small radii)
+  computeVolumes(pos);
   if(verbose_level > 4){
     gvol->print_tree();
   }
-  gvol->compute_volume(pos, volume1, vol_energy1, vol_force, vol_dv, free_volume_large, self_volume_large);
+
+  RealOpenMM volume1 = ch_volume[0], vol_energy1 = ch_energy[0];
+  free_volume_large = ch_free_volume[0];
+  self_volume_large = ch_self_volume[0];
   energy += w_evol * vol_energy1;
-  for(int i = 0; i < numParticles; i++){
-    force[i] += vol_force[i] * w_evol;
+  if(includeForces){
+    for(int i = 0; i < numParticles; i++){
+      force[i] += ch_force[0][i] * w_evol;
+    }
   }
 
   if(verbose_level > 0){
@@ -850,27 +1248,16 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   }
 
 
-  // volume energy function 2 (small radii)
-  RealOpenMM vol_energy2, volume2;
-  
-  gvol->setRadii(radii_vdw);
-  
-  for(int i = 0; i < numParticles; i++){
-    nu[i] = -gammas[i]/roffset;
-  }
-  gvol->setGammas(nu);
-  
-  vector<RealOpenMM> volumes_vdw(numParticles);
-  for(int i = 0; i < numParticles; i++){
-    volumes_vdw[i] = ishydrogen[i]>0 ? 0.0 : 4.*M_PI*pow(radii_vdw[i],3)/3.;
-  }
-  gvol->setVolumes(volumes_vdw);
-  
-  gvol->rescan_tree_volumes(pos);
-  gvol->compute_volume(pos, volume2, vol_energy2, vol_force, vol_dv, free_volume_vdw, self_volume_vdw);
+  RealOpenMM volume2 = ch_volume[1], vol_energy2 = ch_energy[1];
+  free_volume_vdw = ch_free_volume[1];
+  self_volume_vdw = ch_self_volume[1];
+  vol_force = ch_force[1];
+  vol_dv = ch_dv[1];
   
-  for(int i = 0; i < numParticles; i++){
-    force[i] += vol_force[i] * w_evol;
+  if(includeForces){
+    for(int i = 0; i < numParticles; i++){
+      force[i] += vol_force[i] * w_evol;
+    }
   }
   energy += vol_energy2 * w_evol;
   if(verbose_level > 0){
@@ -893,15 +1280,40 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
 
   
   //constructs molecular surface particles (small radii only)
-  vector<MSParticle> msparticles1;
+  msparticles1.clear();
   double radw = solvent_radius;
   double volw = 4.*M_PI*pow(radw,3)/3.;
   double vol_coeff = 0.17;
   int nms = 0;
+  //the MS volume of a pair grows with the radii of the atoms: pairs with the largest radius
+  //farther apart than ms_range have volms below VOLMINMSA and do not make an MS particle
+  double radmax = 0.;
+  for(int i = 0; i < numParticles; i++){
+    if(ishydrogen[i] == 0 && radii_vdw[i] > radmax) radmax = radii_vdw[i];
+  }
+  double qmax = radmax/radw;
+  double volms0max = vol_coeff*qmax*qmax*volw;
+  double ms_range = 2.*radmax + 0.5*radw;
+  if(volms0max > VOLMINMSA){
+    ms_range += 0.5*sqrt(qmax)*radw*sqrt(2.*log(volms0max/VOLMINMSA));
+  }
+  ms_range *= 1.001;
+  //candidate pairs (i,j>i) from the cell grid of the overlap tree, if its cells are large enough,
+  //otherwise from a grid of the heavy atoms built here. Each list of candidates is in increasing
+  //order so that the MS particles are in the same order as from the loop over all pairs.
+  GCellGrid *grid = gvol->getAtomGrid(ms_range);
+  if(!grid){
+    ms_grid_active.resize(numParticles);
+    for(int i = 0; i < numParticles; i++) ms_grid_active[i] = ishydrogen[i]>0 ? 0 : 1;
+    ms_grid.build(pos, ms_grid_active, ms_range);
+    grid = &ms_grid;
+  }
   for(int i = 0; i < numParticles; i++){
     if(ishydrogen[i]>0) continue;
     double rad1 = radii_vdw[i];
-    for(int j = i + 1; j < numParticles; j++){
+    grid->neighbors(pos[i], i, ms_candidates);
+    for(int jj = 0; jj < ms_candidates.size(); jj++){
+      int j = ms_candidates[jj];
       if(ishydrogen[j]>0) continue;
       double rad2 = radii_vdw[j];
       double q = sqrt(rad1*rad2)/radw;
@@ -1012,39 +1424,52 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   
   //obtain free volumes of ms spheres by summing over atoms scaled by their self volumes
   //saves into new list those with non-zero volume
-  vector<MSParticle> msparticles2;
+  msparticles2.clear();
   double ams = KFC/(radw*radw);
   GaussianVca gms, gatom, g12;
+  //each MS sphere visits only the atoms within the reach of its overlaps, found from a cell grid
+  //of the heavy atoms with self volume, and the large and vdW self volumes are done in the same pass.
+  //Candidates are in increasing order, as in the loop over all atoms, and the overlaps of the
+  //others are below VOLMINA and contribute nothing.
+  double vmax_ms = 0., vmax_atom = 0., amin_atom = 0.;
+  for(int ims = 0; ims < msparticles1.size() ; ims++){
+    if(msparticles1[ims].vol > vmax_ms) vmax_ms = msparticles1[ims].vol;
+  }
+  ms_grid_active.resize(numParticles);
+  for(int i = 0; i < numParticles; i++){
+    ms_grid_active[i] = 0;
+    if(ishydrogen[i]>0) continue;
+    RealOpenMM vmax = max(self_volume_large[i], self_volume_vdw[i]);
+    if(vmax <= 0) continue;
+    ms_grid_active[i] = 1;
+    if(vmax > vmax_atom) vmax_atom = vmax;
+    RealOpenMM amin = min(a_large[i], a_vdw[i]);
+    if(amin_atom == 0. || amin < amin_atom) amin_atom = amin;
+  }
+  if(msparticles1.size() > 0){
+    ms_grid.build(pos, ms_grid_active, ogauss_reach(vmax_ms, ams, vmax_atom, amin_atom));
+  }
   for(int ims = 0; ims < msparticles1.size() ; ims++){
-    gms.a = ams;
-    gms.v = msparticles1[ims].vol;
-    gms.c = msparticles1[ims].pos;
+    RealVec posms = msparticles1[ims].pos;
+    RealOpenMM volms = msparticles1[ims].vol;
     int parent1 = msparticles1[ims].parent1;
     int parent2 = msparticles1[ims].parent2;
-    RealOpenMM freevolms_large = msparticles1[ims].vol;
-    RealOpenMM freevolms_vdw = msparticles1[ims].vol;
+    RealOpenMM freevolms_large = volms;
+    RealOpenMM freevolms_vdw = volms;
     double G0m_large = 0;
     double G0m_vdw = 0;
-    for(int i=0;i<numParticles;i++){
-      if(ishydrogen[i]>0) continue;
+    ms_grid.neighbors(posms, -1, ms_candidates);
+    for(int k = 0; k < ms_candidates.size(); k++){
+      int i = ms_candidates[k];
       if(i == parent1 || i == parent2) continue;
-      RealOpenMM rad = radii_large[i];
-      RealOpenMM ai = KFC/(rad*rad);
-      RealOpenMM voli = self_volume_large[i];
-      gatom.a = ai;
-      gatom.v = voli;
-      gatom.c = pos[i];
-      RealOpenMM dVdr, dVdV, sfp;
-      freevolms_large -= ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
-      G0m_large += sfp*g12.v;
+      RealVec dist = pos[i] - posms;
+      RealOpenMM d2 = dist.dot(dist);
+      RealOpenMM gvol, sfp;
+      freevolms_large -= ogauss_d2<GaussVolDoublePrecision>(volms, ams, self_volume_large[i], a_large[i], d2, gvol, sfp);
+      G0m_large += sfp*gvol;
       //repeat with vdw self volume
-      rad = radii_vdw[i];
-      ai = KFC/(rad*rad);
-      voli =  self_volume_vdw[i];
-      gatom.a = ai;
-      gatom.v = voli;
-      freevolms_vdw -= ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
-      G0m_vdw += sfp*g12.v;
+      freevolms_vdw -= ogauss_d2<GaussVolDoublePrecision>(volms, ams, self_volume_vdw[i], a_vdw[i], d2, gvol, sfp);
+      G0m_vdw += sfp*gvol;
     }
     if(freevolms_large > VOLMINMSA || freevolms_vdw > VOLMINMSA){
       MSParticle msp;
@@ -1089,15 +1514,15 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   
   //MS Vdw radii
   int num_ms = msparticles2.size();
-  vector<RealOpenMM> radii_ms(num_ms);
-  vector<RealOpenMM> volumes_ms(num_ms);
-  vector<RealOpenMM> gammas_ms(num_ms);  
-  vector<int> ishydrogen_ms(num_ms);
-  vector<RealVec> pos_ms(num_ms);
-  GaussVol *gvolms;
-  vector<RealVec> forces_ms(num_ms);
-  vector<RealOpenMM> vol_dv_ms(num_ms), freevols_ms(num_ms), selfvols_ms(num_ms);
-  vector<double> numsder(numParticles);
+  radii_ms.resize(num_ms);
+  volumes_ms.resize(num_ms);
+  gammas_ms.resize(num_ms);
+  ishydrogen_ms.resize(num_ms);
+  pos_ms.resize(num_ms);
+  forces_ms.resize(num_ms);
+  vol_dv_ms.resize(num_ms);
+  freevols_ms.resize(num_ms);
+  selfvols_ms.resize(num_ms);
   double energy_ms2, vol_ms2; 
   if(num_ms > 0){
     
@@ -1109,7 +1534,7 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
     for(int i=0;i<num_ms;i++) gammas_ms[i] = -common_gamma/roffset;
     for(int i=0;i<num_ms;i++) pos_ms[i] = msparticles2[i].pos;
     for(int i=0;i<num_ms;i++) ishydrogen_ms[i] = 0;
-    gvolms = new GaussVol(num_ms, ishydrogen_ms);
+    gvolms->setNumAtoms(num_ms, ishydrogen_ms);
     gvolms->setRadii(radii_ms);
     gvolms->setVolumes(volumes_ms);
     gvolms->setGammas(gammas_ms);
@@ -1223,86 +1648,87 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
     }//debug
 #endif
     
-    //forces for energy_ms due to MS particle displacement OK
-    for(int ims = 0; ims < msparticles2.size() ; ims++){
-      int i = msparticles2[ims].parent1;
-      int j = msparticles2[ims].parent2;
-      RealVec dist = pos[j] - pos[i];
-      RealVec hder = msparticles2[ims].hder;
-      double fms = msparticles2[ims].fms;
-      double gms = 1. - fms;
-      double evprod =  w_evol_ms * forces_ms[ims].dot(dist);
-      force[i] +=  hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;
-      force[j] +=  hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;
-
-
-      //der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
-      //der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
-
-    }
-
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
-    for(int ims = 0; ims < msparticles2.size() ; ims++){
-      int parent1 = msparticles2[ims].parent1;
-      int parent2 = msparticles2[ims].parent2;
-      RealVec gder = msparticles2[ims].gder;
-      double ssp = msparticles2[ims].ssp_vdw;
-      double vol = msparticles2[ims].vol_vdw;
-      double vol0 = msparticles2[ims].vol0;
-      double G0m = msparticles2[ims].G0_vdw;
-      double fv = w_evol_ms*ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
-      force[parent1] -= gder * fv;
-      force[parent2] += gder * fv;
-      
-      //der1p[parent1] += gder * fv;//debug
-      //der1p[parent2] -= gder * fv;//debug
-    }
+    if(includeForces){
+      //forces for energy_ms due to MS particle displacement OK
+      for(int ims = 0; ims < msparticles2.size() ; ims++){
+	int i = msparticles2[ims].parent1;
+	int j = msparticles2[ims].parent2;
+	RealVec dist = pos[j] - pos[i];
+	RealVec hder = msparticles2[ims].hder;
+	double fms = msparticles2[ims].fms;
+	double gms = 1. - fms;
+	double evprod =  w_evol_ms * forces_ms[ims].dot(dist);
+	force[i] +=  hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;
+	force[j] +=  hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;
+
+
+	//der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
+	//der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
 
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
+      }
 
-    for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
-    for(int i=0;i<numParticles;i++){
-      if (ishydrogen[i]>0) continue;
-      RealOpenMM rad = radii_vdw[i];
-      RealOpenMM ai = KFC/(rad*rad);
-      RealOpenMM voli = self_volume_vdw[i];
-      gatom.a = ai;
-      gatom.v = voli;
-      gatom.c = pos[i];
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
       for(int ims = 0; ims < msparticles2.size() ; ims++){
-	gms.a = ams;
-	gms.v = msparticles2[ims].vol0;
-	gms.c = msparticles2[ims].pos;
+	int parent1 = msparticles2[ims].parent1;
+	int parent2 = msparticles2[ims].parent2;
+	RealVec gder = msparticles2[ims].gder;
 	double ssp = msparticles2[ims].ssp_vdw;
-	RealOpenMM dVdr, dVdV, sfp;
-	ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
-	force[i] += (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];
+	double vol = msparticles2[ims].vol_vdw;
+	double vol0 = msparticles2[ims].vol0;
+	double G0m = msparticles2[ims].G0_vdw;
+	double fv = w_evol_ms*ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
+	force[parent1] -= gder * fv;
+	force[parent2] += gder * fv;
+      
+	//der1p[parent1] += gder * fv;//debug
+	//der1p[parent2] -= gder * fv;//debug
+      }
+
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
+
+      for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
+      for(int i=0;i<numParticles;i++){
+	if (ishydrogen[i]>0) continue;
+	RealOpenMM rad = radii_vdw[i];
+	RealOpenMM ai = KFC/(rad*rad);
+	RealOpenMM voli = self_volume_vdw[i];
+	gatom.a = ai;
+	gatom.v = voli;
+	gatom.c = pos[i];
+	for(int ims = 0; ims < msparticles2.size() ; ims++){
+	  gms.a = ams;
+	  gms.v = msparticles2[ims].vol0;
+	  gms.c = msparticles2[ims].pos;
+	  double ssp = msparticles2[ims].ssp_vdw;
+	  RealOpenMM dVdr, dVdV, sfp;
+	  ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
+	  force[i] += (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];
 
 
 	
-	//der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
+	  //der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
 
-	numsder[i] += w_evol_ms*ssp*sfp*g12.v*vol_dv_ms[ims];
+	  numsder[i] += w_evol_ms*ssp*sfp*g12.v*vol_dv_ms[ims];
 	
-      }
+	}
 
-      numsder[i] /= -voli;
-    }
+	numsder[i] /= -voli;
+      }
 
-    //derivatives of energy_ms from change in self volumes OK
-    gvol->setGammas(numsder);
-    gvol->rescan_tree_gammas();
-    double volume, vol_energy;
-    gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol_ms;
+      //derivatives of energy_ms from change in self volumes OK
+      gvol->setGammas(numsder);
+      gvol->rescan_tree_gammas();
+      double volume, vol_energy;
+      gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
+      for(int i = 0; i < numParticles; i++){
+	force[i] += vol_force[i] * w_evol_ms;
 
-      //der1p[i] -= vol_force[i] * w_evol_ms;//debug
+	//der1p[i] -= vol_force[i] * w_evol_ms;//debug
+      }
     }
 
 
     //add ms self-volumes (with small radii) to parents
-    vector<RealOpenMM> svadd(numParticles);
     for(int iat=0;iat<numParticles;iat++){
       svadd[iat] = 0.0;
     }
@@ -1344,9 +1770,7 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   //volume scaling factors from self volumes (with small radii)
   double tot_vol = 0;
   for(int i = 0; i < numParticles; i++){
-    RealOpenMM rad = radii_vdw[i];
-    RealOpenMM vol = (4./3.)*M_PI*rad*rad*rad;
-    volume_scaling_factor[i] = self_volume[i]/vol;
+    volume_scaling_factor[i] = self_volume[i]/vdw_volume[i];
     if(verbose_level > 3){
       cout << "SV " << i << " " << self_volume[i] << endl;
     }
@@ -1358,24 +1782,9 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   
   RealOpenMM pifac = 1./(4.*M_PI);
   
-  //compute inverse Born radii, prototype, no cutoff
-  for(int i = 0; i < numParticles; i++){
-    inverse_born_radius[i] = 1./radii_vdw[i];
-    for(int j = 0; j < numParticles; j++){
-      if(i == j) continue;
-      if(ishydrogen[j] > 0) continue;
-      RealVec dist = pos[j] - pos[i];
-      RealOpenMM d = sqrt(dist.dot(dist));
-      if(d < AGBNP_I4LOOKUP_MAXA){
-	int rad_typei = i4_lut->radius_type_screened[i];
-	int rad_typej = i4_lut->radius_type_screener[j];
-	inverse_born_radius[i] -= pifac*volume_scaling_factor[j]*i4_lut->eval(d, rad_typei, rad_typej);
-      }	
-    }
-    RealOpenMM fp;
-    born_radius[i] = 1./agbnp_swf_invbr(inverse_born_radius[i], fp);
-    inverse_born_radius_fp[i] = fp;
-  }
+  //compute inverse Born radii over the neighbor list
+  updateNeighborList(context, pos);
+  computeBornRadii(pos);
   
   if(verbose_level > 3){
     cout << "Born radii:" << endl;
@@ -1391,35 +1800,14 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   RealOpenMM tokjmol = 4.184*332.0/10.0; //the factor of 10 is the conversion of 1/r from nm to Ang
   RealOpenMM dielectric_factor = tokjmol*(-0.5)*(1./dielectric_in - 1./dielectric_out);
   RealOpenMM pt25 = 0.25;
-  vector<RealOpenMM> egb_der_Y(numParticles);
   for(int i = 0; i < numParticles; i++){
     egb_der_Y[i] = 0.0;
   }
   RealOpenMM gb_self_energy = 0.0;
-  RealOpenMM gb_pair_energy = 0.0;
   for(int i = 0; i < numParticles; i++){
-    double uself = dielectric_factor*charge[i]*charge[i]/born_radius[i];
-    gb_self_energy += uself;
-    for(int j = i+1; j < numParticles; j++){
-      RealVec dist = pos[j] - pos[i];
-      RealOpenMM d2 = dist.dot(dist);
-      RealOpenMM qqf = charge[j]*charge[i];
-      RealOpenMM qq = dielectric_factor*qqf;
-      RealOpenMM bb = born_radius[i]*born_radius[j];
-      RealOpenMM etij = exp(-pt25*d2/bb);
-      RealOpenMM fgb = 1./sqrt(d2 + bb*etij);
-      RealOpenMM egb = 2.*qq*fgb;
-      gb_pair_energy += egb;
-      RealOpenMM fgb3 = fgb*fgb*fgb;
-      RealOpenMM mw = -2.0*qq*(1.0-pt25*etij)*fgb3;
-      RealVec g = dist * mw;
-      force[i] += g * w_egb;
-      force[j] -= g * w_egb;
-      RealOpenMM ytij = qqf*(bb+pt25*d2)*etij*fgb3;
-      egb_der_Y[i] += ytij;
-      egb_der_Y[j] += ytij;
-    }
+    gb_self_energy += dielectric_factor*charge[i]*charge[i]/born_radius[i];
   }
+  RealOpenMM gb_pair_energy = computeGBPairEnergy(pos, force, dielectric_factor, w_egb, egb_der_Y, includeForces);
   if(verbose_level > 0){
     cout << "  GB self Energy: " << gb_self_energy << endl;
     cout << "  GB pair Energy: " << gb_pair_energy << endl;
@@ -1444,231 +1832,187 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
   }
   energy += w_vdw*evdw;
   
-  //compute atom-level property for the calculation of the gradients of Evdw and Egb
-  vector<RealOpenMM> evdw_der_brw(numParticles);
-  for(int i = 0; i < numParticles; i++){
-    RealOpenMM br = born_radius[i];
-    evdw_der_brw[i] = -pifac*3.*vdw_alpha[i]*br*br*inverse_born_radius_fp[i]/pow(br+AGBNP_HB_RADIUS,4);
-  }
-  if(verbose_level > 3){
-    cout << "BrW parameters: " << endl;
+  //the rest computes the gradients only, except for the MS energy with large radii below
+  if(includeForces){
+    //compute atom-level property for the calculation of the gradients of Evdw and Egb
     for(int i = 0; i < numParticles; i++){
-      cout << "BrW: " << i << " " << evdw_der_brw[i] << endl;      
+      RealOpenMM br = born_radius[i];
+      evdw_der_brw[i] = -pifac*3.*vdw_alpha[i]*br*br*inverse_born_radius_fp[i]/pow(br+AGBNP_HB_RADIUS,4);
+    }
+    if(verbose_level > 3){
+      cout << "BrW parameters: " << endl;
+      for(int i = 0; i < numParticles; i++){
+	cout << "BrW: " << i << " " << evdw_der_brw[i] << endl;      
+      }
     }
-  }
   
   
-  vector<RealOpenMM> egb_der_bru(numParticles);
-  for(int i = 0; i < numParticles; i++){
-    RealOpenMM br = born_radius[i];
-    RealOpenMM qi = charge[i];
-    egb_der_bru[i] = -pifac*dielectric_factor*(qi*qi + egb_der_Y[i]*br)*inverse_born_radius_fp[i];
-  }
-  
-  if(verbose_level > 3){
-    cout << "BrU parameters: " << endl;
     for(int i = 0; i < numParticles; i++){
-      cout << "BrU: " << i << " " << egb_der_bru[i] << endl;      
+      RealOpenMM br = born_radius[i];
+      RealOpenMM qi = charge[i];
+      egb_der_bru[i] = -pifac*dielectric_factor*(qi*qi + egb_der_Y[i]*br)*inverse_born_radius_fp[i];
     }
-  }
-    
-    
-  //compute the component of the gradients of the van der Waals and GB energies due to
-  //variations of Born radii
-  //also accumulates W's and U's for self-volume components of the gradients later
-  vector<RealOpenMM> evdw_der_W(numParticles);
-  vector<RealOpenMM> egb_der_U(numParticles);
-  for(int i = 0; i < numParticles; i++){
-    evdw_der_W[i] = egb_der_U[i] = 0.0;
-  }
-  for(int i = 0; i < numParticles; i++){
-    for(int j = 0; j < numParticles; j++){
-      if(i == j) continue;
-      if(ishydrogen[j]>0) continue;
-      RealVec dist = pos[j] - pos[i];
-      RealOpenMM d = sqrt(dist.dot(dist));
-      double Qji = 0.0, dQji = 0.0;
-      // Qji: j descreens i
-      if(d < AGBNP_I4LOOKUP_MAXA){
-	int rad_typei = i4_lut->radius_type_screened[i];
-	int rad_typej = i4_lut->radius_type_screener[j];
-	Qji = i4_lut->eval(d, rad_typei, rad_typej); 
-	dQji = i4_lut->evalderiv(d, rad_typei, rad_typej); 
+  
+    if(verbose_level > 3){
+      cout << "BrU parameters: " << endl;
+      for(int i = 0; i < numParticles; i++){
+	cout << "BrU: " << i << " " << egb_der_bru[i] << endl;      
       }
-      RealVec w;
-      //van der Waals stuff
-      evdw_der_W[j] += evdw_der_brw[i]*Qji;
-      w = dist * evdw_der_brw[i]*volume_scaling_factor[j]*dQji/d;
-      force[i] += w * w_vdw;
-      force[j] -= w * w_vdw;
-      //GB stuff
-      egb_der_U[j] += egb_der_bru[i]*Qji;
-      w = dist * egb_der_bru[i]*volume_scaling_factor[j]*dQji/d;
-      force[i] += w * w_egb;
-      force[j] -= w * w_egb;
     }
-  }
+    
+    
+    //compute the component of the gradients of the van der Waals and GB energies due to
+    //variations of Born radii
+    //also accumulates W's and U's for self-volume components of the gradients later
+    computeBornRadiiDerivatives(pos, force, evdw_der_brw, egb_der_bru, w_vdw, w_egb, evdw_der_W, egb_der_U);
 
   
   
-  if(verbose_level > 3){
-    cout << "U parameters: " << endl;
-    for(int i = 0; i < numParticles; i++){
-      RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-      cout << "U: " << i << " " << egb_der_U[i]/vol << endl;      
+    if(verbose_level > 3){
+      cout << "U parameters: " << endl;
+      for(int i = 0; i < numParticles; i++){
+	RealOpenMM vol = vdw_volume[i];
+	cout << "U: " << i << " " << egb_der_U[i]/vol << endl;      
+      }
     }
-  }
   
-  if(verbose_level > 3){
-    cout << "W parameters: " << endl;
-    for(int i = 0; i < numParticles; i++){
-      RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-      cout << "W: " << i << " " << evdw_der_W[i]/vol << endl;      
+    if(verbose_level > 3){
+      cout << "W parameters: " << endl;
+      for(int i = 0; i < numParticles; i++){
+	RealOpenMM vol = vdw_volume[i];
+	cout << "W: " << i << " " << evdw_der_W[i]/vol << endl;      
+      }
     }
-  }
-
-  RealOpenMM volume_tmp, vol_energy_tmp;
-  //set up the parameters of the pseudo-volume energy function and
-  //compute the component of the gradient of Evdw due to the variations
-  //of self volumes
-  for(int i = 0; i < numParticles; i++){
-    RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-    nu[i] = evdw_der_W[i]/vol;
-  }
-  gvol->setGammas(nu);
-  gvol->rescan_tree_gammas();
-  gvol->compute_volume(pos, volume_tmp, vol_energy_tmp, vol_force, vol_dv, free_volume, self_volume);
-  for(int i = 0; i < numParticles; i++){
-    force[i] += vol_force[i] * w_vdw;
-  }
 
-  //set up the parameters of the pseudo-volume energy function and
-  //compute the component of the gradient of Egb due to the variations
-  //of self volumes
-  for(int i = 0; i < numParticles; i++){
-    RealOpenMM vol = 4.*M_PI*pow(radii_vdw[i],3)/3.0; 
-    nu[i] = egb_der_U[i]/vol;
-  }
-  gvol->setGammas(nu);
-  gvol->rescan_tree_gammas();
-  gvol->compute_volume(pos, volume_tmp, vol_energy_tmp, vol_force, vol_dv, free_volume, self_volume);
-  for(int i = 0; i < numParticles; i++){
-    force[i] += vol_force[i] * w_egb;
-  }
+    //set up the parameters of the pseudo-volume energy functions and
+    //compute the components of the gradients of Evdw (channel 0) and Egb (channel 1)
+    //due to the variations of self volumes
+    ch_radii[0] = radii_vdw;
+    ch_volumes[0] = ch_volumes[1];
+    for(int i = 0; i < numParticles; i++){
+      RealOpenMM vol = vdw_volume[i];
+      ch_gammas[0][i] = evdw_der_W[i]/vol;
+      ch_gammas[1][i] = egb_der_U[i]/vol;
+    }
+    gvol->compute_volume_channels(pos, ch_radii, ch_volumes, ch_gammas,
+				  ch_volume, ch_energy, ch_force, ch_dv, ch_free_volume, ch_self_volume);
+    for(int i = 0; i < numParticles; i++){
+      force[i] += ch_force[0][i] * w_vdw;
+      force[i] += ch_force[1][i] * w_egb;
+    }
   
   
-  if(verbose_level > 3){
-    //creates input for test program
-    double nm2ang = 10.0;
-    double kjmol2kcalmol = 1/4.184;
-    double gf = kjmol2kcalmol/(nm2ang*nm2ang);
-    cout << "---- input for test program begins ----" << endl;
-    cout << numParticles << endl;
-    for(int i = 0; i < numParticles; i++){
-      cout << std::setprecision(6) << std::setw(5) << i << " " << std::setw(12) << nm2ang*pos[i][0] << " " << std::setw(12) << nm2ang*pos[i][1] << " " << std::setw(12) << nm2ang*pos[i][2] << " " << std::setw(12) << nm2ang*radii_vdw[i] << " " << std::setw(12) << charge[i] << " " << std::setw(12) << gf*gammas[i] << " " << std::setw(2) << ishydrogen[i] << endl;
+    if(verbose_level > 3){
+      //creates input for test program
+      double nm2ang = 10.0;
+      double kjmol2kcalmol = 1/4.184;
+      double gf = kjmol2kcalmol/(nm2ang*nm2ang);
+      cout << "---- input for test program begins ----" << endl;
+      cout << numParticles << endl;
+      for(int i = 0; i < numParticles; i++){
+	cout << std::setprecision(6) << std::setw(5) << i << " " << std::setw(12) << nm2ang*pos[i][0] << " " << std::setw(12) << nm2ang*pos[i][1] << " " << std::setw(12) << nm2ang*pos[i][2] << " " << std::setw(12) << nm2ang*radii_vdw[i] << " " << std::setw(12) << charge[i] << " " << std::setw(12) << gf*gammas[i] << " " << std::setw(2) << ishydrogen[i] << endl;
+      }
+      cout << "--- input for test program ends ----" << endl;
     }
-    cout << "--- input for test program ends ----" << endl;
-  }
 
 
-  if(verbose_level > 3){
-    //creates input for mkws program
-    double nm2ang = 10.0;
-    cout << "---- input for mkws program begins ----" << endl;
-    cout << numParticles << endl;
-    for(int i = 0; i < numParticles; i++){
-      string at_symbol = "A";
-      if(ishydrogen[i] > 0){
-	at_symbol = "H";
+    if(verbose_level > 3){
+      //creates input for mkws program
+      double nm2ang = 10.0;
+      cout << "---- input for mkws program begins ----" << endl;
+      cout << numParticles << endl;
+      for(int i = 0; i < numParticles; i++){
+	string at_symbol = "A";
+	if(ishydrogen[i] > 0){
+	  at_symbol = "H";
+	}
+	cout << std::setprecision(6) << std::setw(5) << i << " " << at_symbol << "" << std::setw(12) << nm2ang*pos[i][0] << " " << std::setw(12) << nm2ang*pos[i][1] << " " << std::setw(12) << nm2ang*pos[i][2] << " " << std::setw(12) << nm2ang*radii_vdw[i] << endl;
       }
-      cout << std::setprecision(6) << std::setw(5) << i << " " << at_symbol << "" << std::setw(12) << nm2ang*pos[i][0] << " " << std::setw(12) << nm2ang*pos[i][1] << " " << std::setw(12) << nm2ang*pos[i][2] << " " << std::setw(12) << nm2ang*radii_vdw[i] << endl;
+      cout << "--- input for mkws program ends ----" << endl;
     }
-    cout << "--- input for mkws program ends ----" << endl;
-  }
 
-  if(num_ms > 0){
+    if(num_ms > 0){
     
-    //derivatives of vdW/GB energy from MS atoms
+      //derivatives of vdW/GB energy from MS atoms
 
-    for(int i=0;i<num_ms;i++) {
-      int parent1 = msparticles2[i].parent1;
-      int parent2 = msparticles2[i].parent2;
-      RealOpenMM vol = 4.*M_PI*pow(radii_vdw[parent1],3)/3.0; 
-      gammas_ms[i] = w_egb*0.5*egb_der_U[parent1]/vol;
-      vol = 4.*M_PI*pow(radii_vdw[parent2],3)/3.0;
-      gammas_ms[i] += w_vdw*0.5*evdw_der_W[parent2]/vol;
-    }
-    gvolms->setGammas(gammas_ms);
-    gvolms->rescan_tree_gammas();
-    double vol_ms, energy_ms;
-    gvolms->compute_volume(pos_ms, vol_ms, energy_ms, forces_ms, vol_dv_ms, freevols_ms, selfvols_ms);
-
-    //forces for energy_ms due to MS particle displacement OK
-    for(int ims = 0; ims < num_ms ; ims++){
-      int i = msparticles2[ims].parent1;
-      int j = msparticles2[ims].parent2;
-      RealVec dist = pos[j] - pos[i];
-      RealVec hder = msparticles2[ims].hder;
-      double fms = msparticles2[ims].fms;
-      double gms = 1. - fms;
-      double evprod = forces_ms[ims].dot(dist);
-      force[i] +=  hder * (+evprod) + forces_ms[ims] *  gms;
-      force[j] +=  hder * (-evprod) + forces_ms[ims] *  fms;
-      //der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
-      //der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
-    }
-
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
-    for(int ims = 0; ims < msparticles2.size() ; ims++){
-      int parent1 = msparticles2[ims].parent1;
-      int parent2 = msparticles2[ims].parent2;
-      RealVec gder = msparticles2[ims].gder;
-      double ssp = msparticles2[ims].ssp_vdw;
-      double vol = msparticles2[ims].vol_vdw;
-      double vol0 = msparticles2[ims].vol0;
-      double G0m = msparticles2[ims].G0_vdw;
-      double fv = ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
-      force[parent1] -= gder * fv;
-      force[parent2] += gder * fv;
-      //der1p[parent1] += gder * fv;//debug
-      //der1p[parent2] -= gder * fv;//debug
-    }
-
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
-
-    for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
-    for(int i=0;i<numParticles;i++){
-      if (ishydrogen[i]>0) continue;
-      RealOpenMM rad = radii_vdw[i];
-      RealOpenMM ai = KFC/(rad*rad);
-      RealOpenMM voli = self_volume_vdw[i];
-      gatom.a = ai;
-      gatom.v = voli;
-      gatom.c = pos[i];
+      for(int i=0;i<num_ms;i++) {
+	int parent1 = msparticles2[i].parent1;
+	int parent2 = msparticles2[i].parent2;
+	gammas_ms[i] = w_egb*0.5*egb_der_U[parent1]/vdw_volume[parent1];
+	gammas_ms[i] += w_vdw*0.5*evdw_der_W[parent2]/vdw_volume[parent2];
+      }
+      gvolms->setGammas(gammas_ms);
+      gvolms->rescan_tree_gammas();
+      double vol_ms, energy_ms;
+      gvolms->compute_volume(pos_ms, vol_ms, energy_ms, forces_ms, vol_dv_ms, freevols_ms, selfvols_ms);
+
+      //forces for energy_ms due to MS particle displacement OK
+      for(int ims = 0; ims < num_ms ; ims++){
+	int i = msparticles2[ims].parent1;
+	int j = msparticles2[ims].parent2;
+	RealVec dist = pos[j] - pos[i];
+	RealVec hder = msparticles2[ims].hder;
+	double fms = msparticles2[ims].fms;
+	double gms = 1. - fms;
+	double evprod = forces_ms[ims].dot(dist);
+	force[i] +=  hder * (+evprod) + forces_ms[ims] *  gms;
+	force[j] +=  hder * (-evprod) + forces_ms[ims] *  fms;
+	//der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
+	//der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
+      }
+
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
       for(int ims = 0; ims < msparticles2.size() ; ims++){
-	gms.a = ams;
-	gms.v = msparticles2[ims].vol0;
-	gms.c = msparticles2[ims].pos;
+	int parent1 = msparticles2[ims].parent1;
+	int parent2 = msparticles2[ims].parent2;
+	RealVec gder = msparticles2[ims].gder;
 	double ssp = msparticles2[ims].ssp_vdw;
-	RealOpenMM dVdr, dVdV, sfp;
-	ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
-	force[i] += (gatom.c - gms.c) * ssp*sfp*dVdr*vol_dv_ms[ims];
-	//der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
-	numsder[i] += ssp*sfp*g12.v*vol_dv_ms[ims];	
+	double vol = msparticles2[ims].vol_vdw;
+	double vol0 = msparticles2[ims].vol0;
+	double G0m = msparticles2[ims].G0_vdw;
+	double fv = ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
+	force[parent1] -= gder * fv;
+	force[parent2] += gder * fv;
+	//der1p[parent1] += gder * fv;//debug
+	//der1p[parent2] -= gder * fv;//debug
       }
-      numsder[i] /= -voli;
-    }
 
-    //derivatives of energy_ms from change in self volumes OK
-    gvol->setGammas(numsder);
-    gvol->rescan_tree_gammas();
-    double volume, vol_energy;
-    gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i];
-      //der1p[i] -= vol_force[i] * w_evol_ms;//debug
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
+
+      for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
+      for(int i=0;i<numParticles;i++){
+	if (ishydrogen[i]>0) continue;
+	RealOpenMM rad = radii_vdw[i];
+	RealOpenMM ai = KFC/(rad*rad);
+	RealOpenMM voli = self_volume_vdw[i];
+	gatom.a = ai;
+	gatom.v = voli;
+	gatom.c = pos[i];
+	for(int ims = 0; ims < msparticles2.size() ; ims++){
+	  gms.a = ams;
+	  gms.v = msparticles2[ims].vol0;
+	  gms.c = msparticles2[ims].pos;
+	  double ssp = msparticles2[ims].ssp_vdw;
+	  RealOpenMM dVdr, dVdV, sfp;
+	  ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
+	  force[i] += (gatom.c - gms.c) * ssp*sfp*dVdr*vol_dv_ms[ims];
+	  //der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
+	  numsder[i] += ssp*sfp*g12.v*vol_dv_ms[ims];	
+	}
+	numsder[i] /= -voli;
+      }
+
+      //derivatives of energy_ms from change in self volumes OK
+      gvol->setGammas(numsder);
+      gvol->rescan_tree_gammas();
+      double volume, vol_energy;
+      gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
+      for(int i = 0; i < numParticles; i++){
+	force[i] += vol_force[i];
+	//der1p[i] -= vol_force[i] * w_evol_ms;//debug
+      }
     }
-  }
+  }//matches includeForces
   
   //MS Large radii
   if(num_ms > 0){
@@ -1700,74 +2044,76 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
 
     energy += w_evol_ms * energy_ms1;
     
-    //forces for energy_ms due to MS particle displacement OK
-    for(int ims = 0; ims < msparticles2.size() ; ims++){
-      int i = msparticles2[ims].parent1;
-      int j = msparticles2[ims].parent2;
-      RealVec dist = pos[j] - pos[i];
-      RealVec hder = msparticles2[ims].hder;
-      double fms = msparticles2[ims].fms;
-      double gms = 1. - fms;
-      double evprod =  w_evol_ms * forces_ms[ims].dot(dist);
-      force[i] +=  hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;
-      force[j] +=  hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;
-      //der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
-      //der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
-    }
-
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
-    for(int ims = 0; ims < msparticles2.size() ; ims++){
-      int parent1 = msparticles2[ims].parent1;
-      int parent2 = msparticles2[ims].parent2;
-      RealVec gder = msparticles2[ims].gder;
-      double ssp = msparticles2[ims].ssp_large;
-      double vol = msparticles2[ims].vol_large;
-      double vol0 = msparticles2[ims].vol0;
-      double G0m = msparticles2[ims].G0_large;
-      double fv = w_evol_ms*ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
-      force[parent1] -= gder * fv;
-      force[parent2] += gder * fv;
-      //der1p[parent1] += gder * fv;//debug
-      //der1p[parent2] -= gder * fv;//debug
-    }
-
-
-    //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
-    for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
-    for(int i=0;i<numParticles;i++){
-      if (ishydrogen[i]>0) continue;
-      RealOpenMM voli = self_volume_large[i];
-      if(voli <= 0) continue;
-      RealOpenMM rad = radii_large[i];
-      RealOpenMM ai = KFC/(rad*rad);
-      gatom.a = ai;
-      gatom.v = voli;
-      gatom.c = pos[i];
+    if(includeForces){
+      //forces for energy_ms due to MS particle displacement OK
+      for(int ims = 0; ims < msparticles2.size() ; ims++){
+	int i = msparticles2[ims].parent1;
+	int j = msparticles2[ims].parent2;
+	RealVec dist = pos[j] - pos[i];
+	RealVec hder = msparticles2[ims].hder;
+	double fms = msparticles2[ims].fms;
+	double gms = 1. - fms;
+	double evprod =  w_evol_ms * forces_ms[ims].dot(dist);
+	force[i] +=  hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;
+	force[j] +=  hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;
+	//der1p[i] -= hder * (+w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*gms;//debug
+	//der1p[j] -= hder * (-w_evol_ms*evprod) + forces_ms[ims] *  w_evol_ms*fms;//debug
+      }
+
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
       for(int ims = 0; ims < msparticles2.size() ; ims++){
-	gms.a = ams;
-	gms.v = msparticles2[ims].vol0;
-	gms.c = msparticles2[ims].pos;
+	int parent1 = msparticles2[ims].parent1;
+	int parent2 = msparticles2[ims].parent2;
+	RealVec gder = msparticles2[ims].gder;
 	double ssp = msparticles2[ims].ssp_large;
-	RealOpenMM dVdr, dVdV, sfp;
-	ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
-	//cout << "Fd: " << i << " " << ims << " " << vol_dv_ms[ims] << " " << volumes_ms[ims] << endl;
-	force[i] += (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];
-	//der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
-	numsder[i] += w_evol_ms*ssp*sfp*g12.v*vol_dv_ms[ims];	
+	double vol = msparticles2[ims].vol_large;
+	double vol0 = msparticles2[ims].vol0;
+	double G0m = msparticles2[ims].G0_large;
+	double fv = w_evol_ms*ssp*vol_dv_ms[ims]*(1. - G0m/vol0);
+	force[parent1] -= gder * fv;
+	force[parent2] += gder * fv;
+	//der1p[parent1] += gder * fv;//debug
+	//der1p[parent2] -= gder * fv;//debug
+      }
+
+
+      //forces of energy_ms wrt of changing MS volumes due to changes of overlap volumes OK
+      for(int i=0;i<numParticles;i++) numsder[i] = 0.0;
+      for(int i=0;i<numParticles;i++){
+	if (ishydrogen[i]>0) continue;
+	RealOpenMM voli = self_volume_large[i];
+	if(voli <= 0) continue;
+	RealOpenMM rad = radii_large[i];
+	RealOpenMM ai = KFC/(rad*rad);
+	gatom.a = ai;
+	gatom.v = voli;
+	gatom.c = pos[i];
+	for(int ims = 0; ims < msparticles2.size() ; ims++){
+	  gms.a = ams;
+	  gms.v = msparticles2[ims].vol0;
+	  gms.c = msparticles2[ims].pos;
+	  double ssp = msparticles2[ims].ssp_large;
+	  RealOpenMM dVdr, dVdV, sfp;
+	  ogauss_alpha(gms, gatom, g12, dVdr, dVdV, sfp);
+	  //cout << "Fd: " << i << " " << ims << " " << vol_dv_ms[ims] << " " << volumes_ms[ims] << endl;
+	  force[i] += (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];
+	  //der1p[i] -= (gatom.c - gms.c) * w_evol_ms*ssp*sfp*dVdr*vol_dv_ms[ims];//debug
+	  numsder[i] += w_evol_ms*ssp*sfp*g12.v*vol_dv_ms[ims];	
+	}
+	numsder[i] /= -voli;
       }
-      numsder[i] /= -voli;
-    }
     
-    //derivatives of energy_ms from change in self volumes, must rescan the tree
-    gvol->setGammas(numsder);
-    gvol->setRadii(radii_large);
-    gvol->setVolumes(volumes_large);
-    gvol->rescan_tree_volumes(pos);
-    double volume, vol_energy;
-    gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
-    for(int i = 0; i < numParticles; i++){
-      force[i] += vol_force[i] * w_evol_ms;
-      //der1p[i] -= vol_force[i] * w_evol_ms;//debug
+      //derivatives of energy_ms from change in self volumes, must rescan the tree
+      gvol->setGammas(numsder);
+      gvol->setRadii(radii_large);
+      gvol->setVolumes(volumes_large);
+      gvol->rescan_tree_volumes(pos);
+      double volume, vol_energy;
+      gvol->compute_volume(pos, volume, vol_energy, vol_force, vol_dv, free_volume, self_volume);
+      for(int i = 0; i < numParticles; i++){
+	force[i] += vol_force[i] * w_evol_ms;
+	//der1p[i] -= vol_force[i] * w_evol_ms;//debug
+      }
     }
 
     
@@ -1779,9 +2125,6 @@ double ReferenceCalcAGBNPForceKernel::executeAGBNP2(ContextImpl& context, bool i
       
       cout << endl;
     }
-
-    //no longer needs gvol instance
-    delete gvolms;
   }
     
 
@@ -9,7 +9,9 @@
 #include <cmath>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cstdlib>
+#include <new>
 #include "AGBNPForce.h"
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
@@ -18,6 +20,7 @@
 #include "openmm/reference/RealVec.h"
 #include "openmm/VerletIntegrator.h"
 #include "openmm/NonbondedForce.h"
+#include "gaussvol.h"
 
 using namespace AGBNPPlugin;
 using namespace OpenMM;
@@ -25,6 +28,185 @@ using namespace std;
 
 extern "C" OPENMM_EXPORT void registerAGBNPReferenceKernelFactories();
 
+//counts heap allocations while count_allocations is set
+static bool count_allocations = false;
+static long num_allocations = 0;
+void* operator new(size_t size) {
+  if(count_allocations) num_allocations++;
+  void *p = malloc(size);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+static long countAllocations(Context& context, int groups) {
+  num_allocations = 0;
+  count_allocations = true;
+  context.getState(State::Energy | State::Forces, false, groups);
+  count_allocations = false;
+  return num_allocations;
+}
+
+/* after the first steps the kernel works in its persistent workspace: evaluating
+   the AGBNP force group must not allocate more than evaluating no forces at all */
+void testSteadyStateAllocations(System& system, AGBNPForce* force, vector<Vec3>& positions, int version) {
+    int saved_version = force->getVersion();
+    int saved_group = force->getForceGroup();
+    force->setVersion(version);
+    force->setForceGroup(1);
+    VerletIntegrator integ(1.0);
+    Platform& platform = Platform::getPlatformByName("Reference");
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    for(int step = 0; step < 3; step++){
+      context.getState(State::Energy | State::Forces, false, 1<<1);
+    }
+    long nalloc_agbnp = countAllocations(context, 1<<1);
+    long nalloc_none = countAllocations(context, 0);
+    std::cout << "Allocations per step (version " << version << "): " << nalloc_agbnp - nalloc_none << std::endl;
+    ASSERT_EQUAL(nalloc_none, nalloc_agbnp);
+    force->setVersion(saved_version);
+    force->setForceGroup(saved_group);
+}
+
+/* in incremental mode the overlap tree built with a skin is only rescanned while the atoms stay
+   within half the skin and rebuilt when they move further. Either way energy and forces must
+   match those with a tree built afresh, up to the overlaps near the volume cutoff that only one
+   of the two trees includes. */
+void testTreeSkin(System& system, AGBNPForce* force, vector<Vec3>& positions, int version) {
+    int saved_version = force->getVersion();
+    int numParticles = positions.size();
+    force->setVersion(version);
+    force->setTreeSkin(0.05);
+    Platform& platform = Platform::getPlatformByName("Reference");
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    force->setTreeSkin(0.0);
+    vector<Vec3> moved = positions;
+    context.setPositions(moved);
+    context.getState(State::Energy | State::Forces);
+    srand(2017);
+    //three small displacements within the skin, then a large one that requires a rebuild
+    double offsets[4] = { 0.004, 0.004, 0.004, 0.03 };
+    for(int step = 0; step < 4; step++){
+      for(int i = 0; i < numParticles; i++){
+	for(int k = 0; k < 3; k++){
+	  moved[i][k] += offsets[step]*(2.0*rand()/RAND_MAX - 1.0);
+	}
+      }
+      context.setPositions(moved);
+      State state = context.getState(State::Energy | State::Forces);
+      VerletIntegrator integ0(1.0);
+      Context context0(system, integ0, platform);
+      context0.setPositions(moved);
+      State state0 = context0.getState(State::Energy | State::Forces);
+      std::cout << "Energy with tree skin (version " << version << ", step " << step << "): " << state.getPotentialEnergy() << std::endl;
+      ASSERT_EQUAL_TOL(state0.getPotentialEnergy(), state.getPotentialEnergy(), 1.e-8);
+      for(int i = 0; i < numParticles; i++){
+	ASSERT_EQUAL_VEC(state0.getForces()[i], state.getForces()[i], 1.e-4);
+      }
+    }
+    force->setVersion(saved_version);
+}
+
+/* with a periodic box wider than the molecule plus twice the cutoff no pair sees another image,
+   so energy and forces must be those without periodicity whether the molecule is in the middle
+   of the box or straddles its edges */
+void testPeriodic(System& system, AGBNPForce* force, vector<Vec3>& positions) {
+    double cutoff = 1.0;
+    int numParticles = positions.size();
+    Vec3 pmin = positions[0], pmax = positions[0], center;
+    for(int i = 0; i < numParticles; i++){
+      for(int k = 0; k < 3; k++){
+	pmin[k] = min(pmin[k], positions[i][k]);
+	pmax[k] = max(pmax[k], positions[i][k]);
+      }
+    }
+    center = (pmin + pmax)*0.5;
+    double extent = max(pmax[0] - pmin[0], max(pmax[1] - pmin[1], pmax[2] - pmin[2]));
+    double boxsize = extent + 2*cutoff + 0.5;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxsize, 0, 0), Vec3(0, boxsize, 0), Vec3(0, 0, boxsize));
+    force->setCutoffDistance(cutoff);
+    Platform& platform = Platform::getPlatformByName("Reference");
+
+    force->setNonbondedMethod(AGBNPForce::CutoffNonPeriodic);
+    VerletIntegrator integ0(1.0);
+    Context context0(system, integ0, platform);
+    context0.setPositions(positions);
+    State state0 = context0.getState(State::Energy | State::Forces);
+
+    //molecule centered in the box and centered on its corner
+    force->setNonbondedMethod(AGBNPForce::CutoffPeriodic);
+    Vec3 origins[2] = { Vec3(0.5*boxsize, 0.5*boxsize, 0.5*boxsize), Vec3(0, 0, 0) };
+    for(int c = 0; c < 2; c++){
+      vector<Vec3> moved(numParticles);
+      for(int i = 0; i < numParticles; i++) moved[i] = positions[i] - center + origins[c];
+      VerletIntegrator integ(1.0);
+      Context context(system, integ, platform);
+      context.setPositions(moved);
+      State state = context.getState(State::Energy | State::Forces);
+      std::cout << "Energy with periodic cutoff (" << (c == 0 ? "interior" : "box edge") << "): " << state.getPotentialEnergy() << std::endl;
+      ASSERT_EQUAL_TOL(state0.getPotentialEnergy(), state.getPotentialEnergy(), 1.e-8);
+      for(int i = 0; i < numParticles; i++){
+	ASSERT_EQUAL_VEC(state0.getForces()[i], state.getForces()[i], 1.e-6);
+      }
+    }
+    force->setNonbondedMethod(AGBNPForce::CutoffNonPeriodic);
+    force->setCutoffDistance(10.0);
+}
+
+/* volume, energy, forces and free volumes of the molecule with the GaussVol instantiation GV */
+template <class GV>
+static void computeGaussVol(vector<RealVec>& positions, vector<RealOpenMM>& radii, vector<RealOpenMM>& gammas,
+			    vector<int>& ishydrogen, RealOpenMM& volume, RealOpenMM& energy,
+			    vector<RealVec>& forces, vector<RealOpenMM>& free_volume) {
+    int numParticles = positions.size();
+    vector<RealOpenMM> volumes(numParticles), gradV(numParticles), self_volume(numParticles);
+    for(int i = 0; i < numParticles; i++) volumes[i] = 4.*M_PI*pow(radii[i],3)/3.;
+    forces.resize(numParticles);
+    free_volume.resize(numParticles);
+    GV gvol(numParticles, radii, volumes, gammas, ishydrogen);
+    gvol.compute_tree(positions);
+    gvol.compute_volume(positions, volume, energy, forces, gradV, free_volume, self_volume);
+}
+
+/* the float and mixed precision instantiations of GaussVol are library-only (no platform uses them);
+   they must reproduce the double precision volume and energy to 1e-5 and the forces and free volumes
+   to 1e-4 relative (measured: below 3e-6 and 2e-5 on molecules of up to 6000 atoms) */
+void testGaussVolPrecisions(vector<Vec3>& positions, vector<double>& radii, vector<double>& gammas, vector<int>& ishydrogen) {
+    int numParticles = positions.size();
+    vector<RealVec> pos(numParticles);
+    vector<RealOpenMM> r(numParticles), g(numParticles);
+    for(int i = 0; i < numParticles; i++){
+      pos[i] = RealVec(positions[i][0], positions[i][1], positions[i][2]);
+      r[i] = radii[i];
+      g[i] = gammas[i];
+    }
+    RealOpenMM volume, energy;
+    vector<RealVec> forces;
+    vector<RealOpenMM> free_volume;
+    computeGaussVol<GaussVol>(pos, r, g, ishydrogen, volume, energy, forces, free_volume);
+    for(int p = 0; p < 2; p++){
+      RealOpenMM volume_p, energy_p;
+      vector<RealVec> forces_p;
+      vector<RealOpenMM> free_volume_p;
+      if(p == 0){
+	computeGaussVol<GaussVolFloat>(pos, r, g, ishydrogen, volume_p, energy_p, forces_p, free_volume_p);
+      }else{
+	computeGaussVol<GaussVolMixed>(pos, r, g, ishydrogen, volume_p, energy_p, forces_p, free_volume_p);
+      }
+      std::cout << (p == 0 ? "Float" : "Mixed") << " GaussVol energy: " << energy_p << " (double " << energy << ")" << std::endl;
+      ASSERT_EQUAL_TOL(volume, volume_p, 1.e-5);
+      ASSERT_EQUAL_TOL(energy, energy_p, 1.e-5);
+      for(int i = 0; i < numParticles; i++){
+	ASSERT_EQUAL_VEC(forces[i], forces_p[i], 1.e-4);
+	ASSERT_EQUAL_TOL(free_volume[i], free_volume_p[i], 1.e-4);
+      }
+    }
+}
+
 void testForce() {
     bool verbose = true;
     bool veryverbose = false;
@@ -41,6 +223,7 @@ void testForce() {
     double gamma;
     bool ishydrogen;
     vector<int> ihi;
+    vector<double> radii, gammas;
     vector<Vec3> positions;
     std::cin >> numParticles;
     int ih;
@@ -62,6 +245,8 @@ void testForce() {
       ishydrogen = (ih > 0);
       radius *= ang2nm;
       gamma *= kcalmol2kjmol/(ang2nm*ang2nm);
+      radii.push_back(radius);
+      gammas.push_back(gamma);
       sigma_LJ = 2.*radius;
       double sij = sqrt(sigmaw*sigma_LJ);
       double eij = sqrt(epsilonw*epsilon_LJ);
@@ -82,14 +267,51 @@ void testForce() {
     double energy1 = state.getPotentialEnergy();
     std::cout << "Energy: " <<  energy1  << std::endl;
 
+    //an energy-only evaluation skips the derivative stages and must give the same energy
+    double energy_only = context.getState(State::Energy).getPotentialEnergy();
+    ASSERT_EQUAL_TOL(energy1, energy_only, 1.e-10);
+
     if(veryverbose){
       //print out forces for debugging
       cout << "Forces: " << endl;
       for(int i = 0; i < numParticles; i++){
-	cout << "FW: " << i << " " << state.getForces()[i][0] << " " << state.getForces()[i][1] << " "  << state.getForces()[i][2] << " "<< endl;      
+	cout << "FW: " << i << " " << state.getForces()[i][0] << " " << state.getForces()[i][1] << " "  << state.getForces()[i][2] << " "<< endl;
       }
     }
-    
+
+    //a cutoff larger than the molecule must reproduce the energy without cutoff
+    force->setNonbondedMethod(AGBNPForce::CutoffNonPeriodic);
+    force->setCutoffDistance(10.0);
+    context.reinitialize();
+    context.setPositions(positions);
+    double energy_cutoff = context.getState(State::Energy).getPotentialEnergy();
+    std::cout << "Energy with cutoff: " <<  energy_cutoff  << std::endl;
+    ASSERT_EQUAL_TOL(energy1, energy_cutoff, 1.e-6);
+
+    //so do energies and forces with the GB pair treecode
+    force->setNonbondedMethod(AGBNPForce::NoCutoff);
+    force->setGBPairTreecodeAccuracy(0.3);
+    context.reinitialize();
+    context.setPositions(positions);
+    State state_treecode = context.getState(State::Energy | State::Forces);
+    std::cout << "Energy with GB pair treecode: " <<  state_treecode.getPotentialEnergy()  << std::endl;
+    ASSERT_EQUAL_TOL(energy1, state_treecode.getPotentialEnergy(), 1.e-5);
+    for(int i = 0; i < numParticles; i++){
+      ASSERT_EQUAL_VEC(state.getForces()[i], state_treecode.getForces()[i], 1.e-3);
+    }
+    force->setGBPairTreecodeAccuracy(0.0);
+    force->setNonbondedMethod(AGBNPForce::CutoffNonPeriodic);
+
+    testPeriodic(system, force, positions);
+
+    testTreeSkin(system, force, positions, 1);
+    testTreeSkin(system, force, positions, 2);
+
+    testGaussVolPrecisions(positions, radii, gammas, ihi);
+
+    testSteadyStateAllocations(system, force, positions, 1);
+    testSteadyStateAllocations(system, force, positions, 2);
+
 #ifdef NOTNOW
     // validate force by moving heavy atoms
     vector<RealVec> forces;
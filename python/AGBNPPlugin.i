@@ -11,6 +11,7 @@
  */
 
 %include "std_vector.i"
+%include "std_string.i"
 namespace std {
   %template(vectord) vector<double>;
   %template(vectori) vector<int>;
@@ -59,6 +60,10 @@ public:
     
     void updateParametersInContext(OpenMM::Context& context);
 
+    int getNumTreeOverflows(OpenMM::Context& context);
+
+    std::string getKernelLaunchReport(OpenMM::Context& context);
+
     void setCutoffDistance(double distance);
 
     enum NonbondedMethod {
@@ -70,6 +75,26 @@ public:
     void setNonbondedMethod(NonbondedMethod method);
 
     void setVersion(int agbnp_version);
+
+    void setGBPairTreecodeAccuracy(double theta);
+
+    double getGBPairTreecodeAccuracy() const;
+
+    void setGBPairTreecodeOrder(int order);
+
+    int getGBPairTreecodeOrder() const;
+
+    void setTreeSkin(double skin);
+
+    double getTreeSkin() const;
+
+    void setUseFusedKernels(bool fused);
+
+    bool getUseFusedKernels() const;
+
+    void setProgramCacheDirectory(const std::string& directory);
+
+    const std::string& getProgramCacheDirectory() const;
     /*
      * The reference parameters to this function are output values.
      * Marking them as such will cause swig to return a tuple.